@@ -0,0 +1,24 @@
+// libFuzzer target for the version 1 server message parser, build it with
+// cmake -DCRAFT_FUZZ=ON and clang, then run ./message-fuzz
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "message.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *line = malloc(size + 1);
+    memcpy(line, data, size);
+    line[size] = '\0';
+    Message message;
+    if (message_parse(line, &message) == 0) {
+        if (message.count < 1 || message.count > MESSAGE_FIELDS) {
+            abort();
+        }
+        if (message.text && strlen(message.text) > size) {
+            abort();
+        }
+    }
+    free(line);
+    return 0;
+}
@@ -1,3 +1,4 @@
+from collections import OrderedDict
 from math import floor
 from world import World
 import Queue
@@ -7,6 +8,7 @@ import random
 import re
 import requests
 import sqlite3
+import struct
 import sys
 import threading
 import time
@@ -42,15 +44,45 @@ CHUNK = 'C'
 DISCONNECT = 'D'
 KEY = 'K'
 LIGHT = 'L'
+MOVE = 'M'
 NICK = 'N'
 POSITION = 'P'
 REDRAW = 'R'
 SIGN = 'S'
 TALK = 'T'
 TIME = 'E'
+UNLOAD = 'X'
 VERSION = 'V'
 YOU = 'U'
 
+# protocol version 2 frames: payload size and type, then the payload
+PROTOCOL_VERSION = 2
+FRAME = struct.Struct('<IB')
+MAX_FRAME = 512 * 1024
+RECORDS = {
+    BLOCK: struct.Struct('<6i'),
+    LIGHT: struct.Struct('<6i'),
+    POSITION: struct.Struct('<i5f'),
+    MOVE: struct.Struct('<i5h'),
+    KEY: struct.Struct('<3i'),
+    REDRAW: struct.Struct('<2i'),
+}
+CHUNK_REQUEST = struct.Struct('<3i')
+CHUNK_HEADER = struct.Struct('<5i')
+CHUNK_ENTRY = struct.Struct('<BBBb')
+CHUNK_ENTRIES = 65536
+POSITION_SCALES = (64, 64, 64, 1024, 1024)
+
+# positions are relayed less often to players further away, once per
+# RELAY_INTERVAL for every RELAY_DISTANCE blocks between them
+RELAY_DISTANCE = 64
+RELAY_INTERVAL = 0.1
+RELAY_MAX_INTERVAL = 1.0
+
+# clients only hear about changes to chunks they requested, up to
+# MAX_SUBSCRIPTIONS of their most recently requested chunks
+MAX_SUBSCRIPTIONS = 4096
+
 try:
     from config import *
 except ImportError:
@@ -69,6 +101,38 @@ def chunked(x):
 def packet(*args):
     return '%s\n' % ','.join(map(str, args))
 
+def frame(*args):
+    command = args[0]
+    if command in RECORDS:
+        payload = RECORDS[command].pack(*args[1:])
+    else:
+        payload = ','.join(map(unicode, args)).encode('utf-8')
+    return FRAME.pack(len(payload), ord(command)) + payload
+
+def quantize(position):
+    return tuple(int(round(x * s)) for x, s in zip(position, POSITION_SCALES))
+
+def dequantize(fixed):
+    return tuple(float(x) / s for x, s in zip(fixed, POSITION_SCALES))
+
+def chunk_frames(p, q, key, blocks, lights):
+    # large responses are split, only the last record carries the key and
+    # the last record is never full so that it also ends the response
+    result = []
+    dx, dz = p * CHUNK_SIZE, q * CHUNK_SIZE
+    while True:
+        b, blocks = blocks[:CHUNK_ENTRIES], blocks[CHUNK_ENTRIES:]
+        n = CHUNK_ENTRIES - len(b)
+        l, lights = lights[:n], lights[n:]
+        last = len(b) + len(l) < CHUNK_ENTRIES
+        entries = [
+            CHUNK_ENTRY.pack(x - dx, y, z - dz, w) for x, y, z, w in b + l]
+        payload = CHUNK_HEADER.pack(
+            p, q, key if last else 0, len(b), len(l)) + ''.join(entries)
+        result.append(FRAME.pack(len(payload), ord(CHUNK)) + payload)
+        if last:
+            return ''.join(result)
+
 class RateLimiter(object):
     def __init__(self, rate, per):
         self.rate = float(rate)
@@ -102,6 +166,10 @@ class Handler(SocketServer.BaseRequestHandler):
         self.client_id = None
         self.user_id = None
         self.nick = None
+        self.base = None
+        self.relays = {}
+        self.stale = set()
+        self.chunks = OrderedDict()
         self.queue = Queue.Queue()
         self.running = True
         self.start()
@@ -109,31 +177,62 @@ class Handler(SocketServer.BaseRequestHandler):
         model = self.server.model
         model.enqueue(model.on_connect, self)
         try:
-            buf = []
+            buf = ''
+            framed = False
             while True:
                 data = self.request.recv(BUFFER_SIZE)
                 if not data:
                     break
-                buf.extend(data.replace('\r\n', '\n'))
-                while '\n' in buf:
-                    index = buf.index('\n')
-                    line = ''.join(buf[:index])
-                    buf = buf[index + 1:]
-                    if not line:
-                        continue
-                    if line[0] == POSITION:
-                        if self.position_limiter.tick():
-                            log('RATE', self.client_id)
-                            self.stop()
-                            return
-                    else:
-                        if self.limiter.tick():
-                            log('RATE', self.client_id)
-                            self.stop()
-                            return
-                    model.enqueue(model.on_data, self, line)
+                buf += data
+                if not framed:
+                    buf, framed = self.read_lines(buf)
+                if framed and buf is not None:
+                    buf = self.read_frames(buf)
+                if buf is None:
+                    return
         finally:
             model.enqueue(model.on_disconnect, self)
+    def read_lines(self, buf):
+        # returns the unread data and whether the client switched to frames
+        model = self.server.model
+        upgrade = '%s,%d' % (VERSION, PROTOCOL_VERSION)
+        while '\n' in buf:
+            line, buf = buf.split('\n', 1)
+            line = line.rstrip('\r')
+            if not line:
+                continue
+            if line == upgrade and self.version == PROTOCOL_VERSION:
+                # the client's frames start after this line
+                return buf, True
+            if not self.tick(line[0]):
+                return None, False
+            model.enqueue(model.on_data, self, line)
+        return buf, False
+    def read_frames(self, buf):
+        model = self.server.model
+        while len(buf) >= FRAME.size:
+            size, command = FRAME.unpack_from(buf)
+            if size > MAX_FRAME:
+                self.stop()
+                return None
+            if len(buf) < FRAME.size + size:
+                break
+            payload = buf[FRAME.size:FRAME.size + size]
+            buf = buf[FRAME.size + size:]
+            command = chr(command)
+            if not self.tick(command):
+                return None
+            model.enqueue(model.on_frame, self, command, payload)
+        return buf
+    def tick(self, command):
+        limiter = self.limiter
+        if command in (POSITION, MOVE):
+            limiter = self.position_limiter
+        if limiter.tick():
+            log('RATE', self.client_id)
+            self.stop()
+            return False
+        return True
     def finish(self):
         self.running = False
     def stop(self):
@@ -164,12 +263,16 @@ class Handler(SocketServer.BaseRequestHandler):
         if data:
             self.queue.put(data)
     def send(self, *args):
-        self.send_raw(packet(*args))
+        if self.version == PROTOCOL_VERSION:
+            self.send_raw(frame(*args))
+        else:
+            self.send_raw(packet(*args))
 
 class Model(object):
     def __init__(self, seed):
         self.world = World(seed)
         self.clients = []
+        self.subscribers = {}
         self.queue = Queue.Queue()
         self.commands = {
             AUTHENTICATE: self.on_authenticate,
@@ -179,6 +282,7 @@ class Model(object):
             POSITION: self.on_position,
             TALK: self.on_talk,
             SIGN: self.on_sign,
+            UNLOAD: self.on_unload,
             VERSION: self.on_version,
         }
         self.patterns = [
@@ -202,13 +306,14 @@ class Model(object):
                 if time.time() - self.last_commit > COMMIT_INTERVAL:
                     self.commit()
                 self.dequeue()
+                self.relay_positions()
             except Exception:
                 traceback.print_exc()
     def enqueue(self, func, *args, **kwargs):
         self.queue.put((func, args, kwargs))
     def dequeue(self):
         try:
-            func, args, kwargs = self.queue.get(timeout=5)
+            func, args, kwargs = self.queue.get(timeout=RELAY_INTERVAL)
             func(*args, **kwargs)
         except Queue.Empty:
             pass
@@ -259,9 +364,26 @@ class Model(object):
             '   z int not null,'
             '   w int not null'
             ');',
+            'create table if not exists migration ('
+            '    name text not null'
+            ');',
+            'create unique index if not exists migration_name_idx on '
+            '    migration (name);',
         ]
         for query in queries:
             self.execute(query)
+        query = 'select count(*) from migration where name = :name;'
+        if not list(self.execute(query, dict(name='borders')))[0][0]:
+            # older versions stored copies of edge blocks in the neighbours,
+            # the marker is the one the client keeps in the same table
+            query = (
+                'delete from block where '
+                'x < p * :n or x >= (p + 1) * :n or '
+                'z < q * :n or z >= (q + 1) * :n;'
+            )
+            self.execute(query, dict(n=CHUNK_SIZE))
+            query = 'insert into migration (name) values (:name);'
+            self.execute(query, dict(name='borders'))
     def get_default_block(self, x, y, z):
         p, q = chunked(x), chunked(z)
         chunk = self.world.get_chunk(p, q)
@@ -306,16 +428,44 @@ class Model(object):
     def on_disconnect(self, client):
         log('DISC', client.client_id, *client.client_address)
         self.clients.remove(client)
+        for key in list(client.chunks):
+            self.unsubscribe(client, key)
+        for other in self.clients:
+            other.relays.pop(client.client_id, None)
+            other.stale.discard(client)
         self.send_disconnect(client)
         self.send_talk('%s has disconnected from the server.' % client.nick)
+    def on_frame(self, client, command, payload):
+        if command in RECORDS:
+            record = RECORDS[command]
+            if len(payload) != record.size:
+                return
+            args = record.unpack(payload)
+            if command == BLOCK:
+                self.on_block(client, *args[2:])
+            elif command == LIGHT:
+                self.on_light(client, *args[2:])
+            elif command == POSITION:
+                self.on_position(client, *args[1:])
+            elif command == MOVE:
+                self.on_move(client, *args[1:])
+        elif command == CHUNK:
+            if len(payload) == CHUNK_REQUEST.size:
+                self.on_chunk(client, *CHUNK_REQUEST.unpack(payload))
+        else:
+            self.on_data(client, payload.decode('utf-8'))
     def on_version(self, client, version):
-        if client.version is not None:
-            return
         version = int(version)
-        if version != 1:
-            client.stop()
-            return
-        client.version = version
+        if client.version is None:
+            if version != 1:
+                client.stop()
+                return
+            client.version = version
+        elif client.version == 1 and version == PROTOCOL_VERSION:
+            # switch before answering, the answer is the last line sent
+            # as text and the client's frames follow its own V line
+            client.version = version
+            client.send_raw(packet(VERSION, version))
         # TODO: client.start() here
     def on_authenticate(self, client, username, access_token):
         user_id = None
@@ -336,37 +486,63 @@ class Model(object):
         self.send_nick(client)
         # TODO: has left message if was already authenticated
         self.send_talk('%s has joined the game.' % client.nick)
+    def subscribe(self, client, p, q):
+        # requesting a chunk again makes it the most recently requested
+        key = (p, q)
+        if key in client.chunks:
+            del client.chunks[key]
+        else:
+            if len(client.chunks) >= MAX_SUBSCRIPTIONS:
+                self.unsubscribe(client, next(iter(client.chunks)))
+            self.subscribers.setdefault(key, set()).add(client)
+        client.chunks[key] = True
+    def unsubscribe(self, client, key):
+        client.chunks.pop(key, None)
+        subscribers = self.subscribers.get(key)
+        if subscribers is not None:
+            subscribers.discard(client)
+            if not subscribers:
+                del self.subscribers[key]
+    def on_unload(self, client, p, q):
+        self.unsubscribe(client, (int(p), int(q)))
     def on_chunk(self, client, p, q, key=0):
-        packets = []
         p, q, key = map(int, (p, q, key))
+        self.subscribe(client, p, q)
         query = (
             'select rowid, x, y, z, w from block where '
             'p = :p and q = :q and rowid > :key;'
         )
         rows = self.execute(query, dict(p=p, q=q, key=key))
         max_rowid = 0
-        blocks = 0
+        blocks = []
         for rowid, x, y, z, w in rows:
-            blocks += 1
-            packets.append(packet(BLOCK, p, q, x, y, z, w))
+            blocks.append((x, y, z, w))
             max_rowid = max(max_rowid, rowid)
         query = (
             'select x, y, z, w from light where '
             'p = :p and q = :q;'
         )
         rows = self.execute(query, dict(p=p, q=q))
-        lights = 0
-        for x, y, z, w in rows:
-            lights += 1
-            packets.append(packet(LIGHT, p, q, x, y, z, w))
+        lights = list(rows)
         query = (
             'select x, y, z, face, text from sign where '
             'p = :p and q = :q;'
         )
         rows = self.execute(query, dict(p=p, q=q))
-        signs = 0
-        for x, y, z, face, text in rows:
-            signs += 1
+        signs = list(rows)
+        if client.version == PROTOCOL_VERSION:
+            packets = [frame(SIGN, p, q, *row) for row in signs]
+            packets.append(chunk_frames(p, q, max_rowid, blocks, lights))
+            if blocks or lights or signs:
+                packets.append(frame(REDRAW, p, q))
+            client.send_raw(''.join(packets))
+            return
+        packets = []
+        for x, y, z, w in blocks:
+            packets.append(packet(BLOCK, p, q, x, y, z, w))
+        for x, y, z, w in lights:
+            packets.append(packet(LIGHT, p, q, x, y, z, w))
+        for x, y, z, face, text in signs:
             packets.append(packet(SIGN, p, q, x, y, z, face, text))
         if blocks:
             packets.append(packet(KEY, p, q, max_rowid))
@@ -409,17 +585,6 @@ class Model(object):
         )
         self.execute(query, dict(p=p, q=q, x=x, y=y, z=z, w=w))
         self.send_block(client, p, q, x, y, z, w)
-        for dx in range(-1, 2):
-            for dz in range(-1, 2):
-                if dx == 0 and dz == 0:
-                    continue
-                if dx and chunked(x + dx) == p:
-                    continue
-                if dz and chunked(z + dz) == q:
-                    continue
-                np, nq = p + dx, q + dz
-                self.execute(query, dict(p=np, q=nq, x=x, y=y, z=z, w=-w))
-                self.send_block(client, np, nq, x, y, z, -w)
         if w == 0:
             query = (
                 'delete from sign where '
@@ -483,6 +648,13 @@ class Model(object):
     def on_position(self, client, x, y, z, rx, ry):
         x, y, z, rx, ry = map(float, (x, y, z, rx, ry))
         client.position = (x, y, z, rx, ry)
+        client.base = quantize(client.position)
+        self.send_position(client)
+    def on_move(self, client, *deltas):
+        if client.base is None:
+            return
+        client.base = tuple(x + d for x, d in zip(client.base, deltas))
+        client.position = dequantize(client.base)
         self.send_position(client)
     def on_talk(self, client, *args):
         text = ','.join(args)
@@ -582,15 +754,54 @@ class Model(object):
         client.send(TALK,
             'Players: %s' % ', '.join(x.nick for x in self.clients))
     def send_positions(self, client):
+        now = time.time()
         for other in self.clients:
             if other == client:
                 continue
-            client.send(POSITION, other.client_id, *other.position)
+            self.relay_position(other, client, now)
     def send_position(self, client):
+        now = time.time()
         for other in self.clients:
             if other == client:
                 continue
+            if self.relay_due(client, other, now):
+                self.relay_position(client, other, now)
+            else:
+                other.stale.add(client)
+    def relay_positions(self):
+        now = time.time()
+        for other in self.clients:
+            for client in list(other.stale):
+                if self.relay_due(client, other, now):
+                    self.relay_position(client, other, now)
+    def relay_due(self, client, other, now):
+        if client.client_id not in other.relays:
+            return True
+        x1, _, z1 = client.position[:3]
+        x2, _, z2 = other.position[:3]
+        distance = max(abs(x1 - x2), abs(z1 - z2))
+        interval = min(
+            RELAY_MAX_INTERVAL,
+            RELAY_INTERVAL * int(distance / RELAY_DISTANCE))
+        return now - other.relays[client.client_id][1] >= interval
+    def relay_position(self, client, other, now):
+        # version 2 clients get moves from the last position relayed to
+        # them, full positions carry quantized values to start from
+        other.stale.discard(client)
+        base = other.relays.get(client.client_id, (None, 0))[0]
+        if other.version != PROTOCOL_VERSION:
+            other.relays[client.client_id] = (None, now)
             other.send(POSITION, client.client_id, *client.position)
+            return
+        fixed = quantize(client.position)
+        other.relays[client.client_id] = (fixed, now)
+        if base is not None:
+            deltas = [x - y for x, y in zip(fixed, base)]
+            if all(-32768 <= d <= 32767 for d in deltas):
+                if any(deltas):
+                    other.send(MOVE, client.client_id, *deltas)
+                return
+        other.send(POSITION, client.client_id, *dequantize(fixed))
     def send_nicks(self, client):
         for other in self.clients:
             if other == client:
@@ -605,19 +816,19 @@ class Model(object):
                 continue
             other.send(DISCONNECT, client.client_id)
     def send_block(self, client, p, q, x, y, z, w):
-        for other in self.clients:
+        for other in self.subscribers.get((p, q), ()):
             if other == client:
                 continue
             other.send(BLOCK, p, q, x, y, z, w)
             other.send(REDRAW, p, q)
     def send_light(self, client, p, q, x, y, z, w):
-        for other in self.clients:
+        for other in self.subscribers.get((p, q), ()):
             if other == client:
                 continue
             other.send(LIGHT, p, q, x, y, z, w)
             other.send(REDRAW, p, q)
     def send_sign(self, client, p, q, x, y, z, face, text):
-        for other in self.clients:
+        for other in self.subscribers.get((p, q), ()):
             if other == client:
                 continue
             other.send(SIGN, p, q, x, y, z, face, text)
@@ -0,0 +1,45 @@
+// sigwait for a clean shutdown on SIGINT and SIGTERM
+#define _POSIX_C_SOURCE 200112L
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+#include "server.h"
+
+#define DEFAULT_HOST "0.0.0.0"
+#define DEFAULT_PORT 4080
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : DEFAULT_HOST;
+    int port = argc > 2 ? atoi(argv[2]) : DEFAULT_PORT;
+    // block the signals before any thread starts so that only sigwait
+    // below gets them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (server_open(SERVER_DB_PATH, SERVER_LOG_PATH)) {
+        fprintf(stderr, "cannot open %s\n", SERVER_DB_PATH);
+        return EXIT_FAILURE;
+    }
+    if (server_listen(host, port) < 0) {
+        fprintf(stderr, "cannot listen on %s %d\n", host, port);
+        return EXIT_FAILURE;
+    }
+    printf("SERV %s %d\n", host, port);
+    fflush(stdout);
+    // logins ask the login server on threads of their own
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    server_start();
+    sigdelset(&signals, SIGPIPE);
+    int number;
+    sigwait(&signals, &number);
+    server_stop();
+    curl_global_cleanup();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,850 @@
+// clock_gettime for the wall clock the time of day is sent in
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "auth.h"
+#include "config.h"
+#include "model.h"
+#include "proto.h"
+#include "shard.h"
+#include "subscription.h"
+#include "tinycthread.h"
+
+#define MODEL_LINE_SIZE 4096
+#define MODEL_NICK_SIZE 64
+
+static const float spawn_point[5] = {0, 0, 0, 0, 0};
+
+// the last position relayed about one player to another, version 2
+// receivers get moves from its quantized values
+typedef struct {
+    int relayed;
+    int based;
+    int stale;
+    int base[5];
+    double time;
+} Relay;
+
+// Clients with commands in a shard keep their protocol version, shards
+// encode what they send with the version the command was handed over
+// with, so a switch to version 2 waits until they are done.
+typedef struct {
+    int connected;
+    int generation;
+    int version;
+    int pending;
+    int upgrading;
+    int client_id;
+    int user_id;
+    char nick[MODEL_NICK_SIZE];
+    char address[64];
+    float position[5];
+    int based;
+    int base[5];
+    Relay *relays; // by slot, allocated while connected
+    int *stale;
+    int stale_count;
+} Client;
+
+typedef struct {
+    int slot;
+    int generation;
+    char username[MODEL_NICK_SIZE];
+    char access_token[128];
+} Login;
+
+static Client *clients;
+static int auth_required = SERVER_AUTH_REQUIRED;
+static FILE *log_file;
+static mtx_t log_mtx;
+
+double _model_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void model_log(const char *format, ...) {
+    char line[MODEL_LINE_SIZE];
+    char stamp[32];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_t seconds = ts.tv_sec;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    mtx_lock(&log_mtx);
+    printf("%s.%06ld %s\n", stamp, ts.tv_nsec / 1000, line);
+    fflush(stdout);
+    if (log_file) {
+        fprintf(log_file, "%s.%06ld %s\n", stamp, ts.tv_nsec / 1000, line);
+        fflush(log_file);
+    }
+    mtx_unlock(&log_mtx);
+}
+
+int _model_chunked(double x) {
+    return floor(round(x) / CHUNK_SIZE);
+}
+
+int model_open(const char *db_path, const char *log_path) {
+    mtx_init(&log_mtx, mtx_plain);
+    if (log_path) {
+        log_file = fopen(log_path, "a");
+    }
+    if (shard_open(db_path) || subscription_open(SERVER_MAX_CLIENTS)) {
+        model_close();
+        return -1;
+    }
+    clients = calloc(SERVER_MAX_CLIENTS, sizeof(Client));
+    return 0;
+}
+
+void model_close() {
+    shard_close();
+    subscription_close();
+    for (int i = 0; clients && i < SERVER_MAX_CLIENTS; i++) {
+        free(clients[i].relays);
+        free(clients[i].stale);
+    }
+    free(clients);
+    clients = 0;
+    if (log_file) {
+        fclose(log_file);
+        log_file = 0;
+    }
+    mtx_destroy(&log_mtx);
+}
+
+void model_set_auth(int required) {
+    auth_required = required;
+    shard_set_auth(required);
+}
+
+void model_write(const Target *target, const char *data, int length) {
+    server_send(target->slot, target->generation, data, length);
+}
+
+void _model_vsend(const Target *target, const char *format, va_list args) {
+    char line[MODEL_LINE_SIZE];
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    if (length < 0) {
+        return;
+    }
+    if (length > (int)sizeof(line) - 2) {
+        length = sizeof(line) - 2;
+    }
+    if (target->version == PROTO_VERSION) {
+        char frame[PROTO_HEADER_SIZE + MODEL_LINE_SIZE];
+        line[length] = '\0';
+        length = proto_text(frame, sizeof(frame), line);
+        if (length > 0) {
+            model_write(target, frame, length);
+        }
+        return;
+    }
+    line[length++] = '\n';
+    model_write(target, line, length);
+}
+
+// Sends a message as a line, or as a text frame to version 2 clients
+void model_send(const Target *target, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    _model_vsend(target, format, args);
+    va_end(args);
+}
+
+void model_send_block(
+    const Target *target, char type, int p, int q, int x, int y, int z, int w)
+{
+    if (target->version == PROTO_VERSION) {
+        char data[PROTO_BLOCK_SIZE];
+        model_write(target, data, proto_block(data, type, p, q, x, y, z, w));
+        return;
+    }
+    model_send(target, "%c,%d,%d,%d,%d,%d,%d", type, p, q, x, y, z, w);
+}
+
+void model_send_redraw(const Target *target, int p, int q) {
+    if (target->version == PROTO_VERSION) {
+        char data[PROTO_REDRAW_SIZE];
+        model_write(target, data, proto_redraw(data, p, q));
+        return;
+    }
+    model_send(target, "R,%d,%d", p, q);
+}
+
+int _model_slot(Client *client) {
+    return client - clients;
+}
+
+Target _model_target(Client *client) {
+    Target target = {_model_slot(client), client->generation, client->version};
+    return target;
+}
+
+void _model_write(Client *client, const char *data, int length) {
+    Target target = _model_target(client);
+    model_write(&target, data, length);
+}
+
+void _model_send(Client *client, const char *format, ...) {
+    Target target = _model_target(client);
+    va_list args;
+    va_start(args, format);
+    _model_vsend(&target, format, args);
+    va_end(args);
+}
+
+void _model_send_you(Client *client) {
+    float *s = client->position;
+    _model_send(client, "U,%d,%.2f,%.2f,%.2f,%.2f,%.2f",
+        client->client_id, s[0], s[1], s[2], s[3], s[4]);
+}
+
+void _model_send_talk(const char *format, ...) {
+    char text[MODEL_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    model_log("%s", text);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].connected) {
+            _model_send(clients + i, "T,%s", text);
+        }
+    }
+}
+
+void _model_send_nick(Client *client) {
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].connected) {
+            _model_send(clients + i, "N,%d,%s", client->client_id, client->nick);
+        }
+    }
+}
+
+void _model_send_nicks(Client *client) {
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Client *other = clients + i;
+        if (other->connected && other != client) {
+            _model_send(client, "N,%d,%s", other->client_id, other->nick);
+        }
+    }
+}
+
+int _model_relay_due(Client *client, Client *other, double now) {
+    Relay *relay = other->relays + _model_slot(client);
+    if (!relay->relayed) {
+        return 1;
+    }
+    float dx = fabsf(client->position[0] - other->position[0]);
+    float dz = fabsf(client->position[2] - other->position[2]);
+    float distance = dx > dz ? dx : dz;
+    double interval = RELAY_INTERVAL * (int)(distance / RELAY_DISTANCE);
+    if (interval > RELAY_MAX_INTERVAL) {
+        interval = RELAY_MAX_INTERVAL;
+    }
+    return now - relay->time >= interval;
+}
+
+// Version 2 clients get moves from the last position relayed to them,
+// full positions carry quantized values to start from
+void _model_relay_position(Client *client, Client *other, double now) {
+    Relay *relay = other->relays + _model_slot(client);
+    relay->stale = 0;
+    relay->relayed = 1;
+    relay->time = now;
+    if (other->version != PROTO_VERSION) {
+        float *s = client->position;
+        relay->based = 0;
+        _model_send(other, "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f",
+            client->client_id, s[0], s[1], s[2], s[3], s[4]);
+        return;
+    }
+    int fixed[5];
+    proto_quantize(client->position, fixed);
+    if (relay->based) {
+        char data[PROTO_MOVE_SIZE];
+        int length = proto_move(data, client->client_id, relay->base, fixed);
+        if (length > 0) {
+            if (memcmp(relay->base, fixed, sizeof(fixed))) {
+                _model_write(other, data, length);
+            }
+            memcpy(relay->base, fixed, sizeof(fixed));
+            return;
+        }
+    }
+    float s[5];
+    char data[PROTO_POSITION_SIZE];
+    proto_dequantize(fixed, s);
+    _model_write(other, data, proto_position(
+        data, client->client_id, s[0], s[1], s[2], s[3], s[4]));
+    relay->based = 1;
+    memcpy(relay->base, fixed, sizeof(fixed));
+}
+
+void _model_send_positions(Client *client) {
+    double now = _model_time();
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Client *other = clients + i;
+        if (other->connected && other != client) {
+            _model_relay_position(other, client, now);
+        }
+    }
+}
+
+void _model_send_position(Client *client) {
+    double now = _model_time();
+    int slot = _model_slot(client);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Client *other = clients + i;
+        if (!other->connected || other == client) {
+            continue;
+        }
+        if (_model_relay_due(client, other, now)) {
+            _model_relay_position(client, other, now);
+        }
+        else if (!other->relays[slot].stale) {
+            other->relays[slot].stale = 1;
+            other->stale[other->stale_count++] = slot;
+        }
+    }
+}
+
+void _model_relay_positions() {
+    double now = _model_time();
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Client *other = clients + i;
+        if (!other->connected) {
+            continue;
+        }
+        int count = 0;
+        for (int j = 0; j < other->stale_count; j++) {
+            int slot = other->stale[j];
+            Client *client = clients + slot;
+            if (_model_relay_due(client, other, now)) {
+                _model_relay_position(client, other, now);
+            }
+            else {
+                other->stale[count++] = slot;
+            }
+        }
+        other->stale_count = count;
+    }
+}
+
+void _model_on_connect(Client *client, int generation, const char *address) {
+    memset(client, 0, sizeof(Client));
+    int client_id = 1;
+    for (int found = 1; found; ) {
+        found = 0;
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            if (clients[i].connected && clients[i].client_id == client_id) {
+                client_id++;
+                found = 1;
+            }
+        }
+    }
+    client->connected = 1;
+    client->generation = generation;
+    client->relays = calloc(SERVER_MAX_CLIENTS, sizeof(Relay));
+    client->stale = calloc(SERVER_MAX_CLIENTS, sizeof(int));
+    client->client_id = client_id;
+    client->user_id = -1;
+    snprintf(client->nick, sizeof(client->nick), "guest%d", client_id);
+    snprintf(client->address, sizeof(client->address), "%s",
+        address ? address : "");
+    memcpy(client->position, spawn_point, sizeof(spawn_point));
+    model_log("CONN %d %s", client_id, client->address);
+    _model_send_you(client);
+    _model_send(client, "E,%f,%d", _model_time(), DAY_LENGTH);
+    _model_send(client, "T,Welcome to Craft!");
+    _model_send(client, "T,Type \"/help\" for a list of commands.");
+    _model_send_position(client);
+    _model_send_positions(client);
+    _model_send_nick(client);
+    _model_send_nicks(client);
+}
+
+void _model_on_disconnect(Client *client) {
+    int slot = _model_slot(client);
+    model_log("DISC %d %s", client->client_id, client->address);
+    client->connected = 0;
+    subscription_clear(slot);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Client *other = clients + i;
+        if (!other->connected) {
+            continue;
+        }
+        if (other->relays[slot].stale) {
+            for (int j = 0; j < other->stale_count; j++) {
+                if (other->stale[j] == slot) {
+                    other->stale[j] = other->stale[--other->stale_count];
+                    break;
+                }
+            }
+        }
+        memset(other->relays + slot, 0, sizeof(Relay));
+        _model_send(other, "D,%d", client->client_id);
+    }
+    _model_send_talk("%s has disconnected from the server.", client->nick);
+    free(client->relays);
+    free(client->stale);
+    client->relays = 0;
+    client->stale = 0;
+    server_release(slot);
+}
+
+void _model_upgrade(Client *client) {
+    // switch before answering, the answer is the last line sent as text
+    // and the client's frames follow its own V line
+    char line[16];
+    int length = snprintf(line, sizeof(line), "V,%d\n", PROTO_VERSION);
+    client->version = PROTO_VERSION;
+    server_set_version(_model_slot(client), PROTO_VERSION);
+    _model_write(client, line, length);
+}
+
+void _model_on_version(Client *client, int version) {
+    if (!client->version) {
+        if (version != 1) {
+            server_drop(_model_slot(client));
+            return;
+        }
+        client->version = version;
+    }
+    else if (client->version == 1 && version == PROTO_VERSION) {
+        if (client->pending) {
+            client->upgrading = 1;
+        }
+        else {
+            _model_upgrade(client);
+        }
+    }
+}
+
+int _model_login_worker(void *arg) {
+    Login *login = (Login *)arg;
+    Command command = {COMMAND_LOGIN, login->slot, login->generation};
+    command.fields[0].i = get_user_id(login->username, login->access_token);
+    command.text = malloc(strlen(login->username) + 1);
+    strcpy(command.text, login->username);
+    server_command(&command);
+    free(login);
+    return 0;
+}
+
+void _model_on_login(Client *client, int user_id, const char *username) {
+    client->user_id = user_id;
+    if (user_id < 0) {
+        snprintf(client->nick, sizeof(client->nick),
+            "guest%d", client->client_id);
+        _model_send(client, "T,Visit craft.michaelfogleman.com to register!");
+    }
+    else {
+        snprintf(client->nick, sizeof(client->nick), "%s", username);
+    }
+    _model_send_nick(client);
+    _model_send_talk("%s has joined the game.", client->nick);
+}
+
+// The login server is asked on a thread of its own, its answer comes back
+// as a login command so that other clients are not kept waiting
+void _model_on_authenticate(Client *client, int generation, char *text) {
+    char *access_token = strchr(text, ',');
+    if (access_token) {
+        *access_token++ = '\0';
+    }
+    if (!access_token || !*text || !*access_token) {
+        _model_on_login(client, -1, text);
+        return;
+    }
+    Login *login = calloc(1, sizeof(Login));
+    login->slot = _model_slot(client);
+    login->generation = generation;
+    snprintf(login->username, sizeof(login->username), "%s", text);
+    snprintf(login->access_token, sizeof(login->access_token),
+        "%s", access_token);
+    thrd_t thrd;
+    if (thrd_create(&thrd, _model_login_worker, login) != thrd_success) {
+        free(login);
+        _model_on_login(client, -1, text);
+        return;
+    }
+    thrd_detach(thrd);
+}
+
+// Hands a world command to the shard that owns its chunk, the text goes
+// with it
+void _model_route(Client *client, Command *command, int p, int q) {
+    command->user_id = client->user_id;
+    command->version = client->version;
+    client->pending++;
+    shard_put(shard_index(p, q), command);
+    command->text = 0;
+}
+
+void _model_on_done(Command *command) {
+    Client *client = clients + command->slot;
+    int own = client->connected && client->generation == command->generation;
+    MessageField *f = command->fields;
+    char type = f[0].i;
+    const int *slots;
+    int count = type ? subscription_get(f[1].i, f[2].i, &slots) : 0;
+    for (int i = 0; i < count; i++) {
+        Client *other = clients + slots[i];
+        if (!other->connected || (own && other == client)) {
+            continue;
+        }
+        if (type == 'S') {
+            _model_send(other, "S,%d,%d,%d,%d,%d,%d,%s",
+                f[1].i, f[2].i, f[3].i, f[4].i, f[5].i, f[6].i, command->text);
+        }
+        else {
+            Target target = _model_target(other);
+            model_send_block(&target, type,
+                f[1].i, f[2].i, f[3].i, f[4].i, f[5].i, f[6].i);
+            model_send_redraw(&target, f[1].i, f[2].i);
+        }
+    }
+    if (own && !--client->pending && client->upgrading) {
+        client->upgrading = 0;
+        _model_upgrade(client);
+    }
+}
+
+void _model_on_position(Client *client, const float *position) {
+    memcpy(client->position, position, sizeof(client->position));
+    proto_quantize(client->position, client->base);
+    client->based = 1;
+    _model_send_position(client);
+}
+
+void _model_on_move(Client *client, const int *deltas) {
+    if (!client->based) {
+        return;
+    }
+    for (int i = 0; i < 5; i++) {
+        client->base[i] += deltas[i];
+    }
+    proto_dequantize(client->base, client->position);
+    _model_send_position(client);
+}
+
+void _model_teleport(Client *client, const float *position) {
+    memcpy(client->position, position, sizeof(client->position));
+    _model_send_you(client);
+    _model_send_position(client);
+}
+
+Client *_model_find(const char *nick) {
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].connected && !strcmp(clients[i].nick, nick)) {
+            return clients + i;
+        }
+    }
+    return 0;
+}
+
+int _model_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+        c == '\v' || c == '\f';
+}
+
+// Matches "/name" with an optional argument, a word without whitespace and
+// without any of the reject characters, the way server.py's patterns do
+int _model_command(
+    const char *text, const char *name, char *arg, int size,
+    const char *reject)
+{
+    int length = strlen(name);
+    *arg = '\0';
+    if (text[0] != '/' || strncmp(text + 1, name, length)) {
+        return 0;
+    }
+    text += length + 1;
+    if (!*text) {
+        return 1;
+    }
+    if (!reject || !_model_space(*text)) {
+        return 0;
+    }
+    while (_model_space(*text)) {
+        text++;
+    }
+    int n = 0;
+    while (text[n] && !_model_space(text[n]) && !strchr(reject, text[n])) {
+        n++;
+    }
+    if (!n || text[n] || n >= size) {
+        return 0;
+    }
+    memcpy(arg, text, n + 1);
+    return 1;
+}
+
+int _model_pq(const char *text, long *p, long *q) {
+    char *end;
+    if (strncmp(text, "/pq", 3) || !_model_space(text[3])) {
+        return 0;
+    }
+    text += 3;
+    while (_model_space(*text)) {
+        text++;
+    }
+    if (*text == '+' || !strchr("-0123456789", *text)) {
+        return 0;
+    }
+    *p = strtol(text, &end, 10);
+    if (end == text || (*text == '-' && end == text + 1)) {
+        return 0;
+    }
+    text = end;
+    while (_model_space(*text)) {
+        text++;
+    }
+    if (*text == ',') {
+        text++;
+    }
+    while (_model_space(*text)) {
+        text++;
+    }
+    if (*text == '+' || !strchr("-0123456789", *text)) {
+        return 0;
+    }
+    *q = strtol(text, &end, 10);
+    return end != text && *end == '\0' && !(*text == '-' && end == text + 1);
+}
+
+void _model_on_nick(Client *client, const char *nick) {
+    if (auth_required) {
+        _model_send(client, "T,You cannot change your nick on this server.");
+        return;
+    }
+    if (!*nick) {
+        _model_send(client, "T,Your nickname is %s", client->nick);
+        return;
+    }
+    _model_send_talk("%s is now known as %s", client->nick, nick);
+    snprintf(client->nick, sizeof(client->nick), "%s", nick);
+    _model_send_nick(client);
+}
+
+void _model_on_goto(Client *client, const char *nick) {
+    Client *other = 0;
+    if (!*nick) {
+        int count = 0;
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            if (clients[i].connected && clients + i != client) {
+                if (rand() % ++count == 0) {
+                    other = clients + i;
+                }
+            }
+        }
+    }
+    else {
+        other = _model_find(nick);
+    }
+    if (other) {
+        float position[5];
+        memcpy(position, other->position, sizeof(position));
+        _model_teleport(client, position);
+    }
+}
+
+void _model_on_help(Client *client, const char *topic) {
+    static const char *topics[][4] = {
+        {"goto", "Help: /goto [NAME]",
+            "Teleport to another user.",
+            "If NAME is unspecified, a random user is chosen."},
+        {"list", "Help: /list",
+            "Display a list of connected users."},
+        {"login", "Help: /login NAME",
+            "Switch to another registered username.",
+            "The login server will be re-contacted. "
+            "The username is case-sensitive."},
+        {"logout", "Help: /logout",
+            "Unauthenticate and become a guest user.",
+            "Automatic logins will not occur again until the /login "
+            "command is re-issued."},
+        {"offline", "Help: /offline [FILE]",
+            "Switch to offline mode.",
+            "FILE specifies the save file to use and defaults to \"craft\"."},
+        {"online", "Help: /online HOST [PORT]",
+            "Connect to the specified server."},
+        {"nick", "Help: /nick [NICK]",
+            "Get or set your nickname."},
+        {"pq", "Help: /pq P Q",
+            "Teleport to the specified chunk."},
+        {"spawn", "Help: /spawn",
+            "Teleport back to the spawn point."},
+        {"view", "Help: /view N",
+            "Set viewing distance, 1 - 24."},
+    };
+    if (!*topic) {
+        _model_send(client,
+            "T,Type \"t\" to chat. Type \"/\" to type commands:");
+        _model_send(client, "T,/goto [NAME], /help [TOPIC], /list, "
+            "/login NAME, /logout, /nick");
+        _model_send(client, "T,/offline [FILE], /online HOST [PORT], "
+            "/pq P Q, /spawn, /view N");
+        return;
+    }
+    char name[16];
+    int n = 0;
+    while (topic[n] && n < (int)sizeof(name) - 1) {
+        name[n] = topic[n] >= 'A' && topic[n] <= 'Z' ?
+            topic[n] - 'A' + 'a' : topic[n];
+        n++;
+    }
+    name[n] = '\0';
+    for (int i = 0; i < (int)(sizeof(topics) / sizeof(topics[0])); i++) {
+        if (!strcmp(topics[i][0], name)) {
+            for (int j = 1; j < 4 && topics[i][j]; j++) {
+                _model_send(client, "T,%s", topics[i][j]);
+            }
+            return;
+        }
+    }
+}
+
+void _model_on_list(Client *client) {
+    char text[MODEL_LINE_SIZE] = "Players: ";
+    int length = strlen(text);
+    int first = 1;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].connected) {
+            length += snprintf(text + length, sizeof(text) - length,
+                "%s%s", first ? "" : ", ", clients[i].nick);
+            if (length >= (int)sizeof(text)) {
+                break;
+            }
+            first = 0;
+        }
+    }
+    _model_send(client, "T,%s", text);
+}
+
+void _model_on_talk(Client *client, const char *text) {
+    char arg[MODEL_NICK_SIZE];
+    long p, q;
+    if (text[0] == '/') {
+        if (_model_command(text, "nick", arg, sizeof(arg), ",")) {
+            _model_on_nick(client, arg);
+        }
+        else if (_model_command(text, "spawn", arg, sizeof(arg), 0)) {
+            _model_teleport(client, spawn_point);
+        }
+        else if (_model_command(text, "goto", arg, sizeof(arg), "")) {
+            _model_on_goto(client, arg);
+        }
+        else if (_model_pq(text, &p, &q)) {
+            if (labs(p) <= 1000 && labs(q) <= 1000) {
+                float position[5] = {p * CHUNK_SIZE, 0, q * CHUNK_SIZE, 0, 0};
+                _model_teleport(client, position);
+            }
+        }
+        else if (_model_command(text, "help", arg, sizeof(arg), "")) {
+            _model_on_help(client, arg);
+        }
+        else if (_model_command(text, "list", arg, sizeof(arg), 0)) {
+            _model_on_list(client);
+        }
+        else {
+            _model_send(client, "T,Unrecognized command: \"%s\"", text);
+        }
+    }
+    else if (text[0] == '@') {
+        int n = strcspn(text + 1, " ");
+        snprintf(arg, sizeof(arg), "%.*s", n, text + 1);
+        Client *other = _model_find(arg);
+        if (other) {
+            _model_send(client, "T,%s> %s", client->nick, text);
+            _model_send(other, "T,%s> %s", client->nick, text);
+        }
+        else {
+            _model_send(client, "T,Unrecognized nick: \"%s\"", arg);
+        }
+    }
+    else {
+        _model_send_talk("%s> %s", client->nick, text);
+    }
+}
+
+void model_apply(Command *command) {
+    if (command->type == COMMAND_TICK) {
+        shard_tick();
+        _model_relay_positions();
+        return;
+    }
+    if (command->type == COMMAND_DONE) {
+        _model_on_done(command);
+        return;
+    }
+    Client *client = clients + command->slot;
+    if (command->type == COMMAND_CONNECT) {
+        _model_on_connect(client, command->generation, command->text);
+        return;
+    }
+    if (!client->connected || client->generation != command->generation) {
+        return;
+    }
+    MessageField *f = command->fields;
+    switch (command->type) {
+        case COMMAND_DISCONNECT:
+            _model_on_disconnect(client);
+            break;
+        case COMMAND_LOGIN:
+            _model_on_login(client, f[0].i, command->text);
+            break;
+        case 'A':
+            _model_on_authenticate(client, command->generation, command->text);
+            break;
+        case 'B':
+        case 'L':
+        case 'S':
+            _model_route(client, command,
+                _model_chunked(f[0].i), _model_chunked(f[2].i));
+            break;
+        case 'C':
+            subscription_add(command->slot, f[0].i, f[1].i);
+            _model_route(client, command, f[0].i, f[1].i);
+            break;
+        case 'M': {
+            int deltas[5];
+            for (int i = 0; i < 5; i++) {
+                deltas[i] = f[i].i;
+            }
+            _model_on_move(client, deltas);
+            break;
+        }
+        case 'P': {
+            float position[5];
+            for (int i = 0; i < 5; i++) {
+                position[i] = f[i].f;
+            }
+            _model_on_position(client, position);
+            break;
+        }
+        case 'T':
+            _model_on_talk(client, command->text);
+            break;
+        case 'V':
+            _model_on_version(client, f[0].i);
+            break;
+        case 'X':
+            subscription_remove(command->slot, f[0].i, f[1].i);
+            break;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef _model_h_
+#define _model_h_
+
+#include "message.h"
+
+// What the network thread hands to the model thread: a message a client
+// sent, typed by its protocol tag with the fields of message_parse_request,
+// or one of the commands below. Connections are slots that are reused, the
+// generation tells apart the connections that had the same slot.
+
+#define COMMAND_CONNECT '+'
+#define COMMAND_DISCONNECT '-'
+#define COMMAND_LOGIN '@'
+#define COMMAND_TICK '!'
+#define COMMAND_EXIT '.'
+#define COMMAND_DONE '='
+
+// A shard answers every command it is handed with a done command, its
+// first field is the tag of what the other clients must be sent, if
+// anything, and the rest are that message's fields. The model fills in the
+// sender's user id and protocol version before it hands a command over.
+typedef struct {
+    char type;
+    int slot;
+    int generation;
+    MessageField fields[MESSAGE_FIELDS];
+    char *text;
+    int user_id;
+    int version;
+} Command;
+
+// a connection as the threads that write to it know it
+typedef struct {
+    int slot;
+    int generation;
+    int version;
+} Target;
+
+int model_open(const char *db_path, const char *log_path);
+void model_close();
+void model_set_auth(int required);
+void model_apply(Command *command);
+void model_log(const char *format, ...);
+void model_write(const Target *target, const char *data, int length);
+void model_send(const Target *target, const char *format, ...);
+void model_send_block(
+    const Target *target, char type, int p, int q, int x, int y, int z, int w);
+void model_send_redraw(const Target *target, int p, int q);
+
+// implemented by the server for the model and shard threads
+void server_command(Command *command);
+void server_send(int slot, int generation, const char *data, int length);
+void server_flush();
+void server_set_version(int slot, int version);
+void server_drop(int slot);
+void server_release(int slot);
+
+#endif
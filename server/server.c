@@ -0,0 +1,599 @@
+// accept4 for nonblocking client sockets
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "message.h"
+#include "model.h"
+#include "proto.h"
+#include "queue.h"
+#include "server.h"
+#include "stream.h"
+#include "tinycthread.h"
+
+#define SERVER_EVENTS 64
+#define SERVER_BUFFER_SIZE 4096
+#define SERVER_MAX_BUFFER (PROTO_HEADER_SIZE + PROTO_MAX_FRAME)
+#define SERVER_LISTEN (SERVER_MAX_CLIENTS)
+#define SERVER_WAKE (SERVER_MAX_CLIENTS + 1)
+
+// A client socket. The network thread owns the input side. The model and
+// shard threads append to the output buffer under the lock and write it
+// out after every batch of commands, leaving the rest to the network
+// thread when the socket is full.
+typedef struct {
+    int fd;
+    int generation;
+    int used;
+    int open;
+    int framed;
+    int version;
+    Stream stream;
+    mtx_t mtx;
+    char *output;
+    int output_size;
+    int output_capacity;
+    int writing;
+} Connection;
+
+// the connections a thread wrote to since it last flushed
+typedef struct {
+    int count;
+    int slots[SERVER_MAX_CLIENTS];
+    char dirty[SERVER_MAX_CLIENTS];
+} Outbox;
+
+static Connection *connections;
+static _Thread_local Outbox outbox;
+static Queue commands;
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static thrd_t network_thread;
+static thrd_t model_thread;
+static ServerStats stats;
+
+double _server_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _server_add(int *counter, int value) {
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+void server_command(Command *command) {
+    _server_add(&stats.commands, 1);
+    queue_put(&commands, command);
+}
+
+int server_open(const char *db_path, const char *log_path) {
+    if (model_open(db_path, log_path)) {
+        return -1;
+    }
+    connections = calloc(SERVER_MAX_CLIENTS, sizeof(Connection));
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        connections[i].fd = -1;
+        mtx_init(&connections[i].mtx, mtx_plain);
+    }
+    queue_alloc(&commands, sizeof(Command));
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event = {EPOLLIN};
+    event.data.u64 = SERVER_WAKE;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+    return 0;
+}
+
+// Binds the listening socket, a port of 0 picks a free one, returns the
+// port or -1
+int server_listen(const char *host, int port) {
+    struct addrinfo hints = {0};
+    struct addrinfo *info;
+    char service[16];
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &info)) {
+        return -1;
+    }
+    int fd = socket(info->ai_family,
+        info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (fd < 0 || bind(fd, info->ai_addr, info->ai_addrlen) ||
+        listen(fd, SOMAXCONN))
+    {
+        freeaddrinfo(info);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    freeaddrinfo(info);
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    getsockname(fd, (struct sockaddr *)&address, &length);
+    listen_fd = fd;
+    struct epoll_event event = {EPOLLIN};
+    event.data.u64 = SERVER_LISTEN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    if (address.ss_family == AF_INET6) {
+        return ntohs(((struct sockaddr_in6 *)&address)->sin6_port);
+    }
+    return ntohs(((struct sockaddr_in *)&address)->sin_port);
+}
+
+void server_set_auth(int required) {
+    model_set_auth(required);
+}
+
+void server_get_stats(ServerStats *result) {
+    result->connections =
+        __atomic_load_n(&stats.connections, __ATOMIC_RELAXED);
+    result->commands = __atomic_load_n(&stats.commands, __ATOMIC_RELAXED);
+    result->bytes_received =
+        __atomic_load_n(&stats.bytes_received, __ATOMIC_RELAXED);
+    result->bytes_sent = __atomic_load_n(&stats.bytes_sent, __ATOMIC_RELAXED);
+}
+
+void _server_epoll(int slot, int writing) {
+    Connection *connection = connections + slot;
+    struct epoll_event event = {EPOLLIN | EPOLLRDHUP};
+    if (writing) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u64 = slot;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+// Writes as much of the output as the socket takes, called with the lock
+// held, returns -1 when the connection is broken
+int _server_write(Connection *connection) {
+    int sent = 0;
+    while (sent < connection->output_size) {
+        ssize_t n = send(connection->fd, connection->output + sent,
+            connection->output_size - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->output_size = 0;
+                return -1;
+            }
+            break;
+        }
+        sent += n;
+    }
+    _server_add(&stats.bytes_sent, sent);
+    connection->output_size -= sent;
+    memmove(connection->output, connection->output + sent,
+        connection->output_size);
+    return 0;
+}
+
+// Queues data for a connection, unless it has been closed since
+void server_send(int slot, int generation, const char *data, int length) {
+    Connection *connection = connections + slot;
+    mtx_lock(&connection->mtx);
+    if (connection->fd < 0 || connection->generation != generation) {
+        mtx_unlock(&connection->mtx);
+        return;
+    }
+    int size = connection->output_size + length;
+    if (size > SERVER_MAX_BACKLOG) {
+        // too far behind, the hangup disconnects it
+        shutdown(connection->fd, SHUT_RDWR);
+        mtx_unlock(&connection->mtx);
+        return;
+    }
+    if (size > connection->output_capacity) {
+        int capacity = connection->output_capacity ?
+            connection->output_capacity : SERVER_BUFFER_SIZE;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        connection->output = realloc(connection->output, capacity);
+        connection->output_capacity = capacity;
+    }
+    memcpy(connection->output + connection->output_size, data, length);
+    connection->output_size = size;
+    mtx_unlock(&connection->mtx);
+    if (!outbox.dirty[slot]) {
+        outbox.dirty[slot] = 1;
+        outbox.slots[outbox.count++] = slot;
+    }
+}
+
+// Writes what this thread queued, once per batch of commands so that each
+// client gets one send however many messages it was sent
+void server_flush() {
+    for (int i = 0; i < outbox.count; i++) {
+        int slot = outbox.slots[i];
+        Connection *connection = connections + slot;
+        outbox.dirty[slot] = 0;
+        mtx_lock(&connection->mtx);
+        if (connection->fd < 0) {
+            mtx_unlock(&connection->mtx);
+            continue;
+        }
+        if (!connection->writing && connection->output_size) {
+            if (_server_write(connection)) {
+                shutdown(connection->fd, SHUT_RDWR);
+            }
+            else if (connection->output_size) {
+                connection->writing = 1;
+                _server_epoll(slot, 1);
+            }
+        }
+        mtx_unlock(&connection->mtx);
+    }
+    outbox.count = 0;
+}
+
+void server_set_version(int slot, int version) {
+    __atomic_store_n(&connections[slot].version, version, __ATOMIC_RELEASE);
+}
+
+void server_drop(int slot) {
+    shutdown(connections[slot].fd, SHUT_RDWR);
+}
+
+// The model is done with a disconnected client, its slot can be reused
+void server_release(int slot) {
+    Connection *connection = connections + slot;
+    mtx_lock(&connection->mtx);
+    close(connection->fd);
+    connection->fd = -1;
+    free(connection->output);
+    connection->output = 0;
+    connection->output_size = 0;
+    connection->output_capacity = 0;
+    connection->writing = 0;
+    mtx_unlock(&connection->mtx);
+    _server_add(&stats.connections, -1);
+    __atomic_store_n(&connection->used, 0, __ATOMIC_RELEASE);
+}
+
+void _server_hangup(int slot) {
+    Connection *connection = connections + slot;
+    Command command = {COMMAND_DISCONNECT, slot, connection->generation};
+    connection->open = 0;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    stream_free(&connection->stream);
+    server_command(&command);
+}
+
+void _server_accept() {
+    while (1) {
+        struct sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        int fd = accept4(listen_fd, (struct sockaddr *)&address, &length,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        int slot = -1;
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            if (!__atomic_load_n(&connections[i].used, __ATOMIC_ACQUIRE)) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            close(fd);
+            continue;
+        }
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        Connection *connection = connections + slot;
+        mtx_lock(&connection->mtx);
+        connection->fd = fd;
+        connection->generation++;
+        mtx_unlock(&connection->mtx);
+        connection->used = 1;
+        connection->open = 1;
+        connection->framed = 0;
+        connection->version = 0;
+        stream_alloc(&connection->stream, SERVER_BUFFER_SIZE);
+        _server_add(&stats.connections, 1);
+        Command command = {COMMAND_CONNECT, slot, connection->generation};
+        char host[NI_MAXHOST];
+        char port[NI_MAXSERV];
+        if (!getnameinfo((struct sockaddr *)&address, length,
+            host, sizeof(host), port, sizeof(port),
+            NI_NUMERICHOST | NI_NUMERICSERV))
+        {
+            command.text = malloc(strlen(host) + strlen(port) + 2);
+            sprintf(command.text, "%s %s", host, port);
+        }
+        server_command(&command);
+        struct epoll_event event = {EPOLLIN | EPOLLRDHUP};
+        event.data.u64 = slot;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void _server_request(int slot, char *line) {
+    Connection *connection = connections + slot;
+    Message message;
+    if (message_parse_request(line, &message)) {
+        return;
+    }
+    Command command = {message.type, slot, connection->generation};
+    memcpy(command.fields, message.fields, sizeof(command.fields));
+    if (message.text) {
+        command.text = malloc(strlen(message.text) + 1);
+        strcpy(command.text, message.text);
+    }
+    server_command(&command);
+}
+
+// Parses complete lines, returns how many bytes were used, which stops
+// after the line that switches the client to frames
+int _server_lines(int slot, char *data, int length) {
+    Connection *connection = connections + slot;
+    char upgrade[16];
+    snprintf(upgrade, sizeof(upgrade), "V,%d", PROTO_VERSION);
+    int used = 0;
+    while (used < length) {
+        char *line = data + used;
+        char *end = memchr(line, '\n', length - used);
+        if (!end) {
+            break;
+        }
+        used = end - data + 1;
+        *end = '\0';
+        if (end > line && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        if (!*line) {
+            continue;
+        }
+        if (!strcmp(line, upgrade) && __atomic_load_n(
+            &connection->version, __ATOMIC_ACQUIRE) == PROTO_VERSION)
+        {
+            // the client's frames start after this line
+            connection->framed = 1;
+            break;
+        }
+        _server_request(slot, line);
+    }
+    return used;
+}
+
+void _server_frame(int slot, const ProtoFrame *frame) {
+    Connection *connection = connections + slot;
+    Command command = {frame->type, slot, connection->generation};
+    int values[6];
+    switch (frame->type) {
+        case 'B':
+        case 'L':
+            if (proto_read_ints(frame, values, 6)) {
+                return;
+            }
+            for (int i = 0; i < 4; i++) {
+                command.fields[i].i = values[i + 2];
+            }
+            break;
+        case 'C':
+            if (proto_read_ints(frame, values, 3)) {
+                return;
+            }
+            for (int i = 0; i < 3; i++) {
+                command.fields[i].i = values[i];
+            }
+            break;
+        case 'P': {
+            int id;
+            float position[5];
+            if (proto_read_position(frame, &id, position)) {
+                return;
+            }
+            for (int i = 0; i < 5; i++) {
+                command.fields[i].f = position[i];
+            }
+            break;
+        }
+        case 'M': {
+            int id;
+            if (proto_read_move(frame, &id, values)) {
+                return;
+            }
+            for (int i = 0; i < 5; i++) {
+                command.fields[i].i = values[i];
+            }
+            break;
+        }
+        default: {
+            char *line = malloc(frame->size + 1);
+            memcpy(line, frame->data, frame->size);
+            line[frame->size] = '\0';
+            _server_request(slot, line);
+            free(line);
+            return;
+        }
+    }
+    server_command(&command);
+}
+
+// Parses what arrived, returns -1 when the client sent a frame that is too
+// large
+int _server_parse(int slot) {
+    Connection *connection = connections + slot;
+    while (1) {
+        int length;
+        char *data;
+        if (!connection->framed) {
+            data = stream_lines(&connection->stream, &length);
+            if (!data) {
+                return 0;
+            }
+            length = _server_lines(slot, data, length);
+        }
+        else {
+            data = stream_frames(&connection->stream, &length);
+            if (!data) {
+                return length < 0 ? -1 : 0;
+            }
+            ProtoFrame frame;
+            int offset = 0;
+            while (offset < length) {
+                offset += proto_frame(data + offset, length - offset, &frame);
+                _server_frame(slot, &frame);
+            }
+        }
+        stream_consume(&connection->stream, length);
+    }
+}
+
+void _server_read(int slot) {
+    Connection *connection = connections + slot;
+    Stream *stream = &connection->stream;
+    char *space;
+    int size = stream_space(stream, &space);
+    if (!size) {
+        if (stream->capacity >= SERVER_MAX_BUFFER) {
+            _server_hangup(slot);
+            return;
+        }
+        stream_grow(stream, stream->capacity * 2);
+        size = stream_space(stream, &space);
+    }
+    ssize_t n = recv(connection->fd, space, size, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        _server_hangup(slot);
+        return;
+    }
+    _server_add(&stats.bytes_received, n);
+    stream_commit(stream, n);
+    if (_server_parse(slot)) {
+        _server_hangup(slot);
+    }
+}
+
+void _server_writable(int slot) {
+    Connection *connection = connections + slot;
+    mtx_lock(&connection->mtx);
+    if (_server_write(connection)) {
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+    else if (!connection->output_size) {
+        connection->writing = 0;
+        _server_epoll(slot, 0);
+    }
+    mtx_unlock(&connection->mtx);
+}
+
+int _server_network(void *arg) {
+    struct epoll_event events[SERVER_EVENTS];
+    double last_tick = _server_time();
+    while (1) {
+        int count = epoll_wait(
+            epoll_fd, events, SERVER_EVENTS, SERVER_TICK * 1000);
+        for (int i = 0; i < count; i++) {
+            uint64_t slot = events[i].data.u64;
+            if (slot == SERVER_WAKE) {
+                return 0;
+            }
+            if (slot == SERVER_LISTEN) {
+                _server_accept();
+                continue;
+            }
+            if (!connections[slot].open) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                _server_writable(slot);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                _server_read(slot);
+            }
+        }
+        double now = _server_time();
+        if (now - last_tick >= SERVER_TICK) {
+            Command command = {COMMAND_TICK};
+            server_command(&command);
+            last_tick = now;
+        }
+    }
+    return 0;
+}
+
+int _server_model(void *arg) {
+    Command command;
+    while (1) {
+        queue_wait(&commands, &command);
+        do {
+            if (command.type == COMMAND_EXIT) {
+                server_flush();
+                return 0;
+            }
+            model_apply(&command);
+            free(command.text);
+        } while (queue_get(&commands, &command));
+        server_flush();
+    }
+    return 0;
+}
+
+void server_start() {
+    thrd_create(&model_thread, _server_model, NULL);
+    thrd_create(&network_thread, _server_network, NULL);
+}
+
+void server_stop() {
+    uint64_t value = 1;
+    if (write(wake_fd, &value, sizeof(value)) < 0) {
+        return;
+    }
+    thrd_join(network_thread, NULL);
+    Command command = {COMMAND_EXIT};
+    queue_put(&commands, &command);
+    thrd_join(model_thread, NULL);
+    model_close();
+    while (queue_get(&commands, &command)) {
+        free(command.text);
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Connection *connection = connections + i;
+        if (connection->open) {
+            stream_free(&connection->stream);
+        }
+        if (connection->fd >= 0) {
+            close(connection->fd);
+        }
+        free(connection->output);
+        mtx_destroy(&connection->mtx);
+    }
+    free(connections);
+    connections = 0;
+    memset(&stats, 0, sizeof(stats));
+    queue_free(&commands);
+    close(listen_fd);
+    close(epoll_fd);
+    close(wake_fd);
+    listen_fd = epoll_fd = wake_fd = -1;
+}
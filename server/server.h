@@ -0,0 +1,24 @@
+#ifndef _server_h_
+#define _server_h_
+
+// Native game server speaking the same protocol as server.py. A network
+// thread runs the epoll loop, reads what clients send and parses it into
+// commands, and a model thread applies the commands to the world in the
+// order they arrived and writes the answers, the same split server.py makes
+// between its handlers and its model.
+
+typedef struct {
+    int connections;
+    int commands;
+    int bytes_received;
+    int bytes_sent;
+} ServerStats;
+
+int server_open(const char *db_path, const char *log_path);
+int server_listen(const char *host, int port);
+void server_set_auth(int required);
+void server_start();
+void server_stop();
+void server_get_stats(ServerStats *result);
+
+#endif
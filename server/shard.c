@@ -0,0 +1,815 @@
+// clock_gettime for the commit interval
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "map.h"
+#include "proto.h"
+#include "queue.h"
+#include "shard.h"
+#include "sqlite3.h"
+#include "tinycthread.h"
+#include "world.h"
+
+static const int allowed_items[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    17, 18, 19, 20, 21, 22, 23,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+};
+
+static const int indestructible_items[] = {16};
+
+// default blocks of recently used chunks, as world.py caches them
+typedef struct {
+    int p;
+    int q;
+    int used;
+    Map map;
+} WorldChunk;
+
+typedef struct {
+    thrd_t thrd;
+    Queue queue;
+    sqlite3 *db;
+    sqlite3_stmt *get_block_stmt;
+    sqlite3_stmt *insert_block_stmt;
+    sqlite3_stmt *insert_history_stmt;
+    sqlite3_stmt *insert_light_stmt;
+    sqlite3_stmt *clear_light_stmt;
+    sqlite3_stmt *insert_sign_stmt;
+    sqlite3_stmt *delete_sign_stmt;
+    sqlite3_stmt *delete_signs_stmt;
+    sqlite3_stmt *load_blocks_stmt;
+    sqlite3_stmt *load_lights_stmt;
+    sqlite3_stmt *load_signs_stmt;
+    WorldChunk world[SERVER_WORLD_CACHE];
+    int world_count;
+    int world_clock;
+    int *blocks;
+    int block_capacity;
+    int *lights;
+    int light_capacity;
+    double last_commit;
+} Shard;
+
+static Shard shards[SERVER_SHARDS];
+static int shard_count;
+static int auth_required = SERVER_AUTH_REQUIRED;
+
+double _shard_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int _shard_chunked(double x) {
+    return floor(round(x) / CHUNK_SIZE);
+}
+
+int _shard_region(int p) {
+    return floor((double)p / SERVER_REGION_SIZE);
+}
+
+// regions are spread over the shards by a hash of their coordinates
+int shard_index(int p, int q) {
+    unsigned int rp = _shard_region(p);
+    unsigned int rq = _shard_region(q);
+    return ((rp * 73856093u) ^ (rq * 19349663u)) % SERVER_SHARDS;
+}
+
+void _shard_sql_index(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    sqlite3_result_int(context, shard_index(
+        sqlite3_value_int(argv[0]), sqlite3_value_int(argv[1])));
+}
+
+int _shard_contains(const int *items, int count, int w) {
+    for (int i = 0; i < count; i++) {
+        if (items[i] == w) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int _shard_exec(Shard *shard, const char *sql) {
+    char *error = 0;
+    if (sqlite3_exec(shard->db, sql, NULL, NULL, &error) != SQLITE_OK) {
+        model_log("SQL %s", error);
+        sqlite3_free(error);
+        return -1;
+    }
+    return 0;
+}
+
+int _shard_get_int(Shard *shard, const char *sql) {
+    int result = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(shard->db, sql, -1, &stmt, NULL)) {
+        return -1;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        result = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+// Copies this shard's part of the attached database that is not split
+// yet, rowids are kept so that the keys clients have cached stay valid.
+// Whatever an older, interrupted first run left behind is dropped.
+int _shard_import(Shard *shard, const char *path) {
+    static const char *import_query =
+        "delete from block;"
+        "delete from light;"
+        "delete from sign;"
+        "delete from block_history;"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    select rowid, p, q, x, y, z, w from base.block "
+        "    where shard_index(p, q) = %d;"
+        "insert into light (p, q, x, y, z, w) "
+        "    select p, q, x, y, z, w from base.light "
+        "    where shard_index(p, q) = %d;"
+        "insert into sign (p, q, x, y, z, face, text) "
+        "    select p, q, x, y, z, face, text from base.sign "
+        "    where shard_index(p, q) = %d;"
+        "%s";
+    static const char *history_query =
+        "insert into block_history select * from base.block_history;";
+    int index = shard - shards;
+    // the client keeps its storage format there, blocks that are not
+    // stored as rows would be missed
+    if (_shard_get_int(shard, "pragma base.user_version;")) {
+        model_log("SHARD %d can not import %s, its blocks are not stored "
+            "as rows", index, path);
+        return -1;
+    }
+    model_log("SHARD %d importing %s", index, path);
+    char *query = sqlite3_mprintf(import_query,
+        index, index, index, index ? "" : history_query);
+    int result = _shard_exec(shard, query);
+    sqlite3_free(query);
+    return result;
+}
+
+// Takes this shard's part of a database that is not split yet and drops
+// the copies of edge blocks older versions stored in the neighbours. The
+// marker is the one the client and server.py keep, and goes in the same
+// transaction so that a first run that was stopped starts over.
+int _shard_migrate(Shard *shard, const char *base_path) {
+    static const char *migrate_query =
+        "delete from block where "
+        "x < p * %d or x >= (p + 1) * %d or "
+        "z < q * %d or z >= (q + 1) * %d;"
+        "insert into migration (name) values ('borders');";
+    int import = base_path && access(base_path, F_OK) == 0;
+    if (import) {
+        char *attach = sqlite3_mprintf(
+            "attach database %Q as base;", base_path);
+        int rc = _shard_exec(shard, attach);
+        sqlite3_free(attach);
+        if (rc) {
+            return -1;
+        }
+    }
+    char query[320];
+    snprintf(query, sizeof(query), migrate_query,
+        CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+    int result = _shard_exec(shard, "begin;");
+    if (!result) {
+        if ((import && _shard_import(shard, base_path)) ||
+            _shard_exec(shard, query) || _shard_exec(shard, "commit;"))
+        {
+            _shard_exec(shard, "rollback;");
+            result = -1;
+        }
+    }
+    if (import) {
+        _shard_exec(shard, "detach database base;");
+    }
+    return result;
+}
+
+// Which shard owns a chunk depends on SERVER_SHARDS and SERVER_REGION_SIZE,
+// a file that was split with other values would miss chunks and is not
+// opened. Files from before the layout was kept are taken to match.
+int _shard_check_layout(Shard *shard) {
+    static const char *insert_query =
+        "insert into layout (shards, region_size) values (%d, %d);";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(shard->db,
+        "select shards, region_size from layout;", -1, &stmt, NULL))
+    {
+        return -1;
+    }
+    int found = sqlite3_step(stmt) == SQLITE_ROW;
+    int count = found ? sqlite3_column_int(stmt, 0) : SERVER_SHARDS;
+    int size = found ? sqlite3_column_int(stmt, 1) : SERVER_REGION_SIZE;
+    sqlite3_finalize(stmt);
+    if (!found) {
+        char query[128];
+        snprintf(query, sizeof(query), insert_query,
+            SERVER_SHARDS, SERVER_REGION_SIZE);
+        return _shard_exec(shard, query);
+    }
+    if (count != SERVER_SHARDS || size != SERVER_REGION_SIZE) {
+        model_log("SHARD %d was split into %d shards by regions of %d, "
+            "not %d by %d", (int)(shard - shards), count, size,
+            SERVER_SHARDS, SERVER_REGION_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+int _shard_create_tables(Shard *shard, const char *base_path) {
+    static const char *create_query =
+        "create table if not exists block ("
+        "    p int not null,"
+        "    q int not null,"
+        "    x int not null,"
+        "    y int not null,"
+        "    z int not null,"
+        "    w int not null"
+        ");"
+        "create unique index if not exists block_pqxyz_idx on "
+        "    block (p, q, x, y, z);"
+        "create table if not exists light ("
+        "    p int not null,"
+        "    q int not null,"
+        "    x int not null,"
+        "    y int not null,"
+        "    z int not null,"
+        "    w int not null"
+        ");"
+        "create unique index if not exists light_pqxyz_idx on "
+        "    light (p, q, x, y, z);"
+        "create table if not exists sign ("
+        "    p int not null,"
+        "    q int not null,"
+        "    x int not null,"
+        "    y int not null,"
+        "    z int not null,"
+        "    face int not null,"
+        "    text text not null"
+        ");"
+        "create index if not exists sign_pq_idx on sign (p, q);"
+        "create unique index if not exists sign_xyzface_idx on "
+        "    sign (x, y, z, face);"
+        "create table if not exists block_history ("
+        "   timestamp real not null,"
+        "   user_id int not null,"
+        "   x int not null,"
+        "   y int not null,"
+        "   z int not null,"
+        "   w int not null"
+        ");"
+        "create table if not exists layout ("
+        "    shards int not null,"
+        "    region_size int not null"
+        ");"
+        "create table if not exists migration ("
+        "    name text not null"
+        ");"
+        "create unique index if not exists migration_name_idx on "
+        "    migration (name);";
+    if (_shard_exec(shard, create_query)) {
+        return -1;
+    }
+    int migrated = _shard_get_int(shard,
+        "select count(*) from migration where name = 'borders';");
+    if (migrated < 0 || (!migrated && _shard_migrate(shard, base_path))) {
+        return -1;
+    }
+    return _shard_check_layout(shard);
+}
+
+int _shard_prepare(Shard *shard) {
+    static const char *get_block_query =
+        "select w from block where "
+        "p = ? and q = ? and x = ? and y = ? and z = ?;";
+    static const char *insert_block_query =
+        "insert or replace into block (p, q, x, y, z, w) "
+        "values (?, ?, ?, ?, ?, ?);";
+    static const char *insert_history_query =
+        "insert into block_history (timestamp, user_id, x, y, z, w) "
+        "values (?, ?, ?, ?, ?, ?);";
+    static const char *insert_light_query =
+        "insert or replace into light (p, q, x, y, z, w) "
+        "values (?, ?, ?, ?, ?, ?);";
+    static const char *clear_light_query =
+        "update light set w = 0 where x = ? and y = ? and z = ?;";
+    static const char *insert_sign_query =
+        "insert or replace into sign (p, q, x, y, z, face, text) "
+        "values (?, ?, ?, ?, ?, ?, ?);";
+    static const char *delete_sign_query =
+        "delete from sign where x = ? and y = ? and z = ? and face = ?;";
+    static const char *delete_signs_query =
+        "delete from sign where x = ? and y = ? and z = ?;";
+    static const char *load_blocks_query =
+        "select rowid, x, y, z, w from block where "
+        "p = ? and q = ? and rowid > ?;";
+    static const char *load_lights_query =
+        "select x, y, z, w from light where p = ? and q = ?;";
+    static const char *load_signs_query =
+        "select x, y, z, face, text from sign where p = ? and q = ?;";
+    sqlite3 *db = shard->db;
+    int rc;
+    rc = sqlite3_prepare_v2(
+        db, get_block_query, -1, &shard->get_block_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, insert_block_query, -1, &shard->insert_block_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, insert_history_query, -1, &shard->insert_history_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, insert_light_query, -1, &shard->insert_light_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, clear_light_query, -1, &shard->clear_light_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, insert_sign_query, -1, &shard->insert_sign_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, delete_sign_query, -1, &shard->delete_sign_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, delete_signs_query, -1, &shard->delete_signs_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_blocks_query, -1, &shard->load_blocks_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_lights_query, -1, &shard->load_lights_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_signs_query, -1, &shard->load_signs_stmt, NULL);
+    if (rc) return rc;
+    return 0;
+}
+
+void _shard_world_func(int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+int _shard_default_block(Shard *shard, int x, int y, int z) {
+    int p = _shard_chunked(x);
+    int q = _shard_chunked(z);
+    WorldChunk *world = shard->world;
+    WorldChunk *chunk = 0;
+    for (int i = 0; i < shard->world_count; i++) {
+        if (world[i].p == p && world[i].q == q) {
+            chunk = world + i;
+            break;
+        }
+    }
+    if (!chunk) {
+        if (shard->world_count < SERVER_WORLD_CACHE) {
+            chunk = world + shard->world_count++;
+        }
+        else {
+            chunk = world;
+            for (int i = 1; i < shard->world_count; i++) {
+                if (world[i].used < chunk->used) {
+                    chunk = world + i;
+                }
+            }
+            map_free(&chunk->map);
+        }
+        chunk->p = p;
+        chunk->q = q;
+        map_alloc(&chunk->map,
+            p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, 0x7fff);
+        create_world(p, q, _shard_world_func, &chunk->map);
+    }
+    chunk->used = ++shard->world_clock;
+    return map_get(&chunk->map, x, y, z);
+}
+
+int _shard_get_block(Shard *shard, int x, int y, int z) {
+    sqlite3_stmt *stmt = shard->get_block_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, _shard_chunked(x));
+    sqlite3_bind_int(stmt, 2, _shard_chunked(z));
+    sqlite3_bind_int(stmt, 3, x);
+    sqlite3_bind_int(stmt, 4, y);
+    sqlite3_bind_int(stmt, 5, z);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        return sqlite3_column_int(stmt, 0);
+    }
+    return _shard_default_block(shard, x, y, z);
+}
+
+int *_shard_entries(int **entries, int *capacity, int count) {
+    if (count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        *entries = realloc(*entries, sizeof(int) * 4 * *capacity);
+    }
+    return *entries + count * 4;
+}
+
+void _shard_send_chunk(
+    Shard *shard, const Target *target, int p, int q, int key,
+    int block_count, int light_count)
+{
+    // large responses are split, only the last record carries the key and
+    // the last record is never full so that it also ends the response
+    int b = 0;
+    int l = 0;
+    while (1) {
+        int bn = block_count - b;
+        if (bn > PROTO_CHUNK_ENTRIES) {
+            bn = PROTO_CHUNK_ENTRIES;
+        }
+        int ln = light_count - l;
+        if (ln > PROTO_CHUNK_ENTRIES - bn) {
+            ln = PROTO_CHUNK_ENTRIES - bn;
+        }
+        int last = bn + ln < PROTO_CHUNK_ENTRIES;
+        char *data = malloc(proto_chunk_size(bn, ln));
+        int length = proto_chunk(data, p, q, last ? key : 0,
+            shard->blocks + b * 4, bn, shard->lights + l * 4, ln);
+        model_write(target, data, length);
+        free(data);
+        b += bn;
+        l += ln;
+        if (last) {
+            break;
+        }
+    }
+}
+
+void _shard_on_chunk(Shard *shard, const Target *target, int p, int q, int key) {
+    sqlite3_stmt *stmt;
+    int block_count = 0;
+    int light_count = 0;
+    int sign_count = 0;
+    int max_rowid = 0;
+    int framed = target->version == PROTO_VERSION;
+    stmt = shard->load_blocks_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    sqlite3_bind_int(stmt, 3, key);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int rowid = sqlite3_column_int(stmt, 0);
+        int *e = _shard_entries(
+            &shard->blocks, &shard->block_capacity, block_count++);
+        for (int i = 0; i < 4; i++) {
+            e[i] = sqlite3_column_int(stmt, i + 1);
+        }
+        max_rowid = rowid > max_rowid ? rowid : max_rowid;
+    }
+    stmt = shard->load_lights_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int *e = _shard_entries(
+            &shard->lights, &shard->light_capacity, light_count++);
+        for (int i = 0; i < 4; i++) {
+            e[i] = sqlite3_column_int(stmt, i);
+        }
+    }
+    if (!framed) {
+        for (int i = 0; i < block_count; i++) {
+            int *e = shard->blocks + i * 4;
+            model_send_block(target, 'B', p, q, e[0], e[1], e[2], e[3]);
+        }
+        for (int i = 0; i < light_count; i++) {
+            int *e = shard->lights + i * 4;
+            model_send_block(target, 'L', p, q, e[0], e[1], e[2], e[3]);
+        }
+    }
+    stmt = shard->load_signs_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        model_send(target, "S,%d,%d,%d,%d,%d,%d,%s", p, q,
+            sqlite3_column_int(stmt, 0),
+            sqlite3_column_int(stmt, 1),
+            sqlite3_column_int(stmt, 2),
+            sqlite3_column_int(stmt, 3),
+            sqlite3_column_text(stmt, 4));
+        sign_count++;
+    }
+    if (framed) {
+        _shard_send_chunk(
+            shard, target, p, q, max_rowid, block_count, light_count);
+    }
+    else if (block_count) {
+        model_send(target, "K,%d,%d,%d", p, q, max_rowid);
+    }
+    if (block_count || light_count || sign_count) {
+        model_send_redraw(target, p, q);
+    }
+    if (!framed) {
+        model_send(target, "C,%d,%d", p, q);
+    }
+}
+
+void _shard_done(
+    Command *done, char type, int p, int q, int x, int y, int z, int w)
+{
+    int values[] = {type, p, q, x, y, z, w};
+    for (int i = 0; i < 7; i++) {
+        done->fields[i].i = values[i];
+    }
+}
+
+void _shard_on_block(
+    Shard *shard, const Target *target, int user_id,
+    int x, int y, int z, int w, Command *done)
+{
+    sqlite3_stmt *stmt;
+    int p = _shard_chunked(x);
+    int q = _shard_chunked(z);
+    int previous = _shard_get_block(shard, x, y, z);
+    const char *message = 0;
+    if (auth_required && user_id < 0) {
+        message = "Only logged in users are allowed to build.";
+    }
+    else if (y <= 0 || y > 255) {
+        message = "Invalid block coordinates.";
+    }
+    else if (!_shard_contains(allowed_items,
+        sizeof(allowed_items) / sizeof(int), w))
+    {
+        message = "That item is not allowed.";
+    }
+    else if (w && previous) {
+        message = "Cannot create blocks in a non-empty space.";
+    }
+    else if (!w && !previous) {
+        message = "That space is already empty.";
+    }
+    else if (_shard_contains(indestructible_items,
+        sizeof(indestructible_items) / sizeof(int), previous))
+    {
+        message = "Cannot destroy that type of block.";
+    }
+    if (message) {
+        model_send_block(target, 'B', p, q, x, y, z, previous);
+        model_send_redraw(target, p, q);
+        model_send(target, "T,%s", message);
+        return;
+    }
+    if (SERVER_RECORD_HISTORY) {
+        stmt = shard->insert_history_stmt;
+        sqlite3_reset(stmt);
+        sqlite3_bind_double(stmt, 1, _shard_time());
+        sqlite3_bind_int(stmt, 2, user_id);
+        sqlite3_bind_int(stmt, 3, x);
+        sqlite3_bind_int(stmt, 4, y);
+        sqlite3_bind_int(stmt, 5, z);
+        sqlite3_bind_int(stmt, 6, w);
+        sqlite3_step(stmt);
+    }
+    stmt = shard->insert_block_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    sqlite3_bind_int(stmt, 3, x);
+    sqlite3_bind_int(stmt, 4, y);
+    sqlite3_bind_int(stmt, 5, z);
+    sqlite3_bind_int(stmt, 6, w);
+    sqlite3_step(stmt);
+    _shard_done(done, 'B', p, q, x, y, z, w);
+    if (w == 0) {
+        stmt = shard->delete_signs_stmt;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, x);
+        sqlite3_bind_int(stmt, 2, y);
+        sqlite3_bind_int(stmt, 3, z);
+        sqlite3_step(stmt);
+        stmt = shard->clear_light_stmt;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, x);
+        sqlite3_bind_int(stmt, 2, y);
+        sqlite3_bind_int(stmt, 3, z);
+        sqlite3_step(stmt);
+    }
+}
+
+void _shard_on_light(
+    Shard *shard, const Target *target, int user_id,
+    int x, int y, int z, int w, Command *done)
+{
+    int p = _shard_chunked(x);
+    int q = _shard_chunked(z);
+    int block = _shard_get_block(shard, x, y, z);
+    const char *message = 0;
+    if (auth_required && user_id < 0) {
+        message = "Only logged in users are allowed to build.";
+    }
+    else if (block == 0) {
+        message = "Lights must be placed on a block.";
+    }
+    else if (w < 0 || w > 15) {
+        message = "Invalid light value.";
+    }
+    if (message) {
+        model_send_redraw(target, p, q);
+        model_send(target, "T,%s", message);
+        return;
+    }
+    sqlite3_stmt *stmt = shard->insert_light_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    sqlite3_bind_int(stmt, 3, x);
+    sqlite3_bind_int(stmt, 4, y);
+    sqlite3_bind_int(stmt, 5, z);
+    sqlite3_bind_int(stmt, 6, w);
+    sqlite3_step(stmt);
+    _shard_done(done, 'L', p, q, x, y, z, w);
+}
+
+void _shard_on_sign(
+    Shard *shard, const Target *target, int user_id,
+    int x, int y, int z, int face, char *text, Command *done)
+{
+    sqlite3_stmt *stmt;
+    if (auth_required && user_id < 0) {
+        model_send(target, "T,Only logged in users are allowed to build.");
+        return;
+    }
+    if (y <= 0 || y > 255 || face < 0 || face > 7 || strlen(text) > 48) {
+        return;
+    }
+    int p = _shard_chunked(x);
+    int q = _shard_chunked(z);
+    if (*text) {
+        stmt = shard->insert_sign_stmt;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, p);
+        sqlite3_bind_int(stmt, 2, q);
+        sqlite3_bind_int(stmt, 3, x);
+        sqlite3_bind_int(stmt, 4, y);
+        sqlite3_bind_int(stmt, 5, z);
+        sqlite3_bind_int(stmt, 6, face);
+        sqlite3_bind_text(stmt, 7, text, -1, SQLITE_STATIC);
+        sqlite3_step(stmt);
+    }
+    else {
+        stmt = shard->delete_sign_stmt;
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, x);
+        sqlite3_bind_int(stmt, 2, y);
+        sqlite3_bind_int(stmt, 3, z);
+        sqlite3_bind_int(stmt, 4, face);
+        sqlite3_step(stmt);
+    }
+    _shard_done(done, 'S', p, q, x, y, z, face);
+    done->text = text;
+}
+
+void _shard_apply(Shard *shard, Command *command) {
+    if (command->type == COMMAND_TICK) {
+        if (_shard_time() - shard->last_commit > COMMIT_INTERVAL) {
+            shard->last_commit = _shard_time();
+            _shard_exec(shard, "commit; begin;");
+        }
+        return;
+    }
+    Target target = {command->slot, command->generation, command->version};
+    Command done = {COMMAND_DONE, command->slot, command->generation};
+    MessageField *f = command->fields;
+    int user_id = command->user_id;
+    switch (command->type) {
+        case 'B':
+            _shard_on_block(shard, &target, user_id,
+                f[0].i, f[1].i, f[2].i, f[3].i, &done);
+            break;
+        case 'C':
+            _shard_on_chunk(shard, &target, f[0].i, f[1].i, f[2].i);
+            break;
+        case 'L':
+            _shard_on_light(shard, &target, user_id,
+                f[0].i, f[1].i, f[2].i, f[3].i, &done);
+            break;
+        case 'S':
+            _shard_on_sign(shard, &target, user_id,
+                f[0].i, f[1].i, f[2].i, f[3].i, command->text, &done);
+            break;
+    }
+    if (done.text == command->text) {
+        command->text = 0;
+    }
+    server_command(&done);
+}
+
+int _shard_worker(void *arg) {
+    Shard *shard = (Shard *)arg;
+    Command command;
+    while (1) {
+        queue_wait(&shard->queue, &command);
+        do {
+            if (command.type == COMMAND_EXIT) {
+                server_flush();
+                return 0;
+            }
+            _shard_apply(shard, &command);
+            free(command.text);
+        } while (queue_get(&shard->queue, &command));
+        server_flush();
+    }
+    return 0;
+}
+
+int _shard_open(Shard *shard, const char *db_path) {
+    int index = shard - shards;
+    char path[1024];
+    const char *base_path = 0;
+    if (SERVER_SHARDS == 1 || !strcmp(db_path, ":memory:")) {
+        snprintf(path, sizeof(path), "%s", db_path);
+    }
+    else {
+        snprintf(path, sizeof(path), "%s.%d", db_path, index);
+        base_path = db_path;
+    }
+    if (sqlite3_open(path, &shard->db)) {
+        return -1;
+    }
+    sqlite3_create_function(shard->db, "shard_index", 2, SQLITE_UTF8,
+        NULL, _shard_sql_index, NULL, NULL);
+    if (_shard_create_tables(shard, base_path) || _shard_prepare(shard)) {
+        return -1;
+    }
+    _shard_exec(shard, "begin;");
+    shard->last_commit = _shard_time();
+    queue_alloc(&shard->queue, sizeof(Command));
+    thrd_create(&shard->thrd, _shard_worker, shard);
+    return 0;
+}
+
+int shard_open(const char *db_path) {
+    for (shard_count = 0; shard_count < SERVER_SHARDS; shard_count++) {
+        Shard *shard = shards + shard_count;
+        if (_shard_open(shard, db_path)) {
+            sqlite3_close(shard->db);
+            shard->db = 0;
+            shard_close();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void shard_close() {
+    Command command = {COMMAND_EXIT};
+    for (int i = 0; i < shard_count; i++) {
+        queue_put(&shards[i].queue, &command);
+    }
+    for (int i = 0; i < shard_count; i++) {
+        Shard *shard = shards + i;
+        thrd_join(shard->thrd, NULL);
+        while (queue_get(&shard->queue, &command)) {
+            free(command.text);
+        }
+        queue_free(&shard->queue);
+        _shard_exec(shard, "commit;");
+        sqlite3_finalize(shard->get_block_stmt);
+        sqlite3_finalize(shard->insert_block_stmt);
+        sqlite3_finalize(shard->insert_history_stmt);
+        sqlite3_finalize(shard->insert_light_stmt);
+        sqlite3_finalize(shard->clear_light_stmt);
+        sqlite3_finalize(shard->insert_sign_stmt);
+        sqlite3_finalize(shard->delete_sign_stmt);
+        sqlite3_finalize(shard->delete_signs_stmt);
+        sqlite3_finalize(shard->load_blocks_stmt);
+        sqlite3_finalize(shard->load_lights_stmt);
+        sqlite3_finalize(shard->load_signs_stmt);
+        sqlite3_close(shard->db);
+        for (int j = 0; j < shard->world_count; j++) {
+            map_free(&shard->world[j].map);
+        }
+        free(shard->blocks);
+        free(shard->lights);
+        memset(shard, 0, sizeof(Shard));
+    }
+    shard_count = 0;
+}
+
+void shard_set_auth(int required) {
+    auth_required = required;
+}
+
+void shard_put(int index, const Command *command) {
+    queue_put(&shards[index].queue, command);
+}
+
+void shard_tick() {
+    Command command = {COMMAND_TICK};
+    for (int i = 0; i < shard_count; i++) {
+        queue_put(&shards[i].queue, &command);
+    }
+}
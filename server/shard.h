@@ -0,0 +1,20 @@
+#ifndef _shard_h_
+#define _shard_h_
+
+#include "model.h"
+
+// World state is split into regions of SERVER_REGION_SIZE by
+// SERVER_REGION_SIZE chunks and every region belongs to one of
+// SERVER_SHARDS shards. A shard has its own thread, command queue and
+// database file, so edits and chunk requests in regions of different
+// shards never wait on each other. Shards answer the client that sent a
+// command directly and hand what other clients must see back to the model.
+
+int shard_index(int p, int q);
+int shard_open(const char *db_path);
+void shard_close();
+void shard_set_auth(int required);
+void shard_put(int index, const Command *command);
+void shard_tick();
+
+#endif
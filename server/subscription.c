@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "subscription.h"
+
+#define SUBSCRIPTION_BUCKETS 65536
+
+// the connections subscribed to one chunk
+typedef struct Topic {
+    struct Topic *next;
+    int p;
+    int q;
+    int count;
+    int capacity;
+    int *slots;
+} Topic;
+
+// the chunks of one connection, least recently requested first
+typedef struct {
+    int (*chunks)[2];
+    int count;
+    int capacity;
+} Subscriber;
+
+static Topic **buckets;
+static Subscriber *subscribers;
+static int slot_count;
+
+Topic **_subscription_find(int p, int q) {
+    unsigned int hash = ((unsigned int)p * 73856093u) ^
+        ((unsigned int)q * 19349663u);
+    Topic **link = buckets + (hash & (SUBSCRIPTION_BUCKETS - 1));
+    while (*link && ((*link)->p != p || (*link)->q != q)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+void _subscription_subscribe(int slot, int p, int q) {
+    Topic **link = _subscription_find(p, q);
+    Topic *topic = *link;
+    if (!topic) {
+        topic = calloc(1, sizeof(Topic));
+        topic->p = p;
+        topic->q = q;
+        *link = topic;
+    }
+    if (topic->count == topic->capacity) {
+        topic->capacity = topic->capacity ? topic->capacity * 2 : 4;
+        topic->slots = realloc(topic->slots, sizeof(int) * topic->capacity);
+    }
+    topic->slots[topic->count++] = slot;
+}
+
+void _subscription_unsubscribe(int slot, int p, int q) {
+    Topic **link = _subscription_find(p, q);
+    Topic *topic = *link;
+    if (!topic) {
+        return;
+    }
+    for (int i = 0; i < topic->count; i++) {
+        if (topic->slots[i] == slot) {
+            topic->slots[i] = topic->slots[--topic->count];
+            break;
+        }
+    }
+    if (!topic->count) {
+        *link = topic->next;
+        free(topic->slots);
+        free(topic);
+    }
+}
+
+// drops the subscriber's chunk at index, keeping the others in order
+void _subscription_drop(Subscriber *subscriber, int index) {
+    subscriber->count--;
+    memmove(subscriber->chunks + index, subscriber->chunks + index + 1,
+        sizeof(subscriber->chunks[0]) * (subscriber->count - index));
+}
+
+int _subscription_index(Subscriber *subscriber, int p, int q) {
+    for (int i = subscriber->count - 1; i >= 0; i--) {
+        if (subscriber->chunks[i][0] == p && subscriber->chunks[i][1] == q) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int subscription_open(int slots) {
+    buckets = calloc(SUBSCRIPTION_BUCKETS, sizeof(Topic *));
+    subscribers = calloc(slots, sizeof(Subscriber));
+    if (!buckets || !subscribers) {
+        subscription_close();
+        return -1;
+    }
+    slot_count = slots;
+    return 0;
+}
+
+void subscription_close() {
+    for (int i = 0; buckets && i < SUBSCRIPTION_BUCKETS; i++) {
+        while (buckets[i]) {
+            Topic *topic = buckets[i];
+            buckets[i] = topic->next;
+            free(topic->slots);
+            free(topic);
+        }
+    }
+    for (int i = 0; subscribers && i < slot_count; i++) {
+        free(subscribers[i].chunks);
+    }
+    free(buckets);
+    free(subscribers);
+    buckets = 0;
+    subscribers = 0;
+    slot_count = 0;
+}
+
+// Requesting a chunk again makes it the most recently requested one
+void subscription_add(int slot, int p, int q) {
+    Subscriber *subscriber = subscribers + slot;
+    int index = _subscription_index(subscriber, p, q);
+    if (index >= 0) {
+        _subscription_drop(subscriber, index);
+    }
+    else {
+        if (subscriber->count == SERVER_MAX_SUBSCRIPTIONS) {
+            int *oldest = subscriber->chunks[0];
+            _subscription_unsubscribe(slot, oldest[0], oldest[1]);
+            _subscription_drop(subscriber, 0);
+        }
+        _subscription_subscribe(slot, p, q);
+    }
+    if (subscriber->count == subscriber->capacity) {
+        subscriber->capacity = subscriber->capacity ?
+            subscriber->capacity * 2 : 64;
+        subscriber->chunks = realloc(subscriber->chunks,
+            sizeof(subscriber->chunks[0]) * subscriber->capacity);
+    }
+    subscriber->chunks[subscriber->count][0] = p;
+    subscriber->chunks[subscriber->count][1] = q;
+    subscriber->count++;
+}
+
+void subscription_remove(int slot, int p, int q) {
+    Subscriber *subscriber = subscribers + slot;
+    int index = _subscription_index(subscriber, p, q);
+    if (index >= 0) {
+        _subscription_drop(subscriber, index);
+        _subscription_unsubscribe(slot, p, q);
+    }
+}
+
+void subscription_clear(int slot) {
+    Subscriber *subscriber = subscribers + slot;
+    for (int i = 0; i < subscriber->count; i++) {
+        int *chunk = subscriber->chunks[i];
+        _subscription_unsubscribe(slot, chunk[0], chunk[1]);
+    }
+    free(subscriber->chunks);
+    memset(subscriber, 0, sizeof(Subscriber));
+}
+
+// the slots subscribed to a chunk, in no particular order
+int subscription_get(int p, int q, const int **slots) {
+    Topic *topic = *_subscription_find(p, q);
+    if (!topic) {
+        *slots = 0;
+        return 0;
+    }
+    *slots = topic->slots;
+    return topic->count;
+}
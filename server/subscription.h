@@ -0,0 +1,16 @@
+#ifndef _subscription_h_
+#define _subscription_h_
+
+// The chunks every connection asked for with C messages, changes to a
+// chunk are only sent to the connections subscribed to it. Clients let go
+// of a chunk with an X message, those that never do lose their least
+// recently requested chunks past SERVER_MAX_SUBSCRIPTIONS.
+
+int subscription_open(int slots);
+void subscription_close();
+void subscription_add(int slot, int p, int q);
+void subscription_remove(int slot, int p, int q);
+void subscription_clear(int slot);
+int subscription_get(int p, int q, const int **slots);
+
+#endif
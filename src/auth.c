@@ -47,3 +47,32 @@ int get_access_token(
     }
     return 0;
 }
+
+// Asks the login server who an access token belongs to, as game servers
+// do, returns the user id or -1
+int get_user_id(const char *username, const char *access_token) {
+    static char url[] = "https://craft.michaelfogleman.com/api/1/access";
+    int result = -1;
+    CURL *curl = curl_easy_init();
+    if (curl) {
+        char post[MAX_POST_LENGTH] = {0};
+        char response[MAX_RESPONSE_LENGTH] = {0};
+        long http_code = 0;
+        snprintf(post, MAX_POST_LENGTH, "username=%s&access_token=%s",
+            username, access_token);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_function);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
+        CURLcode code = curl_easy_perform(curl);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_easy_cleanup(curl);
+        int length = strlen(response);
+        if (code == CURLE_OK && http_code == 200 && length &&
+            strspn(response, "0123456789") == (size_t)length)
+        {
+            result = atoi(response);
+        }
+    }
+    return result;
+}
@@ -3,5 +3,6 @@
 
 int get_access_token(
     char *result, int length, char *username, char *identity_token);
+int get_user_id(const char *username, const char *access_token);
 
 #endif
@@ -0,0 +1,454 @@
+// clock_gettime for timing
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "message.h"
+#include "proto.h"
+
+// a synthetic, heavily edited world of BENCH_CHUNKS by BENCH_CHUNKS chunks
+#define BENCH_CHUNKS 16
+#define BENCH_BLOCKS 4096
+#define BENCH_LIGHTS 256
+
+double _bench_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _bench_clear(const char *path) {
+    char other[600];
+    remove(path);
+    snprintf(other, sizeof(other), "%s-wal", path);
+    remove(other);
+    snprintf(other, sizeof(other), "%s-shm", path);
+    remove(other);
+    snprintf(other, sizeof(other), "%s.regions/r.0.0.dat", path);
+    remove(other);
+}
+
+int _bench_format(const char *dir, const char *name, int format) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bench-%s.db", dir, name);
+    _bench_clear(path);
+    db_set_format(format);
+    if (db_init(path)) {
+        return -1;
+    }
+    srand(1);
+    double start = _bench_time();
+    int writes = 0;
+    for (int p = 0; p < BENCH_CHUNKS; p++) {
+        for (int q = 0; q < BENCH_CHUNKS; q++) {
+            for (int i = 0; i < BENCH_BLOCKS; i++) {
+                int x = p * CHUNK_SIZE + rand() % CHUNK_SIZE;
+                int y = rand() % 128;
+                int z = q * CHUNK_SIZE + rand() % CHUNK_SIZE;
+                db_insert_block(p, q, x, y, z, 1 + rand() % 60);
+                writes++;
+            }
+            for (int i = 0; i < BENCH_LIGHTS; i++) {
+                int x = p * CHUNK_SIZE + rand() % CHUNK_SIZE;
+                int y = rand() % 128;
+                int z = q * CHUNK_SIZE + rand() % CHUNK_SIZE;
+                db_insert_light(p, q, x, y, z, 15);
+                writes++;
+            }
+        }
+    }
+    // closing waits for the writer to flush everything
+    db_close();
+    double save = _bench_time() - start;
+    if (db_init(path)) {
+        return -1;
+    }
+    start = _bench_time();
+    int blocks = 0;
+    for (int p = 0; p < BENCH_CHUNKS; p++) {
+        for (int q = 0; q < BENCH_CHUNKS; q++) {
+            int dx = p * CHUNK_SIZE - 1;
+            int dz = q * CHUNK_SIZE - 1;
+            Map block_map;
+            Map light_map;
+            map_alloc(&block_map, dx, 0, dz, 0x7fff);
+            map_alloc(&light_map, dx, 0, dz, 0xf);
+            db_load_blocks(&block_map, p, q);
+            db_load_lights(&light_map, p, q);
+            blocks += block_map.size;
+            map_free(&block_map);
+            map_free(&light_map);
+        }
+    }
+    double load = _bench_time() - start;
+    db_close();
+    int chunks = BENCH_CHUNKS * BENCH_CHUNKS;
+    printf("%-8s save %8.0f writes/s  load %8.1f chunks/s  (%d blocks)\n",
+        name, writes / save, chunks / load, blocks);
+    return 0;
+}
+
+// Compares save and load throughput of the storage formats. Each world is
+// written from scratch, then every chunk is loaded back on one thread.
+int bench_storage(const char *dir) {
+    db_enable();
+    if (_bench_format(dir, "rows", DB_FORMAT_ROWS) ||
+        _bench_format(dir, "blobs", DB_FORMAT_BLOBS) ||
+        _bench_format(dir, "regions", DB_FORMAT_REGIONS))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// a chunk response as the server sends it, repeated until timing is stable
+#define BENCH_RESPONSE_BLOCKS 4096
+#define BENCH_RESPONSE_LIGHTS 256
+#define BENCH_PROTOCOL_TIME 0.5
+
+int _bench_entries(int *entries, int count, int p, int q) {
+    for (int i = 0; i < count; i++) {
+        entries[i * 4] = p * CHUNK_SIZE + rand() % CHUNK_SIZE;
+        entries[i * 4 + 1] = rand() % 256;
+        entries[i * 4 + 2] = q * CHUNK_SIZE + rand() % CHUNK_SIZE;
+        entries[i * 4 + 3] = 1 + rand() % 60;
+    }
+    return count;
+}
+
+// the lines the client receives for one chunk response
+int _bench_encode_text(
+    char *data, int p, int q, const int *blocks, const int *lights)
+{
+    int size = 0;
+    for (int i = 0; i < BENCH_RESPONSE_BLOCKS; i++) {
+        const int *e = blocks + i * 4;
+        size += sprintf(data + size, "B,%d,%d,%d,%d,%d,%d\n",
+            p, q, e[0], e[1], e[2], e[3]);
+    }
+    for (int i = 0; i < BENCH_RESPONSE_LIGHTS; i++) {
+        const int *e = lights + i * 4;
+        size += sprintf(data + size, "L,%d,%d,%d,%d,%d,%d\n",
+            p, q, e[0], e[1], e[2], e[3]);
+    }
+    size += sprintf(data + size, "K,%d,%d,%d\nR,%d,%d\nC,%d,%d\n",
+        p, q, 1, p, q, p, q);
+    return size;
+}
+
+// decodes the lines the way the receive thread does
+int _bench_decode_text(char *data, int size) {
+    int checksum = 0;
+    Message message;
+    char *line = data;
+    char *end = data + size;
+    while (line < end) {
+        char *next = memchr(line, '\n', end - line);
+        *next = '\0';
+        if (!message_parse(line, &message) &&
+            (message.type == 'B' || message.type == 'L'))
+        {
+            MessageField *v = message.fields;
+            checksum += v[2].i + v[3].i + v[4].i + v[5].i;
+        }
+        *next = '\n';
+        line = next + 1;
+    }
+    return checksum;
+}
+
+int _bench_decode_frames(const char *data, int size) {
+    int checksum = 0;
+    ProtoFrame frame;
+    ProtoChunk chunk;
+    int n;
+    while ((n = proto_frame(data, size, &frame)) > 0) {
+        data += n;
+        size -= n;
+        if (frame.type != 'C' || proto_read_chunk(&frame, &chunk)) {
+            continue;
+        }
+        int x, y, z, w;
+        for (int i = 0; i < chunk.block_count; i++) {
+            proto_chunk_entry(&chunk, chunk.blocks, i, &x, &y, &z, &w);
+            checksum += x + y + z + w;
+        }
+        for (int i = 0; i < chunk.light_count; i++) {
+            proto_chunk_entry(&chunk, chunk.lights, i, &x, &y, &z, &w);
+            checksum += x + y + z + w;
+        }
+    }
+    return checksum;
+}
+
+void _bench_report(
+    const char *name, int size, int count, double encode, double decode)
+{
+    int records = BENCH_RESPONSE_BLOCKS + BENCH_RESPONSE_LIGHTS;
+    printf("%-8s %7d bytes  encode %8.2f M records/s  "
+        "decode %8.2f M records/s\n",
+        name, size, records * count / encode / 1e6,
+        records * count / decode / 1e6);
+}
+
+// Compares the wire size and the encode and decode cost of one chunk
+// response in protocol versions 1 and 2.
+int bench_protocol() {
+    int p = -7;
+    int q = 12;
+    int *blocks = malloc(sizeof(int) * 4 * BENCH_RESPONSE_BLOCKS);
+    int *lights = malloc(sizeof(int) * 4 * BENCH_RESPONSE_LIGHTS);
+    srand(1);
+    _bench_entries(blocks, BENCH_RESPONSE_BLOCKS, p, q);
+    _bench_entries(lights, BENCH_RESPONSE_LIGHTS, p, q);
+    char *text = malloc(64 * (BENCH_RESPONSE_BLOCKS + BENCH_RESPONSE_LIGHTS));
+    char *frames = malloc(
+        proto_chunk_size(BENCH_RESPONSE_BLOCKS, BENCH_RESPONSE_LIGHTS) +
+        PROTO_REDRAW_SIZE);
+
+    int size = 0;
+    int count = 0;
+    double start = _bench_time();
+    while (_bench_time() - start < BENCH_PROTOCOL_TIME) {
+        size = _bench_encode_text(text, p, q, blocks, lights);
+        count++;
+    }
+    double encode = _bench_time() - start;
+    int checksum = 0;
+    start = _bench_time();
+    for (int i = 0; i < count; i++) {
+        checksum = _bench_decode_text(text, size);
+    }
+    _bench_report("v1", size, count, encode, _bench_time() - start);
+
+    int expected = checksum;
+    count = 0;
+    start = _bench_time();
+    while (_bench_time() - start < BENCH_PROTOCOL_TIME) {
+        size = proto_chunk(frames, p, q, 1,
+            blocks, BENCH_RESPONSE_BLOCKS, lights, BENCH_RESPONSE_LIGHTS);
+        size += proto_redraw(frames + size, p, q);
+        count++;
+    }
+    encode = _bench_time() - start;
+    start = _bench_time();
+    for (int i = 0; i < count; i++) {
+        checksum = _bench_decode_frames(frames, size);
+    }
+    _bench_report("v2", size, count, encode, _bench_time() - start);
+
+    free(blocks);
+    free(lights);
+    free(text);
+    free(frames);
+    if (checksum != expected) {
+        fprintf(stderr, "protocol versions decoded different records\n");
+        return -1;
+    }
+    return 0;
+}
+
+// a chunk dump with the other messages a busy server sends mixed in
+#define BENCH_PARSER_TIME 0.5
+
+// MAX_NAME_LENGTH, game.h needs the window headers
+#define BENCH_NAME_LENGTH 32
+
+int _bench_stream(char *data) {
+    int *blocks = malloc(sizeof(int) * 4 * BENCH_RESPONSE_BLOCKS);
+    int *lights = malloc(sizeof(int) * 4 * BENCH_RESPONSE_LIGHTS);
+    int size = 0;
+    srand(1);
+    for (int p = -2; p <= 2; p++) {
+        _bench_entries(blocks, BENCH_RESPONSE_BLOCKS, p, 3);
+        _bench_entries(lights, BENCH_RESPONSE_LIGHTS, p, 3);
+        size += _bench_encode_text(data + size, p, 3, blocks, lights);
+        for (int i = 0; i < 64; i++) {
+            size += sprintf(data + size,
+                "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n"
+                "S,%d,3,%d,%d,%d,%d,sign number %d\n",
+                i % 8, rand() % 10000 / 100.0, rand() % 10000 / 100.0,
+                rand() % 10000 / 100.0, rand() % 628 / 100.0,
+                rand() % 314 / 100.0 - 1.57,
+                p, p * CHUNK_SIZE + i % CHUNK_SIZE, 10 + i, 3 * CHUNK_SIZE,
+                i % 8, i);
+        }
+        size += sprintf(data + size,
+            "T,player%d> hello there\nN,%d,player%d\nE,%.6f,600\nD,%d\n",
+            p + 2, p + 2, p + 2, 1234.5 + p, p + 2);
+    }
+    free(blocks);
+    free(lights);
+    return size;
+}
+
+// the sscanf calls the client made before it dispatched on the tag
+int _bench_parse_sscanf(char *line) {
+    int checksum = 0;
+    int pid, bp, bq, bx, by, bz, bw, kp, kq, kk, face, day_length;
+    float ux, uy, uz, urx, ury;
+    double elapsed;
+    if (sscanf(line, "U,%d,%f,%f,%f,%f,%f",
+        &pid, &ux, &uy, &uz, &urx, &ury) == 6)
+    {
+        checksum += pid + (int)(ux + uy + uz + urx + ury);
+    }
+    if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
+        &bp, &bq, &bx, &by, &bz, &bw) == 6)
+    {
+        checksum += bp + bq + bx + by + bz + bw;
+    }
+    if (sscanf(line, "L,%d,%d,%d,%d,%d,%d",
+        &bp, &bq, &bx, &by, &bz, &bw) == 6)
+    {
+        checksum += bp + bq + bx + by + bz + bw;
+    }
+    if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
+        &pid, &ux, &uy, &uz, &urx, &ury) == 6)
+    {
+        checksum += pid + (int)(ux + uy + uz + urx + ury);
+    }
+    if (sscanf(line, "D,%d", &pid) == 1) {
+        checksum += pid;
+    }
+    if (sscanf(line, "K,%d,%d,%d", &kp, &kq, &kk) == 3) {
+        checksum += kp + kq + kk;
+    }
+    if (sscanf(line, "R,%d,%d", &kp, &kq) == 2) {
+        checksum += kp + kq;
+    }
+    if (sscanf(line, "E,%lf,%d", &elapsed, &day_length) == 2) {
+        checksum += (int)elapsed + day_length;
+    }
+    if (line[0] == 'T' && line[1] == ',') {
+        checksum += strlen(line + 2);
+    }
+    char format[64];
+    snprintf(format, sizeof(format), "N,%%d,%%%ds", BENCH_NAME_LENGTH - 1);
+    char name[BENCH_NAME_LENGTH];
+    if (sscanf(line, format, &pid, name) == 2) {
+        checksum += pid + strlen(name);
+    }
+    snprintf(
+        format, sizeof(format),
+        "S,%%d,%%d,%%d,%%d,%%d,%%d,%%%d[^\n]", MAX_SIGN_LENGTH - 1);
+    char text[MAX_SIGN_LENGTH] = {0};
+    if (sscanf(line, format, &bp, &bq, &bx, &by, &bz, &face, text) >= 6) {
+        checksum += bp + bq + bx + by + bz + face + strlen(text);
+    }
+    return checksum;
+}
+
+// the length of a text field once truncated to its buffer
+int _bench_length(const char *text, int limit) {
+    int length = strlen(text);
+    return length < limit ? length : limit;
+}
+
+int _bench_parse_table(char *line) {
+    Message message;
+    if (message_parse(line, &message)) {
+        return 0;
+    }
+    MessageField *v = message.fields;
+    switch (message.type) {
+        case 'U':
+        case 'P':
+            return v[0].i + (int)(v[1].f + v[2].f + v[3].f + v[4].f + v[5].f);
+        case 'B':
+        case 'L':
+            return v[0].i + v[1].i + v[2].i + v[3].i + v[4].i + v[5].i;
+        case 'D':
+            return v[0].i;
+        case 'K':
+            return v[0].i + v[1].i + v[2].i;
+        case 'R':
+            return v[0].i + v[1].i;
+        case 'E':
+            return (int)v[0].d + v[1].i;
+        case 'T':
+            return strlen(message.text);
+        case 'N':
+            return v[0].i + _bench_length(message.text, BENCH_NAME_LENGTH - 1);
+        case 'S':
+            return v[0].i + v[1].i + v[2].i + v[3].i + v[4].i + v[5].i +
+                _bench_length(message.text, MAX_SIGN_LENGTH - 1);
+    }
+    return 0;
+}
+
+typedef int (*bench_parse_func)(char *);
+
+double _bench_parse(
+    char *data, int size, bench_parse_func func, int *checksum)
+{
+    int count = 0;
+    double start = _bench_time();
+    // at least one pass, which sets the checksum
+    do {
+        *checksum = 0;
+        char *line = data;
+        char *end = data + size;
+        while (line < end) {
+            char *next = memchr(line, '\n', end - line);
+            if (!next) {
+                next = end;
+            }
+            char c = *next;
+            *next = '\0';
+            *checksum += func(line);
+            *next = c;
+            line = next + 1;
+        }
+        count++;
+    } while (_bench_time() - start < BENCH_PARSER_TIME);
+    return (_bench_time() - start) / count;
+}
+
+// Compares the sscanf cascade the client used to run on every line with
+// the tag dispatched parser, on a recorded stream of version 1 server
+// output or a synthetic chunk dump.
+int bench_parser(const char *path) {
+    char *data;
+    int size;
+    if (path) {
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return -1;
+        }
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = malloc(size + 1);
+        size = fread(data, 1, size, file);
+        fclose(file);
+    }
+    else {
+        data = malloc(5 * (64 * (BENCH_RESPONSE_BLOCKS +
+            BENCH_RESPONSE_LIGHTS + 200)));
+        size = _bench_stream(data);
+    }
+    int lines = 0;
+    for (int i = 0; i < size; i++) {
+        lines += data[i] == '\n';
+    }
+    int expected, checksum;
+    double before = _bench_parse(data, size, _bench_parse_sscanf, &expected);
+    double after = _bench_parse(data, size, _bench_parse_table, &checksum);
+    printf("%d bytes, %d lines\n", size, lines);
+    printf("%-8s %8.2f M lines/s\n", "sscanf", lines / before / 1e6);
+    printf("%-8s %8.2f M lines/s\n", "table", lines / after / 1e6);
+    free(data);
+    if (checksum != expected) {
+        fprintf(stderr, "parsers read different fields\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef _bench_h_
+#define _bench_h_
+
+int bench_storage(const char *dir);
+int bench_protocol();
+int bench_parser(const char *path);
+
+#endif
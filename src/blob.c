@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include "blob.h"
+#include "config.h"
+#include "lodepng.h"
+
+#define BLOB_WIDTH (CHUNK_SIZE + 2)
+
+void blob_alloc(Blob *blob, int p, int q) {
+    blob->p = p;
+    blob->q = q;
+    blob->capacity = 256;
+    blob->size = 0;
+    blob->data = (BlobEntry *)calloc(blob->capacity, sizeof(BlobEntry));
+}
+
+void blob_free(Blob *blob) {
+    free(blob->data);
+    blob->data = NULL;
+}
+
+void blob_clear(Blob *blob, int p, int q) {
+    blob->p = p;
+    blob->q = q;
+    blob->size = 0;
+}
+
+int blob_set(Blob *blob, int x, int y, int z, int w) {
+    int lx = x - (blob->p * CHUNK_SIZE - 1);
+    int lz = z - (blob->q * CHUNK_SIZE - 1);
+    if (lx < 0 || lx >= BLOB_WIDTH || lz < 0 || lz >= BLOB_WIDTH ||
+        y < 0 || y >= 256)
+    {
+        return 0;
+    }
+    if (blob->size == blob->capacity) {
+        blob->capacity *= 2;
+        blob->data = (BlobEntry *)realloc(
+            blob->data, blob->capacity * sizeof(BlobEntry));
+    }
+    BlobEntry *e = blob->data + blob->size;
+    e->key = (y * BLOB_WIDTH + lx) * BLOB_WIDTH + lz;
+    e->order = blob->size;
+    e->w = w;
+    blob->size++;
+    return 1;
+}
+
+int _blob_entry_compare(const void *arg1, const void *arg2) {
+    const BlobEntry *a = (const BlobEntry *)arg1;
+    const BlobEntry *b = (const BlobEntry *)arg2;
+    if (a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    return a->order - b->order;
+}
+
+// sorts by position and keeps only the latest write to each one
+void blob_compact(Blob *blob) {
+    qsort(blob->data, blob->size, sizeof(BlobEntry), _blob_entry_compare);
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < blob->size; i++) {
+        if (i + 1 < blob->size && blob->data[i + 1].key == blob->data[i].key) {
+            continue;
+        }
+        blob->data[count] = blob->data[i];
+        blob->data[count].order = count;
+        count++;
+    }
+    blob->size = count;
+}
+
+// drops entries on the one block border around the chunk, older versions
+// stored copies of their neighbours' edge blocks there
+int blob_trim(Blob *blob) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < blob->size; i++) {
+        unsigned int key = blob->data[i].key;
+        int lz = key % BLOB_WIDTH;
+        int lx = (key / BLOB_WIDTH) % BLOB_WIDTH;
+        if (lx == 0 || lz == 0 ||
+            lx == BLOB_WIDTH - 1 || lz == BLOB_WIDTH - 1)
+        {
+            continue;
+        }
+        blob->data[count] = blob->data[i];
+        blob->data[count].order = count;
+        count++;
+    }
+    int result = blob->size - count;
+    blob->size = count;
+    return result;
+}
+
+void _blob_put_int(unsigned char *data, unsigned int value) {
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+unsigned int _blob_get_int(const unsigned char *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        ((unsigned int)data[3] << 24);
+}
+
+int blob_encode(Blob *blob, unsigned char **data, int *size) {
+    blob_compact(blob);
+    // at most three bytes of key delta and one of block type per entry
+    unsigned char *raw = (unsigned char *)malloc(blob->size * 4 + 1);
+    unsigned int length = 0;
+    unsigned int previous = 0;
+    for (unsigned int i = 0; i < blob->size; i++) {
+        BlobEntry *e = blob->data + i;
+        unsigned int delta = e->key - previous;
+        while (delta >= 0x80) {
+            raw[length++] = (delta & 0x7f) | 0x80;
+            delta >>= 7;
+        }
+        raw[length++] = delta;
+        raw[length++] = (unsigned char)(signed char)e->w;
+        previous = e->key;
+    }
+    unsigned char *deflated = 0;
+    size_t deflated_size = 0;
+    if (lodepng_zlib_compress(&deflated, &deflated_size, raw, length,
+        &lodepng_default_compress_settings))
+    {
+        free(raw);
+        free(deflated);
+        return -1;
+    }
+    free(raw);
+    unsigned char *result =
+        (unsigned char *)malloc(BLOB_HEADER_SIZE + deflated_size);
+    result[0] = 'C';
+    result[1] = 'B';
+    result[2] = BLOB_VERSION;
+    result[3] = 0;
+    _blob_put_int(result + 4, blob->size);
+    _blob_put_int(result + 8, length);
+    memcpy(result + BLOB_HEADER_SIZE, deflated, deflated_size);
+    free(deflated);
+    *data = result;
+    *size = BLOB_HEADER_SIZE + deflated_size;
+    return 0;
+}
+
+typedef void (*blob_func)(int, int, int, int, void *);
+
+int _blob_read(
+    int p, int q, const unsigned char *data, int size,
+    blob_func func, void *arg)
+{
+    if (size < BLOB_HEADER_SIZE || data[0] != 'C' || data[1] != 'B' ||
+        data[2] != BLOB_VERSION)
+    {
+        return -1;
+    }
+    unsigned int count = _blob_get_int(data + 4);
+    unsigned int length = _blob_get_int(data + 8);
+    unsigned char *raw = 0;
+    size_t raw_size = 0;
+    if (lodepng_zlib_decompress(&raw, &raw_size,
+        data + BLOB_HEADER_SIZE, size - BLOB_HEADER_SIZE,
+        &lodepng_default_decompress_settings) || raw_size != length)
+    {
+        free(raw);
+        return -1;
+    }
+    int ox = p * CHUNK_SIZE - 1;
+    int oz = q * CHUNK_SIZE - 1;
+    unsigned int key = 0;
+    size_t offset = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int delta = 0;
+        int shift = 0;
+        while (offset < raw_size && (raw[offset] & 0x80) && shift < 28) {
+            delta |= (raw[offset++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (offset + 2 > raw_size) {
+            free(raw);
+            return -1;
+        }
+        delta |= raw[offset++] << shift;
+        int w = (signed char)raw[offset++];
+        key += delta;
+        int z = key % BLOB_WIDTH;
+        int x = (key / BLOB_WIDTH) % BLOB_WIDTH;
+        int y = key / (BLOB_WIDTH * BLOB_WIDTH);
+        func(x + ox, y, z + oz, w, arg);
+    }
+    free(raw);
+    return 0;
+}
+
+void _blob_set_func(int x, int y, int z, int w, void *arg) {
+    blob_set((Blob *)arg, x, y, z, w);
+}
+
+void _blob_map_set_func(int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+// appends the entries of an encoded blob, later writes still win
+int blob_decode(Blob *blob, const unsigned char *data, int size) {
+    return _blob_read(blob->p, blob->q, data, size, _blob_set_func, blob);
+}
+
+// decodes straight into a chunk's block map
+int blob_load(Map *map, int p, int q, const unsigned char *data, int size) {
+    return _blob_read(p, q, data, size, _blob_map_set_func, map);
+}
@@ -0,0 +1,36 @@
+#ifndef _blob_h_
+#define _blob_h_
+
+#include "map.h"
+
+// Compressed per-chunk edit records. Positions are relative to the chunk
+// including its one block border, sorted and delta encoded, then deflated.
+
+#define BLOB_VERSION 1
+#define BLOB_HEADER_SIZE 12
+
+typedef struct {
+    unsigned int key;
+    int order;
+    int w;
+} BlobEntry;
+
+typedef struct {
+    int p;
+    int q;
+    unsigned int capacity;
+    unsigned int size;
+    BlobEntry *data;
+} Blob;
+
+void blob_alloc(Blob *blob, int p, int q);
+void blob_free(Blob *blob);
+void blob_clear(Blob *blob, int p, int q);
+int blob_set(Blob *blob, int x, int y, int z, int w);
+void blob_compact(Blob *blob);
+int blob_trim(Blob *blob);
+int blob_encode(Blob *blob, unsigned char **data, int *size);
+int blob_decode(Blob *blob, const unsigned char *data, int size);
+int blob_load(Map *map, int p, int q, const unsigned char *data, int size);
+
+#endif
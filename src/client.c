@@ -5,6 +5,9 @@
     #define sleep Sleep
 #else
     #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/uio.h>
     #include <unistd.h>
 #endif
 
@@ -12,20 +15,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include "client.h"
+#include "config.h"
+#include "proto.h"
+#include "queue.h"
+#include "stream.h"
 #include "tinycthread.h"
 
 #define QUEUE_SIZE 1048576
-#define RECV_SIZE 4096
+#define QUEUE_MAX_SIZE (64 * 1048576)
+#define SEND_SEGMENT_SIZE 16384
+#define SEND_SEGMENTS (SEND_BUFFER_SIZE / SEND_SEGMENT_SIZE)
 
 static int client_enabled = 0;
 static int running = 0;
 static int sd = 0; // Socket of the server
 static int bytes_sent = 0;
 static int bytes_received = 0;
-static char *queue = 0;
-static int qsize = 0;
+static Stream stream; // received bytes, only touched by the receive thread
+static Queue events; // parsed messages for the main thread
+static int pending = 0; // events queued and not applied yet
+static int throttled = 0; // the receive thread waits for pending to drop
+static int upgraded = 0; // the server answered the offer of a newer protocol
+static char *segments[SEND_SEGMENTS]; // outgoing bytes until client_flush
+static int send_size = 0;
+static ClientStats stats;
+static int offered = 0; // a newer protocol was offered to the server
+static int send_version = 1;
+static int moves = 0; // positions can be sent as moves from position_base
+static int position_base[5];
 static thrd_t recv_thread;
 static mtx_t mutex;
+static cnd_t drained;
 
 // Enables the client
 void client_enable() {
@@ -54,38 +74,142 @@ int client_sendall(int sd, char *data, int length) {
     }
     int count = 0;
     while (count < length) {
-        int n = send(sd, data + count, length, 0);
+        int n = send(sd, data + count, length - count, 0);
+        stats.syscalls++;
         if (n == -1) {
             return -1;
         }
         count += n;
-        length -= n;
         bytes_sent += n;
     }
     return 0;
 }
 
+// Writes the buffered segments in as few calls as the socket allows
+int _client_writev(int count) {
+#ifdef _WIN32
+    for (int i = 0; i < count; i++) {
+        int length = send_size - i * SEND_SEGMENT_SIZE;
+        if (length > SEND_SEGMENT_SIZE) {
+            length = SEND_SEGMENT_SIZE;
+        }
+        if (client_sendall(sd, segments[i], length) == -1) {
+            return -1;
+        }
+    }
+#else
+    struct iovec iov[SEND_SEGMENTS];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = segments[i];
+        iov[i].iov_len = SEND_SEGMENT_SIZE;
+    }
+    iov[count - 1].iov_len = send_size - (count - 1) * SEND_SEGMENT_SIZE;
+    struct iovec *next = iov;
+    while (count) {
+        ssize_t n = writev(sd, next, count);
+        stats.syscalls++;
+        if (n == -1) {
+            return -1;
+        }
+        bytes_sent += n;
+        // skips what went out, a partial write can end inside a segment
+        while (count && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+#endif
+    return 0;
+}
+
+// Sends everything buffered since the last flush, called once per frame
+// and whenever the buffer fills up
+void client_flush() {
+    if (!client_enabled || !send_size) {
+        return;
+    }
+    int count = (send_size + SEND_SEGMENT_SIZE - 1) / SEND_SEGMENT_SIZE;
+    if (_client_writev(count) == -1) {
+        perror("client_flush");
+        exit(1);
+    }
+    stats.flushes++;
+    send_size = 0;
+}
+
+// Buffers raw bytes, messages may span segments
+void _client_send_data(const char *data, int length) {
+    stats.messages++;
+    while (length) {
+        if (send_size == SEND_BUFFER_SIZE) {
+            client_flush();
+        }
+        int index = send_size / SEND_SEGMENT_SIZE;
+        int offset = send_size % SEND_SEGMENT_SIZE;
+        if (!segments[index]) {
+            segments[index] = malloc(SEND_SEGMENT_SIZE);
+        }
+        int n = SEND_SEGMENT_SIZE - offset;
+        n = n < length ? n : length;
+        memcpy(segments[index] + offset, data, n);
+        send_size += n;
+        data += n;
+        length -= n;
+    }
+}
+
+// Returns the counts behind the network line of the stats text, the calls
+// saved are the messages that did not need a send of their own
+void client_get_stats(ClientStats *result) {
+    if (!client_enabled) {
+        memset(result, 0, sizeof(ClientStats));
+        return;
+    }
+    memcpy(result, &stats, sizeof(ClientStats));
+    result->bytes_sent = bytes_sent;
+    result->bytes_received = __atomic_load_n(&bytes_received, __ATOMIC_RELAXED);
+    result->saved = stats.messages - stats.syscalls;
+}
+
 // Calls the client_sendall function and handles errors for it
 // exits with a return value of 1 upon error, returns nothing otherwise
+// Once protocol version 2 is in use the line is sent as a text frame
 // USE THIS ONE TO SEND DATA, NOT SENDALL
 void client_send(char *data) {
     if (!client_enabled) {
         return;
     }
-    if (client_sendall(sd, data, strlen(data)) == -1) {
-        perror("client_sendall");
-        exit(1);
+    if (send_version >= 2) {
+        char frame[PROTO_HEADER_SIZE + 1024];
+        int length = proto_text(frame, sizeof(frame), data);
+        if (length > 0) {
+            _client_send_data(frame, length);
+        }
+        return;
     }
+    _client_send_data(data, strlen(data));
 }
 
-// Gets the game version of the client and sends it to the server
+// Announces protocol version 1 to the server and offers a newer version
+// if the client speaks one. Servers that know it answer with a V line
+// that is the last text they send, older servers ignore the offer.
 void client_version(int version) {
     if (!client_enabled) {
         return;
     }
     char buffer[1024];
-    snprintf(buffer, 1024, "V,%d\n", version);
+    snprintf(buffer, 1024, "V,%d\n", 1);
     client_send(buffer);
+    if (version > 1) {
+        __atomic_store_n(&offered, version, __ATOMIC_RELEASE);
+        snprintf(buffer, 1024, "V,%d\n", version);
+        client_send(buffer);
+    }
 }
 
 // Sends the client's username and ID token to the server for authentification
@@ -116,6 +240,27 @@ void client_position(float x, float y, float z, float rx, float ry) {
         return;
     }
     px = x; py = y; pz = z; prx = rx; pry = ry;
+    if (send_version >= 2) {
+        float values[5] = {x, y, z, rx, ry};
+        int fixed[5];
+        proto_quantize(values, fixed);
+        char frame[PROTO_POSITION_SIZE];
+        int size = -1;
+        if (moves) {
+            size = proto_move(frame, 0, position_base, fixed);
+        }
+        if (size < 0) {
+            // the server takes the quantized values as the next base
+            proto_dequantize(fixed, values);
+            size = proto_position(
+                frame, 0, values[0], values[1], values[2], values[3],
+                values[4]);
+        }
+        memcpy(position_base, fixed, sizeof(position_base));
+        moves = 1;
+        _client_send_data(frame, size);
+        return;
+    }
     char buffer[1024];
     snprintf(buffer, 1024, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", x, y, z, rx, ry);
     client_send(buffer);
@@ -126,16 +271,40 @@ void client_chunk(int p, int q, int key) {
     if (!client_enabled) {
         return;
     }
+    if (send_version >= 2) {
+        char frame[PROTO_KEY_SIZE];
+        proto_request(frame, p, q, key);
+        _client_send_data(frame, sizeof(frame));
+        return;
+    }
     char buffer[1024];
     snprintf(buffer, 1024, "C,%d,%d,%d\n", p, q, key);
     client_send(buffer);
 }
 
+// Tells the server that a chunk it asked for was unloaded, so that it
+// stops sending changes to it
+void client_unload(int p, int q) {
+    if (!client_enabled) {
+        return;
+    }
+    char buffer[1024];
+    snprintf(buffer, 1024, "X,%d,%d\n", p, q);
+    client_send(buffer);
+}
+
 // Sends the client's current block coordinate to the server
 void client_block(int x, int y, int z, int w) {
     if (!client_enabled) {
         return;
     }
+    if (send_version >= 2) {
+        // the server works out the chunk itself
+        char frame[PROTO_BLOCK_SIZE];
+        proto_block(frame, 'B', 0, 0, x, y, z, w);
+        _client_send_data(frame, sizeof(frame));
+        return;
+    }
     char buffer[1024];
     snprintf(buffer, 1024, "B,%d,%d,%d,%d\n", x, y, z, w);
     client_send(buffer);
@@ -146,6 +315,12 @@ void client_light(int x, int y, int z, int w) {
     if (!client_enabled) {
         return;
     }
+    if (send_version >= 2) {
+        char frame[PROTO_BLOCK_SIZE];
+        proto_block(frame, 'L', 0, 0, x, y, z, w);
+        _client_send_data(frame, sizeof(frame));
+        return;
+    }
     char buffer[1024];
     snprintf(buffer, 1024, "L,%d,%d,%d,%d\n", x, y, z, w);
     client_send(buffer);
@@ -174,41 +349,145 @@ void client_talk(const char *text) {
     client_send(buffer);
 }
 
-// Receives data from the server in the form of a string
-// Creates a new thread for this operation
-// Returns the string received
-// Probably don't call this on its own
-char *client_recv() {
+// Returns the length of the text up to and including the server's answer
+// to a protocol offer, or 0 if it is not among the given lines
+int _client_find_upgrade(const char *data, int length, int offer) {
+    char line[16];
+    snprintf(line, sizeof(line), "V,%d\n", offer);
+    int size = strlen(line);
+    const char *start = data;
+    while (start < data + length) {
+        const char *end = memchr(start, '\n', data + length - start);
+        if (end - start + 1 == size && memcmp(start, line, size) == 0) {
+            return end - data + 1;
+        }
+        start = end + 1;
+    }
+    return 0;
+}
+
+// Returns the next message the receive thread parsed, or 0 if there is
+// none, apply it and pass it to event_free
+// Once the server has answered our protocol offer this also sends our own
+// answer, the server reads frames from us after it
+int client_event(Event *event) {
     if (!client_enabled) {
         return 0;
     }
-    char *result = 0;
+    if (__atomic_load_n(&upgraded, __ATOMIC_ACQUIRE) &&
+        send_version < offered)
+    {
+        // the same line marks where our own frames start
+        char line[16];
+        snprintf(line, sizeof(line), "V,%d\n", offered);
+        _client_send_data(line, strlen(line));
+        send_version = offered;
+    }
+    int found = queue_get(&events, event);
+    if (found) {
+        __atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+    }
+    // the receive thread checks pending under the mutex before it waits
     mtx_lock(&mutex);
-    char *p = queue + qsize - 1;
-    while (p >= queue && *p != '\n') {
-        p--;
-    }
-    if (p >= queue) {
-        int length = p - queue + 1;
-        result = malloc(sizeof(char) * (length + 1));
-        memcpy(result, queue, sizeof(char) * length);
-        result[length] = '\0';
-        int remaining = qsize - length;
-        memmove(queue, p + 1, remaining);
-        qsize -= length;
-        bytes_received += length;
+    if (throttled) {
+        cnd_signal(&drained);
     }
     mtx_unlock(&mutex);
-    return result;
+    return found;
+}
+
+void _client_put(Event *event) {
+    __atomic_add_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+    queue_put(&events, event);
+}
+
+// Parses the complete lines at the front of the stream into events, up to
+// the server's answer to a protocol offer, and returns the bytes used
+int _client_parse_lines(char *data, int length, int *version) {
+    int offer = __atomic_load_n(&offered, __ATOMIC_ACQUIRE);
+    if (offer) {
+        // frames follow the answer
+        int end = _client_find_upgrade(data, length, offer);
+        if (end) {
+            length = end;
+            *version = offer;
+            __atomic_store_n(&upgraded, 1, __ATOMIC_RELEASE);
+        }
+    }
+    Event event;
+    char *end = data + length;
+    while (data < end) {
+        char *line = data;
+        char *newline = memchr(data, '\n', end - data);
+        *newline = '\0';
+        data = newline + 1;
+        if (!event_line(line, &event)) {
+            _client_put(&event);
+        }
+    }
+    return length;
 }
 
-// Continually receives data from the server until completion
-// Pass in client_recv() to use this function
+void _client_parse_frames(const char *data, int length) {
+    ProtoFrame frame;
+    Event event;
+    int n;
+    while ((n = proto_frame(data, length, &frame)) > 0) {
+        data += n;
+        length -= n;
+        if (!event_frame(&frame, &event)) {
+            _client_put(&event);
+        }
+    }
+}
+
+// Parses everything complete in the stream, the version switches to
+// frames right after the server's answer to our offer
+void _client_parse(int *version) {
+    while (1) {
+        int length;
+        char *data;
+        if (*version >= 2) {
+            data = stream_frames(&stream, &length);
+            if (length < 0) {
+                fprintf(stderr, "invalid frame from server\n");
+                exit(1);
+            }
+            if (!data) {
+                return;
+            }
+            _client_parse_frames(data, length);
+        }
+        else {
+            data = stream_lines(&stream, &length);
+            if (!data) {
+                return;
+            }
+            length = _client_parse_lines(data, length, version);
+        }
+        __atomic_add_fetch(&bytes_received, length, __ATOMIC_RELAXED);
+        stream_consume(&stream, length);
+    }
+}
+
+// Continually receives data from the server straight into the free space
+// of the stream, parses it and waits while the main thread is behind
 int recv_worker(void *arg) {
-    char *data = malloc(sizeof(char) * RECV_SIZE);
+    int version = 1;
     while (1) {
+        char *data;
+        int size = stream_space(&stream, &data);
+        if (!size) {
+            // a single message larger than the whole stream
+            if (stream.capacity >= QUEUE_MAX_SIZE) {
+                fprintf(stderr, "message from server too large\n");
+                exit(1);
+            }
+            stream_grow(&stream, stream.capacity * 2);
+            continue;
+        }
         int length;
-        if ((length = recv(sd, data, RECV_SIZE - 1, 0)) <= 0) {
+        if ((length = recv(sd, data, size, 0)) <= 0) {
             if (running) {
                 perror("recv");
                 exit(1);
@@ -217,23 +496,25 @@ int recv_worker(void *arg) {
                 break;
             }
         }
-        data[length] = '\0';
-        while (1) {
-            int done = 0;
-            mtx_lock(&mutex);
-            if (qsize + length < QUEUE_SIZE) {
-                memcpy(queue + qsize, data, sizeof(char) * (length + 1));
-                qsize += length;
-                done = 1;
-            }
-            mtx_unlock(&mutex);
-            if (done) {
-                break;
+        stream_commit(&stream, length);
+        _client_parse(&version);
+        mtx_lock(&mutex);
+        if (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) > EVENT_QUEUE_SIZE) {
+            // wait until the main thread has applied half of the queue
+            throttled = 1;
+            while (running && __atomic_load_n(&pending, __ATOMIC_ACQUIRE) >
+                EVENT_QUEUE_SIZE / 2)
+            {
+                cnd_wait(&drained, &mutex);
             }
-            sleep(0);
+            throttled = 0;
+        }
+        int stopping = !running;
+        mtx_unlock(&mutex);
+        if (stopping) {
+            break;
         }
     }
-    free(data);
     return 0;
 }
 
@@ -260,6 +541,10 @@ void client_connect(char *hostname, int port) {
         perror("connect");
         exit(1);
     }
+    // messages are already coalesced per frame, don't wait for acks
+    int nodelay = 1;
+    setsockopt(
+        sd, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay, sizeof(nodelay));
 }
 
 // Creates a new thread running the client
@@ -268,9 +553,15 @@ void client_start() {
         return;
     }
     running = 1;
-    queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
-    qsize = 0;
+    stream_alloc(&stream, QUEUE_SIZE);
+    queue_alloc(&events, sizeof(Event));
+    pending = throttled = upgraded = 0;
+    memset(&stats, 0, sizeof(stats));
+    offered = 0;
+    send_version = 1;
+    moves = 0;
     mtx_init(&mutex, mtx_plain);
+    cnd_init(&drained);
     if (thrd_create(&recv_thread, recv_worker, NULL) != thrd_success) {
         perror("thrd_create");
         exit(1);
@@ -284,15 +575,28 @@ void client_stop() {
     if (!client_enabled) {
         return;
     }
+    mtx_lock(&mutex);
     running = 0;
+    cnd_signal(&drained);
+    mtx_unlock(&mutex);
+    client_flush();
     close(sd);
     // if (thrd_join(recv_thread, NULL) != thrd_success) {
     //     perror("thrd_join");
     //     exit(1);
     // }
     // mtx_destroy(&mutex);
-    qsize = 0;
-    free(queue);
+    stream_free(&stream);
+    Event event;
+    while (queue_get(&events, &event)) {
+        event_free(&event);
+    }
+    queue_free(&events);
+    send_size = 0;
+    for (int i = 0; i < SEND_SEGMENTS; i++) {
+        free(segments[i]);
+        segments[i] = 0;
+    }
     // printf("Bytes Sent: %d, Bytes Received: %d\n",
     //     bytes_sent, bytes_received);
 }
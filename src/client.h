@@ -1,8 +1,19 @@
 #ifndef _client_h_
 #define _client_h_
 
+#include "event.h"
+
 #define DEFAULT_PORT 4080
 
+typedef struct {
+    int messages;
+    int syscalls;
+    int saved;
+    int flushes;
+    int bytes_sent;
+    int bytes_received;
+} ClientStats;
+
 void client_enable();
 void client_disable();
 int get_client_enabled();
@@ -10,11 +21,14 @@ void client_connect(char *hostname, int port);
 void client_start();
 void client_stop();
 void client_send(char *data);
-char *client_recv();
+void client_flush();
+void client_get_stats(ClientStats *result);
+int client_event(Event *event);
 void client_version(int version);
 void client_login(const char *username, const char *identity_token);
 void client_position(float x, float y, float z, float rx, float ry);
 void client_chunk(int p, int q, int key);
+void client_unload(int p, int q);
 void client_block(int x, int y, int z, int w);
 void client_light(int x, int y, int z, int w);
 void client_sign(int x, int y, int z, int face, const char *text);
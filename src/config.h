@@ -25,6 +25,7 @@
 #define SHOW_INFO_TEXT 1
 #define SHOW_CHAT_TEXT 1
 #define SHOW_PLAYER_NAMES 1
+#define SHOW_STATS_TEXT 0
 
 // key bindings
 #define CRAFT_KEY_FORWARD 'W'
@@ -48,7 +49,59 @@
 #define RENDER_CHUNK_RADIUS 10
 #define RENDER_SIGN_RADIUS 4
 #define DELETE_CHUNK_RADIUS 14
+#define PREFETCH_CHUNK_RADIUS 6
 #define CHUNK_SIZE 32
 #define COMMIT_INTERVAL 5
+#define UPLOAD_BUDGET_BYTES (4 * 1024 * 1024)
+#define UPLOAD_BUDGET_TIME 0.004
+#define EVENT_BUDGET_TIME 0.004
+#define EVENT_QUEUE_SIZE 65536
+#define SEND_BUFFER_SIZE 65536
+#define CHUNK_REQUEST_WINDOW 16
+#define CHUNK_REQUEST_TIMEOUT 10.0
+#define POSITION_MIN_INTERVAL 0.1
+#define POSITION_MAX_INTERVAL 1.0
+#define POSITION_STEP 0.5
+#define POSITION_TURN 0.1
+
+// database options, journal mode can be "delete", "truncate" or "wal"
+// and chunk workers only get their own read connections with "wal",
+// blob storage keeps each chunk's edits of new worlds in a single record,
+// region storage keeps block and light edits in region files instead,
+// which a new world also gets when its WORLD.regions directory exists,
+// block and light writes are coalesced per position until the next commit
+// or until the write buffer holds this many positions
+#define DB_JOURNAL_MODE "wal"
+#define DB_SYNCHRONOUS "normal"
+#define DB_CACHE_SIZE -2000
+#define DB_MMAP_SIZE 0
+#define DB_BLOB_STORAGE 0
+#define DB_REGION_STORAGE 0
+#define DB_WRITE_BUFFER_SIZE 65536
+#define FORCE_CHUNK_TIMEOUT 0.01
+#define SPAWN_CHUNK_TIMEOUT 2.0
+
+// server options, the same as the defaults of server.py, positions are
+// relayed less often to players further away, once per RELAY_INTERVAL for
+// every RELAY_DISTANCE blocks between them, and clients that fall this many
+// bytes behind are disconnected. World state is split between shards by
+// regions of SERVER_REGION_SIZE chunks, each shard keeps its own database
+// file next to SERVER_DB_PATH and takes its part of that file on first run.
+// Clients only hear about changes to chunks they requested, up to
+// SERVER_MAX_SUBSCRIPTIONS of their most recently requested chunks
+#define SERVER_DB_PATH "craft.db"
+#define SERVER_LOG_PATH "log.txt"
+#define SERVER_AUTH_REQUIRED 1
+#define SERVER_RECORD_HISTORY 0
+#define SERVER_MAX_CLIENTS 1024
+#define SERVER_MAX_BACKLOG (64 * 1024 * 1024)
+#define SERVER_WORLD_CACHE 64
+#define SERVER_SHARDS 4
+#define SERVER_REGION_SIZE 8
+#define SERVER_MAX_SUBSCRIPTIONS 4096
+#define SERVER_TICK 0.1
+#define RELAY_DISTANCE 64
+#define RELAY_INTERVAL 0.1
+#define RELAY_MAX_INTERVAL 1.0
 
 #endif
@@ -1,5 +1,15 @@
+// clock_gettime for write latency metrics
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "blob.h"
+#include "config.h"
 #include "db.h"
+#include "queue.h"
+#include "region.h"
 #include "ring.h"
 #include "sqlite3.h"
 #include "tinycthread.h"
@@ -12,18 +22,76 @@ static sqlite3_stmt *insert_light_stmt;
 static sqlite3_stmt *insert_sign_stmt;
 static sqlite3_stmt *delete_sign_stmt;
 static sqlite3_stmt *delete_signs_stmt;
-static sqlite3_stmt *load_blocks_stmt;
-static sqlite3_stmt *load_lights_stmt;
-static sqlite3_stmt *load_signs_stmt;
-static sqlite3_stmt *get_key_stmt;
 static sqlite3_stmt *set_key_stmt;
+static sqlite3_stmt *load_blob_stmt;
+static sqlite3_stmt *insert_blob_stmt;
+
+static int new_format =
+    DB_REGION_STORAGE ? DB_FORMAT_REGIONS :
+    DB_BLOB_STORAGE ? DB_FORMAT_BLOBS : DB_FORMAT_ROWS;
+static int blob_storage = 0;
+static int region_storage = 0;
+static RegionStore regions;
 
-static Ring ring;
+static Queue queue;
+static Ring batch;
+static int batching = 0;
+static DbStats stats;
 static thrd_t thrd;
 static mtx_t mtx;
-static cnd_t cnd;
 static mtx_t load_mtx;
 
+// read statements, one set per reading thread when the database is in
+// WAL mode, otherwise a single set on the shared connection
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *load_blocks_stmt;
+    sqlite3_stmt *load_blob_stmt;
+    sqlite3_stmt *load_lights_stmt;
+    sqlite3_stmt *load_signs_stmt;
+    sqlite3_stmt *load_blocks_range_stmt;
+    sqlite3_stmt *load_blob_range_stmt;
+    sqlite3_stmt *load_lights_range_stmt;
+    sqlite3_stmt *load_signs_range_stmt;
+} DbReader;
+
+#define MAX_READERS 16
+
+static char db_path[256];
+static int readers_enabled = 0;
+static tss_t reader_key;
+static DbReader shared_reader;
+static DbReader *readers[MAX_READERS];
+static int reader_count = 0;
+
+typedef struct {
+    RingEntry entry;
+    double time;
+    int phase;
+    int index;
+} DbWrite;
+
+// chunk keys, read once at startup and written through on every update
+typedef struct {
+    int p;
+    int q;
+    int key;
+    int used;
+} DbKey;
+
+static DbKey *keys;
+static int key_count = 0;
+static int key_capacity = 0;
+static mtx_t key_mtx;
+
+// block and light writes are held here, one per position and sorted by
+// chunk, until the next commit, loads apply them on top of what they read
+static DbWrite *pending;
+static int pending_count = 0;
+static int pending_capacity = 0;
+static int pending_flushes = 0;
+static mtx_t pending_mtx;
+
 void db_enable() {
     db_enabled = 1;
 }
@@ -36,6 +104,353 @@ int get_db_enabled() {
     return db_enabled;
 }
 
+double _db_time() {
+    struct timespec ts;
+    clock_gettime(TIME_UTC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _db_put(RingEntry *entry) {
+    DbWrite write;
+    write.entry = *entry;
+    write.time = _db_time();
+    write.phase = 0;
+    write.index = 0;
+    queue_put(&queue, &write);
+}
+
+int _db_reader_prepare(DbReader *reader, sqlite3 *db) {
+    static const char *load_blocks_query =
+        "select x, y, z, w from block where p = ? and q = ?;";
+    static const char *load_blob_query =
+        "select data from block_blob where p = ? and q = ?;";
+    static const char *load_lights_query =
+        "select x, y, z, w from light where p = ? and q = ?;";
+    static const char *load_signs_query =
+        "select x, y, z, face, text from sign where p = ? and q = ?;";
+    static const char *load_blocks_range_query =
+        "select p, q, x, y, z, w from block "
+        "where p between ? and ? and q between ? and ? order by p, q;";
+    static const char *load_blob_range_query =
+        "select p, q, data from block_blob "
+        "where p between ? and ? and q between ? and ? order by p, q;";
+    static const char *load_lights_range_query =
+        "select p, q, x, y, z, w from light "
+        "where p between ? and ? and q between ? and ? order by p, q;";
+    static const char *load_signs_range_query =
+        "select p, q, x, y, z, face, text from sign "
+        "where p between ? and ? and q between ? and ? order by p, q;";
+    int rc;
+    reader->db = db;
+    rc = sqlite3_prepare_v2(
+        db, load_blocks_query, -1, &reader->load_blocks_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_blob_query, -1, &reader->load_blob_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_lights_query, -1, &reader->load_lights_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(
+        db, load_signs_query, -1, &reader->load_signs_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(db, load_blocks_range_query, -1,
+        &reader->load_blocks_range_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(db, load_blob_range_query, -1,
+        &reader->load_blob_range_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(db, load_lights_range_query, -1,
+        &reader->load_lights_range_stmt, NULL);
+    if (rc) return rc;
+    rc = sqlite3_prepare_v2(db, load_signs_range_query, -1,
+        &reader->load_signs_range_stmt, NULL);
+    if (rc) return rc;
+    return 0;
+}
+
+void _db_reader_finalize(DbReader *reader) {
+    sqlite3_finalize(reader->load_blocks_stmt);
+    sqlite3_finalize(reader->load_blob_stmt);
+    sqlite3_finalize(reader->load_lights_stmt);
+    sqlite3_finalize(reader->load_signs_stmt);
+    sqlite3_finalize(reader->load_blocks_range_stmt);
+    sqlite3_finalize(reader->load_blob_range_stmt);
+    sqlite3_finalize(reader->load_lights_range_stmt);
+    sqlite3_finalize(reader->load_signs_range_stmt);
+}
+
+DbReader *_db_reader_open() {
+    char pragma_query[128];
+    snprintf(pragma_query, sizeof(pragma_query),
+        "pragma cache_size = %d;"
+        "pragma mmap_size = %d;",
+        DB_CACHE_SIZE, DB_MMAP_SIZE);
+    sqlite3 *reader_db;
+    if (sqlite3_open_v2(db_path, &reader_db, SQLITE_OPEN_READONLY, NULL)) {
+        sqlite3_close(reader_db);
+        return 0;
+    }
+    sqlite3_busy_timeout(reader_db, 1000);
+    sqlite3_exec(reader_db, pragma_query, NULL, NULL, NULL);
+    DbReader *reader = (DbReader *)calloc(1, sizeof(DbReader));
+    int registered = 0;
+    if (!_db_reader_prepare(reader, reader_db)) {
+        mtx_lock(&mtx);
+        if (reader_count < MAX_READERS) {
+            readers[reader_count++] = reader;
+            registered = 1;
+        }
+        mtx_unlock(&mtx);
+    }
+    if (!registered) {
+        _db_reader_finalize(reader);
+        sqlite3_close(reader_db);
+        free(reader);
+        return 0;
+    }
+    tss_set(reader_key, reader);
+    return reader;
+}
+
+// returns the calling thread's reader, falling back to the shared
+// connection (serialised by load_mtx) when WAL is off or opening fails
+DbReader *_db_reader_acquire() {
+    if (readers_enabled) {
+        DbReader *reader = (DbReader *)tss_get(reader_key);
+        if (!reader) {
+            reader = _db_reader_open();
+        }
+        if (reader) {
+            return reader;
+        }
+    }
+    mtx_lock(&load_mtx);
+    return &shared_reader;
+}
+
+void _db_reader_release(DbReader *reader) {
+    if (reader == &shared_reader) {
+        mtx_unlock(&load_mtx);
+    }
+}
+
+void _db_readers_close() {
+    for (int i = 0; i < reader_count; i++) {
+        DbReader *reader = readers[i];
+        _db_reader_finalize(reader);
+        sqlite3_close(reader->db);
+        free(reader);
+    }
+    reader_count = 0;
+    if (readers_enabled) {
+        tss_delete(reader_key);
+        readers_enabled = 0;
+    }
+}
+
+int _db_get_int(const char *query) {
+    int result = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL)) {
+        return 0;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        result = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+unsigned int _db_key_hash(int p, int q) {
+    unsigned int hash = (unsigned int)p * 73856093u;
+    hash ^= (unsigned int)q * 19349663u;
+    return hash ^ (hash >> 16);
+}
+
+// returns the slot of a chunk's key, or the empty slot it would go in
+DbKey *_db_key_find(int p, int q) {
+    unsigned int mask = key_capacity - 1;
+    unsigned int index = _db_key_hash(p, q) & mask;
+    while (keys[index].used) {
+        DbKey *entry = keys + index;
+        if (entry->p == p && entry->q == q) {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    return keys + index;
+}
+
+void _db_key_set(int p, int q, int key) {
+    DbKey *entry = _db_key_find(p, q);
+    if (!entry->used) {
+        // keep the table at most half full
+        if ((key_count + 1) * 2 > key_capacity) {
+            DbKey *old = keys;
+            int old_capacity = key_capacity;
+            key_capacity *= 2;
+            keys = (DbKey *)calloc(key_capacity, sizeof(DbKey));
+            for (int i = 0; i < old_capacity; i++) {
+                if (old[i].used) {
+                    *_db_key_find(old[i].p, old[i].q) = old[i];
+                }
+            }
+            free(old);
+            entry = _db_key_find(p, q);
+        }
+        entry->used = 1;
+        entry->p = p;
+        entry->q = q;
+        key_count++;
+    }
+    entry->key = key;
+}
+
+int _db_keys_load() {
+    key_capacity = 1024;
+    key_count = 0;
+    keys = (DbKey *)calloc(key_capacity, sizeof(DbKey));
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(
+        db, "select p, q, key from key;", -1, &stmt, NULL);
+    if (rc) return rc;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        _db_key_set(
+            sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+            sqlite3_column_int(stmt, 2));
+    }
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+// starts a rewrite of a chunk's blob from what is currently stored,
+// a stored blob that does not decode must not be overwritten
+int _db_blob_begin(Blob *blob, int p, int q) {
+    int result = 0;
+    blob_clear(blob, p, q);
+    sqlite3_reset(load_blob_stmt);
+    sqlite3_bind_int(load_blob_stmt, 1, p);
+    sqlite3_bind_int(load_blob_stmt, 2, q);
+    if (sqlite3_step(load_blob_stmt) == SQLITE_ROW) {
+        result = blob_decode(blob, sqlite3_column_blob(load_blob_stmt, 0),
+            sqlite3_column_bytes(load_blob_stmt, 0));
+    }
+    sqlite3_reset(load_blob_stmt);
+    if (result) {
+        fprintf(stderr, "corrupt blob in chunk %d, %d is kept as is\n", p, q);
+    }
+    return result;
+}
+
+void _db_blob_end(Blob *blob) {
+    unsigned char *data;
+    int size;
+    if (blob_encode(blob, &data, &size)) {
+        return;
+    }
+    sqlite3_reset(insert_blob_stmt);
+    sqlite3_bind_int(insert_blob_stmt, 1, blob->p);
+    sqlite3_bind_int(insert_blob_stmt, 2, blob->q);
+    sqlite3_bind_blob(insert_blob_stmt, 3, data, size, SQLITE_STATIC);
+    sqlite3_step(insert_blob_stmt);
+    sqlite3_reset(insert_blob_stmt);
+    free(data);
+}
+
+// Chunks used to store copies of their neighbours' edge blocks, these are
+// now read from the neighbour itself at meshing time.
+int _db_purge_borders() {
+    int count = 0;
+    if (region_storage) {
+        int *chunks;
+        int n = region_chunks(&regions, REGION_BLOCKS, &chunks);
+        Blob blob;
+        blob_alloc(&blob, 0, 0);
+        for (int i = 0; i < n; i++) {
+            blob_clear(&blob, chunks[i * 2], chunks[i * 2 + 1]);
+            region_read(&regions, &blob, REGION_BLOCKS);
+            blob_compact(&blob);
+            int trimmed = blob_trim(&blob);
+            if (trimmed) {
+                region_save(&regions, &blob, REGION_BLOCKS);
+                count += trimmed;
+            }
+        }
+        blob_free(&blob);
+        free(chunks);
+        region_sync(&regions);
+    }
+    else if (blob_storage) {
+        sqlite3_stmt *stmt;
+        int rc = sqlite3_prepare_v2(
+            db, "select p, q from block_blob;", -1, &stmt, NULL);
+        if (rc) return -1;
+        int n = 0;
+        int capacity = 64;
+        int *chunks = malloc(sizeof(int) * 2 * capacity);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (n == capacity) {
+                capacity *= 2;
+                chunks = realloc(chunks, sizeof(int) * 2 * capacity);
+            }
+            chunks[n * 2] = sqlite3_column_int(stmt, 0);
+            chunks[n * 2 + 1] = sqlite3_column_int(stmt, 1);
+            n++;
+        }
+        sqlite3_finalize(stmt);
+        Blob blob;
+        blob_alloc(&blob, 0, 0);
+        for (int i = 0; i < n; i++) {
+            if (_db_blob_begin(&blob, chunks[i * 2], chunks[i * 2 + 1])) {
+                continue;
+            }
+            blob_compact(&blob);
+            int trimmed = blob_trim(&blob);
+            if (trimmed) {
+                _db_blob_end(&blob);
+                count += trimmed;
+            }
+        }
+        blob_free(&blob);
+        free(chunks);
+    }
+    else {
+        char query[256];
+        snprintf(query, sizeof(query),
+            "delete from block where "
+            "x < p * %d or x >= (p + 1) * %d or "
+            "z < q * %d or z >= (q + 1) * %d;",
+            CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+        if (sqlite3_exec(db, query, NULL, NULL, NULL)) {
+            return -1;
+        }
+        count = sqlite3_changes(db);
+    }
+    if (count) {
+        printf("purged %d border blocks\n", count);
+    }
+    return 0;
+}
+
+// one-time fixups of data written by older versions
+int _db_migrate() {
+    if (_db_get_int(
+        "select count(*) from migration where name = 'borders';"))
+    {
+        return 0;
+    }
+    sqlite3_exec(db, "begin;", NULL, NULL, NULL);
+    if (_db_purge_borders()) {
+        sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+        return -1;
+    }
+    sqlite3_exec(db,
+        "insert into migration (name) values ('borders'); commit;",
+        NULL, NULL, NULL);
+    return 0;
+}
+
 int db_init(char *path) {
     if (!db_enabled) {
         return 0;
@@ -64,6 +479,11 @@ int db_init(char *path) {
         "    z int not null,"
         "    w int not null"
         ");"
+        "create table if not exists block_blob ("
+        "    p int not null,"
+        "    q int not null,"
+        "    data blob not null"
+        ");"
         "create table if not exists light ("
         "    p int not null,"
         "    q int not null,"
@@ -87,10 +507,16 @@ int db_init(char *path) {
         "    text text not null"
         ");"
         "create unique index if not exists block_pqxyz_idx on block (p, q, x, y, z);"
+        "create unique index if not exists block_blob_pq_idx on block_blob (p, q);"
         "create unique index if not exists light_pqxyz_idx on light (p, q, x, y, z);"
         "create unique index if not exists key_pq_idx on key (p, q);"
         "create unique index if not exists sign_xyzface_idx on sign (x, y, z, face);"
-        "create index if not exists sign_pq_idx on sign (p, q);";
+        "create index if not exists sign_pq_idx on sign (p, q);"
+        "create table if not exists migration ("
+        "    name text not null"
+        ");"
+        "create unique index if not exists migration_name_idx"
+        "   on migration (name);";
     static const char *insert_block_query =
         "insert or replace into block (p, q, x, y, z, w) "
         "values (?, ?, ?, ?, ?, ?);";
@@ -104,20 +530,26 @@ int db_init(char *path) {
         "delete from sign where x = ? and y = ? and z = ? and face = ?;";
     static const char *delete_signs_query =
         "delete from sign where x = ? and y = ? and z = ?;";
-    static const char *load_blocks_query =
-        "select x, y, z, w from block where p = ? and q = ?;";
-    static const char *load_lights_query =
-        "select x, y, z, w from light where p = ? and q = ?;";
-    static const char *load_signs_query =
-        "select x, y, z, face, text from sign where p = ? and q = ?;";
-    static const char *get_key_query =
-        "select key from key where p = ? and q = ?;";
     static const char *set_key_query =
         "insert or replace into key (p, q, key) "
         "values (?, ?, ?);";
+    static const char *load_blob_query =
+        "select data from block_blob where p = ? and q = ?;";
+    static const char *insert_blob_query =
+        "insert or replace into block_blob (p, q, data) "
+        "values (?, ?, ?);";
+    char pragma_query[256];
+    snprintf(pragma_query, sizeof(pragma_query),
+        "pragma journal_mode = %s;"
+        "pragma synchronous = %s;"
+        "pragma cache_size = %d;"
+        "pragma mmap_size = %d;",
+        DB_JOURNAL_MODE, DB_SYNCHRONOUS, DB_CACHE_SIZE, DB_MMAP_SIZE);
     int rc;
     rc = sqlite3_open(path, &db);
     if (rc) return rc;
+    rc = sqlite3_exec(db, pragma_query, NULL, NULL, NULL);
+    if (rc) return rc;
     rc = sqlite3_exec(db, create_query, NULL, NULL, NULL);
     if (rc) return rc;
     rc = sqlite3_prepare_v2(
@@ -135,16 +567,57 @@ int db_init(char *path) {
     rc = sqlite3_prepare_v2(
         db, delete_signs_query, -1, &delete_signs_stmt, NULL);
     if (rc) return rc;
-    rc = sqlite3_prepare_v2(db, load_blocks_query, -1, &load_blocks_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
     if (rc) return rc;
-    rc = sqlite3_prepare_v2(db, load_lights_query, -1, &load_lights_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, load_blob_query, -1, &load_blob_stmt, NULL);
     if (rc) return rc;
-    rc = sqlite3_prepare_v2(db, load_signs_query, -1, &load_signs_stmt, NULL);
+    rc = sqlite3_prepare_v2(
+        db, insert_blob_query, -1, &insert_blob_stmt, NULL);
     if (rc) return rc;
-    rc = sqlite3_prepare_v2(db, get_key_query, -1, &get_key_stmt, NULL);
+    rc = _db_reader_prepare(&shared_reader, db);
     if (rc) return rc;
-    rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
+    // block and light payloads of region storage live in region files
+    // next to the database, everything else stays in it
+    char region_path[512];
+    snprintf(region_path, sizeof(region_path), "%s.regions", path);
+    int format = _db_get_int("pragma user_version;");
+    int start = region_store_exists(region_path) ?
+        DB_FORMAT_REGIONS : new_format;
+    if (format == DB_FORMAT_ROWS && start != DB_FORMAT_ROWS &&
+        !_db_get_int("select count(*) from (select 1 from block limit 1);") &&
+        !_db_get_int("select count(*) from (select 1 from light limit 1);"))
+    {
+        // new or unedited world, start it in the configured format or in
+        // region storage when its region directory was made beforehand
+        char query[64];
+        snprintf(query, sizeof(query), "pragma user_version = %d;", start);
+        sqlite3_exec(db, query, NULL, NULL, NULL);
+        format = start;
+    }
+    blob_storage = format == DB_FORMAT_BLOBS;
+    region_storage = format == DB_FORMAT_REGIONS;
+    if (region_storage) {
+        if (region_store_open(&regions, region_path)) {
+            return -1;
+        }
+    }
+    rc = _db_migrate();
+    if (rc) return rc;
+    rc = _db_keys_load();
     if (rc) return rc;
+    mtx_init(&key_mtx, mtx_plain);
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "pragma journal_mode;", -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+        readers_enabled = strcmp(mode, "wal") == 0;
+    }
+    sqlite3_finalize(stmt);
+    if (readers_enabled && tss_create(&reader_key, NULL) != thrd_success) {
+        readers_enabled = 0;
+    }
+    strncpy(db_path, path, sizeof(db_path) - 1);
+    db_path[sizeof(db_path) - 1] = '\0';
     sqlite3_exec(db, "begin;", NULL, NULL, NULL);
     db_worker_start();
     return 0;
@@ -155,28 +628,36 @@ void db_close() {
         return;
     }
     db_worker_stop();
+    _db_readers_close();
     sqlite3_exec(db, "commit;", NULL, NULL, NULL);
     sqlite3_finalize(insert_block_stmt);
     sqlite3_finalize(insert_light_stmt);
     sqlite3_finalize(insert_sign_stmt);
     sqlite3_finalize(delete_sign_stmt);
     sqlite3_finalize(delete_signs_stmt);
-    sqlite3_finalize(load_blocks_stmt);
-    sqlite3_finalize(load_lights_stmt);
-    sqlite3_finalize(load_signs_stmt);
-    sqlite3_finalize(get_key_stmt);
+    _db_reader_finalize(&shared_reader);
     sqlite3_finalize(set_key_stmt);
+    sqlite3_finalize(load_blob_stmt);
+    sqlite3_finalize(insert_blob_stmt);
     sqlite3_close(db);
+    if (region_storage) {
+        region_store_close(&regions);
+    }
+    free(keys);
+    keys = 0;
+    mtx_destroy(&key_mtx);
+}
+
+void db_set_format(int format) {
+    new_format = format;
 }
 
 void db_commit() {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&mtx);
-    ring_put_commit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    RingEntry e = {COMMIT};
+    _db_put(&e);
 }
 
 void _db_commit() {
@@ -316,10 +797,12 @@ void db_insert_block(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&mtx);
-    ring_put_block(&ring, p, q, x, y, z, w);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    if (batching) {
+        ring_put_block(&batch, p, q, x, y, z, w);
+        return;
+    }
+    RingEntry e = {BLOCK, p, q, x, y, z, w};
+    _db_put(&e);
 }
 
 void _db_insert_block(int p, int q, int x, int y, int z, int w) {
@@ -333,14 +816,88 @@ void _db_insert_block(int p, int q, int x, int y, int z, int w) {
     sqlite3_step(insert_block_stmt);
 }
 
+int db_migrate_blobs() {
+    if (!db_enabled) {
+        return -1;
+    }
+    if (blob_storage) {
+        return 0;
+    }
+    if (region_storage) {
+        fprintf(stderr, "world is stored in region files\n");
+        return -1;
+    }
+    static const char *query =
+        "select p, q, x, y, z, w from block order by p, q;";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL)) {
+        return -1;
+    }
+    Blob blob;
+    blob_alloc(&blob, 0, 0);
+    int count = 0;
+    int corrupt = 0;
+    int failed = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int p = sqlite3_column_int(stmt, 0);
+        int q = sqlite3_column_int(stmt, 1);
+        if (!count || p != blob.p || q != blob.q) {
+            if (count && !corrupt) {
+                _db_blob_end(&blob);
+            }
+            corrupt = _db_blob_begin(&blob, p, q);
+            failed |= corrupt;
+            count++;
+        }
+        blob_set(&blob,
+            sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3),
+            sqlite3_column_int(stmt, 4), sqlite3_column_int(stmt, 5));
+    }
+    if (count && !corrupt) {
+        _db_blob_end(&blob);
+    }
+    sqlite3_finalize(stmt);
+    blob_free(&blob);
+    if (failed) {
+        // the rows stay, migrating again merges them into the same blobs
+        fprintf(stderr, "not migrating to blob storage\n");
+        return -1;
+    }
+    sqlite3_exec(db, "delete from block; pragma user_version = 1;",
+        NULL, NULL, NULL);
+    blob_storage = 1;
+    printf("migrated %d chunks to blob storage\n", count);
+    return 0;
+}
+
 void db_insert_light(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&mtx);
-    ring_put_light(&ring, p, q, x, y, z, w);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    if (batching) {
+        ring_put_light(&batch, p, q, x, y, z, w);
+        return;
+    }
+    RingEntry e = {LIGHT, p, q, x, y, z, w};
+    _db_put(&e);
+}
+
+void db_begin_batch() {
+    if (!db_enabled) {
+        return;
+    }
+    batching = 1;
+}
+
+void db_end_batch() {
+    if (!db_enabled) {
+        return;
+    }
+    batching = 0;
+    RingEntry e;
+    while (ring_get(&batch, &e)) {
+        _db_put(&e);
+    }
 }
 
 void _db_insert_light(int p, int q, int x, int y, int z, int w) {
@@ -354,27 +911,49 @@ void _db_insert_light(int p, int q, int x, int y, int z, int w) {
     sqlite3_step(insert_light_stmt);
 }
 
+// sign writes carry a copy of the text that the writer frees
+void _db_put_sign(RingEntry *e) {
+    if (batching) {
+        ring_put(&batch, e);
+        return;
+    }
+    _db_put(e);
+}
+
 void db_insert_sign(
     int p, int q, int x, int y, int z, int face, const char *text)
 {
     if (!db_enabled) {
         return;
     }
+    RingEntry e = {SIGN, p, q, x, y, z, face};
+    size_t length = strlen(text) + 1;
+    e.text = malloc(length);
+    memcpy(e.text, text, length);
+    _db_put_sign(&e);
+}
+
+void _db_insert_sign(RingEntry *e) {
     sqlite3_reset(insert_sign_stmt);
-    sqlite3_bind_int(insert_sign_stmt, 1, p);
-    sqlite3_bind_int(insert_sign_stmt, 2, q);
-    sqlite3_bind_int(insert_sign_stmt, 3, x);
-    sqlite3_bind_int(insert_sign_stmt, 4, y);
-    sqlite3_bind_int(insert_sign_stmt, 5, z);
-    sqlite3_bind_int(insert_sign_stmt, 6, face);
-    sqlite3_bind_text(insert_sign_stmt, 7, text, -1, NULL);
+    sqlite3_bind_int(insert_sign_stmt, 1, e->p);
+    sqlite3_bind_int(insert_sign_stmt, 2, e->q);
+    sqlite3_bind_int(insert_sign_stmt, 3, e->x);
+    sqlite3_bind_int(insert_sign_stmt, 4, e->y);
+    sqlite3_bind_int(insert_sign_stmt, 5, e->z);
+    sqlite3_bind_int(insert_sign_stmt, 6, e->w);
+    sqlite3_bind_text(insert_sign_stmt, 7, e->text, -1, NULL);
     sqlite3_step(insert_sign_stmt);
 }
 
-void db_delete_sign(int x, int y, int z, int face) {
+void db_delete_sign(int p, int q, int x, int y, int z, int face) {
     if (!db_enabled) {
         return;
     }
+    RingEntry e = {DELETE_SIGN, p, q, x, y, z, face};
+    _db_put_sign(&e);
+}
+
+void _db_delete_sign(int x, int y, int z, int face) {
     sqlite3_reset(delete_sign_stmt);
     sqlite3_bind_int(delete_sign_stmt, 1, x);
     sqlite3_bind_int(delete_sign_stmt, 2, y);
@@ -383,10 +962,15 @@ void db_delete_sign(int x, int y, int z, int face) {
     sqlite3_step(delete_sign_stmt);
 }
 
-void db_delete_signs(int x, int y, int z) {
+void db_delete_signs(int p, int q, int x, int y, int z) {
     if (!db_enabled) {
         return;
     }
+    RingEntry e = {DELETE_SIGNS, p, q, x, y, z};
+    _db_put_sign(&e);
+}
+
+void _db_delete_signs(int x, int y, int z) {
     sqlite3_reset(delete_signs_stmt);
     sqlite3_bind_int(delete_signs_stmt, 1, x);
     sqlite3_bind_int(delete_signs_stmt, 2, y);
@@ -398,84 +982,309 @@ void db_delete_all_signs() {
     if (!db_enabled) {
         return;
     }
-    sqlite3_exec(db, "delete from sign;", NULL, NULL, NULL);
+    RingEntry e = {DELETE_ALL_SIGNS};
+    _db_put_sign(&e);
+}
+
+void _db_load_rows(sqlite3_stmt *stmt, Map *map, int p, int q) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int w = sqlite3_column_int(stmt, 3);
+        map_set(map, x, y, z, w);
+    }
+}
+
+void _db_load_blob(sqlite3_stmt *stmt, Map *map, int p, int q) {
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        blob_load(map, p, q, sqlite3_column_blob(stmt, 0),
+            sqlite3_column_bytes(stmt, 0));
+    }
+    sqlite3_reset(stmt);
+}
+
+// applies the buffered writes of a chunk on top of what was read, fails
+// if the buffer was flushed and emptied since the read started
+int _db_load_pending(
+    Map *map, RingEntryType type, int p, int q, int flushes)
+{
+    mtx_lock(&pending_mtx);
+    if (pending_flushes != flushes) {
+        mtx_unlock(&pending_mtx);
+        return 0;
+    }
+    int lo = 0;
+    int hi = pending_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        RingEntry *e = &pending[mid].entry;
+        if (e->p < p || (e->p == p && (e->q < q ||
+            (e->q == q && e->type < type))))
+        {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    for (int i = lo; i < pending_count; i++) {
+        RingEntry *e = &pending[i].entry;
+        if (e->p != p || e->q != q || e->type != type) {
+            break;
+        }
+        map_set(map, e->x, e->y, e->z, e->w);
+    }
+    mtx_unlock(&pending_mtx);
+    return 1;
+}
+
+int _db_pending_flushes() {
+    mtx_lock(&pending_mtx);
+    int result = pending_flushes;
+    mtx_unlock(&pending_mtx);
+    return result;
 }
 
 void db_load_blocks(Map *map, int p, int q) {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_blocks_stmt);
-    sqlite3_bind_int(load_blocks_stmt, 1, p);
-    sqlite3_bind_int(load_blocks_stmt, 2, q);
-    while (sqlite3_step(load_blocks_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_blocks_stmt, 0);
-        int y = sqlite3_column_int(load_blocks_stmt, 1);
-        int z = sqlite3_column_int(load_blocks_stmt, 2);
-        int w = sqlite3_column_int(load_blocks_stmt, 3);
-        map_set(map, x, y, z, w);
-    }
-    mtx_unlock(&load_mtx);
+    int flushes;
+    do {
+        flushes = _db_pending_flushes();
+        if (region_storage) {
+            region_load(&regions, map, p, q, REGION_BLOCKS);
+            continue;
+        }
+        DbReader *reader = _db_reader_acquire();
+        if (blob_storage) {
+            _db_load_blob(reader->load_blob_stmt, map, p, q);
+        }
+        else {
+            _db_load_rows(reader->load_blocks_stmt, map, p, q);
+        }
+        _db_reader_release(reader);
+    } while (!_db_load_pending(map, BLOCK, p, q, flushes));
 }
 
 void db_load_lights(Map *map, int p, int q) {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&load_mtx);
-    sqlite3_reset(load_lights_stmt);
-    sqlite3_bind_int(load_lights_stmt, 1, p);
-    sqlite3_bind_int(load_lights_stmt, 2, q);
-    while (sqlite3_step(load_lights_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_lights_stmt, 0);
-        int y = sqlite3_column_int(load_lights_stmt, 1);
-        int z = sqlite3_column_int(load_lights_stmt, 2);
-        int w = sqlite3_column_int(load_lights_stmt, 3);
+    int flushes;
+    do {
+        flushes = _db_pending_flushes();
+        if (region_storage) {
+            region_load(&regions, map, p, q, REGION_LIGHTS);
+            continue;
+        }
+        DbReader *reader = _db_reader_acquire();
+        _db_load_rows(reader->load_lights_stmt, map, p, q);
+        _db_reader_release(reader);
+    } while (!_db_load_pending(map, LIGHT, p, q, flushes));
+}
+
+void db_load_signs(SignList *list, int p, int q) {
+    if (!db_enabled) {
+        return;
+    }
+    DbReader *reader = _db_reader_acquire();
+    sqlite3_stmt *stmt = reader->load_signs_stmt;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, q);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(stmt, 0);
+        int y = sqlite3_column_int(stmt, 1);
+        int z = sqlite3_column_int(stmt, 2);
+        int face = sqlite3_column_int(stmt, 3);
+        const char *text = (const char *)sqlite3_column_text(
+            stmt, 4);
+        sign_list_add(list, x, y, z, face, text);
+    }
+    _db_reader_release(reader);
+}
+
+void _db_bind_range(
+    sqlite3_stmt *stmt, int p, int q, int width, int height)
+{
+    sqlite3_reset(stmt);
+    sqlite3_bind_int(stmt, 1, p);
+    sqlite3_bind_int(stmt, 2, p + width - 1);
+    sqlite3_bind_int(stmt, 3, q);
+    sqlite3_bind_int(stmt, 4, q + height - 1);
+}
+
+// rows come ordered by chunk, so the target only changes between chunks
+void _db_load_range_rows(
+    sqlite3_stmt *stmt, Map **maps, int p, int q, int width, int height)
+{
+    _db_bind_range(stmt, p, q, width, height);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int a = sqlite3_column_int(stmt, 0) - p;
+        int b = sqlite3_column_int(stmt, 1) - q;
+        Map *map = maps[a * height + b];
+        if (!map) {
+            continue;
+        }
+        int x = sqlite3_column_int(stmt, 2);
+        int y = sqlite3_column_int(stmt, 3);
+        int z = sqlite3_column_int(stmt, 4);
+        int w = sqlite3_column_int(stmt, 5);
         map_set(map, x, y, z, w);
     }
-    mtx_unlock(&load_mtx);
 }
 
-void db_load_signs(SignList *list, int p, int q) {
+void _db_load_range_blobs(
+    sqlite3_stmt *stmt, Map **maps, int p, int q, int width, int height)
+{
+    _db_bind_range(stmt, p, q, width, height);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int a = sqlite3_column_int(stmt, 0);
+        int b = sqlite3_column_int(stmt, 1);
+        Map *map = maps[(a - p) * height + (b - q)];
+        if (map) {
+            blob_load(map, a, b, sqlite3_column_blob(stmt, 2),
+                sqlite3_column_bytes(stmt, 2));
+        }
+    }
+    sqlite3_reset(stmt);
+}
+
+// region files are mapped, so each chunk is read where it lies
+void _db_load_range_regions(
+    Map **maps, int kind, int p, int q, int width, int height)
+{
+    for (int a = 0; a < width; a++) {
+        for (int b = 0; b < height; b++) {
+            Map *map = maps[a * height + b];
+            if (map) {
+                region_load(&regions, map, p + a, q + b, kind);
+            }
+        }
+    }
+}
+
+int _db_load_range_pending(
+    Map **maps, RingEntryType type, int p, int q, int width, int height,
+    int flushes)
+{
+    for (int a = 0; a < width; a++) {
+        for (int b = 0; b < height; b++) {
+            Map *map = maps[a * height + b];
+            if (map &&
+                !_db_load_pending(map, type, p + a, q + b, flushes))
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Loads a width by height rectangle of chunks starting at (p, q) with one
+// query, maps[a * height + b] receives chunk (p + a, q + b) and chunks
+// without a map are skipped.
+void db_load_blocks_range(Map **maps, int p, int q, int width, int height) {
+    if (!db_enabled) {
+        return;
+    }
+    int flushes;
+    do {
+        flushes = _db_pending_flushes();
+        if (region_storage) {
+            _db_load_range_regions(
+                maps, REGION_BLOCKS, p, q, width, height);
+            continue;
+        }
+        DbReader *reader = _db_reader_acquire();
+        if (blob_storage) {
+            _db_load_range_blobs(reader->load_blob_range_stmt,
+                maps, p, q, width, height);
+        }
+        else {
+            _db_load_range_rows(reader->load_blocks_range_stmt,
+                maps, p, q, width, height);
+        }
+        _db_reader_release(reader);
+    } while (!_db_load_range_pending(
+        maps, BLOCK, p, q, width, height, flushes));
+}
+
+void db_load_lights_range(Map **maps, int p, int q, int width, int height) {
+    if (!db_enabled) {
+        return;
+    }
+    int flushes;
+    do {
+        flushes = _db_pending_flushes();
+        if (region_storage) {
+            _db_load_range_regions(
+                maps, REGION_LIGHTS, p, q, width, height);
+            continue;
+        }
+        DbReader *reader = _db_reader_acquire();
+        _db_load_range_rows(reader->load_lights_range_stmt,
+            maps, p, q, width, height);
+        _db_reader_release(reader);
+    } while (!_db_load_range_pending(
+        maps, LIGHT, p, q, width, height, flushes));
+}
+
+void db_load_signs_range(
+    SignList **lists, int p, int q, int width, int height)
+{
     if (!db_enabled) {
         return;
     }
-    sqlite3_reset(load_signs_stmt);
-    sqlite3_bind_int(load_signs_stmt, 1, p);
-    sqlite3_bind_int(load_signs_stmt, 2, q);
-    while (sqlite3_step(load_signs_stmt) == SQLITE_ROW) {
-        int x = sqlite3_column_int(load_signs_stmt, 0);
-        int y = sqlite3_column_int(load_signs_stmt, 1);
-        int z = sqlite3_column_int(load_signs_stmt, 2);
-        int face = sqlite3_column_int(load_signs_stmt, 3);
+    DbReader *reader = _db_reader_acquire();
+    sqlite3_stmt *stmt = reader->load_signs_range_stmt;
+    _db_bind_range(stmt, p, q, width, height);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int a = sqlite3_column_int(stmt, 0) - p;
+        int b = sqlite3_column_int(stmt, 1) - q;
+        SignList *list = lists[a * height + b];
+        if (!list) {
+            continue;
+        }
+        int x = sqlite3_column_int(stmt, 2);
+        int y = sqlite3_column_int(stmt, 3);
+        int z = sqlite3_column_int(stmt, 4);
+        int face = sqlite3_column_int(stmt, 5);
         const char *text = (const char *)sqlite3_column_text(
-            load_signs_stmt, 4);
+            stmt, 6);
         sign_list_add(list, x, y, z, face, text);
     }
+    _db_reader_release(reader);
 }
 
 int db_get_key(int p, int q) {
     if (!db_enabled) {
         return 0;
     }
-    sqlite3_reset(get_key_stmt);
-    sqlite3_bind_int(get_key_stmt, 1, p);
-    sqlite3_bind_int(get_key_stmt, 2, q);
-    if (sqlite3_step(get_key_stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(get_key_stmt, 0);
-    }
-    return 0;
+    mtx_lock(&key_mtx);
+    DbKey *entry = _db_key_find(p, q);
+    int result = entry->used ? entry->key : 0;
+    mtx_unlock(&key_mtx);
+    return result;
 }
 
 void db_set_key(int p, int q, int key) {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&mtx);
-    ring_put_key(&ring, p, q, key);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    mtx_lock(&key_mtx);
+    _db_key_set(p, q, key);
+    mtx_unlock(&key_mtx);
+    RingEntry e = {KEY, p, q, 0, 0, 0, 0, key};
+    _db_put(&e);
 }
 
 void _db_set_key(int p, int q, int key) {
@@ -490,10 +1299,14 @@ void db_worker_start(char *path) {
     if (!db_enabled) {
         return;
     }
-    ring_alloc(&ring, 1024);
+    queue_alloc(&queue, sizeof(DbWrite));
+    ring_alloc(&batch, 1024);
     mtx_init(&mtx, mtx_plain);
     mtx_init(&load_mtx, mtx_plain);
-    cnd_init(&cnd);
+    mtx_init(&pending_mtx, mtx_plain);
+    pending_capacity = 1024;
+    pending_count = 0;
+    pending = malloc(sizeof(DbWrite) * pending_capacity);
     thrd_create(&thrd, db_worker_run, path);
 }
 
@@ -501,43 +1314,329 @@ void db_worker_stop() {
     if (!db_enabled) {
         return;
     }
-    mtx_lock(&mtx);
-    ring_put_exit(&ring);
-    cnd_signal(&cnd);
-    mtx_unlock(&mtx);
+    RingEntry e = {EXIT};
+    _db_put(&e);
     thrd_join(thrd, NULL);
-    cnd_destroy(&cnd);
+    free(pending);
+    pending = 0;
+    mtx_destroy(&pending_mtx);
     mtx_destroy(&load_mtx);
     mtx_destroy(&mtx);
-    ring_free(&ring);
+    queue_free(&queue);
+    ring_free(&batch);
+}
+
+void db_get_stats(DbStats *result) {
+    if (!db_enabled) {
+        memset(result, 0, sizeof(DbStats));
+        return;
+    }
+    mtx_lock(&mtx);
+    memcpy(result, &stats, sizeof(DbStats));
+    mtx_unlock(&mtx);
+}
+
+int _db_write_compare(const void *arg1, const void *arg2) {
+    const DbWrite *a = (const DbWrite *)arg1;
+    const DbWrite *b = (const DbWrite *)arg2;
+    if (a->phase != b->phase) {
+        return a->phase - b->phase;
+    }
+    if (a->entry.type == DELETE_ALL_SIGNS ||
+        b->entry.type == DELETE_ALL_SIGNS)
+    {
+        return a->index - b->index;
+    }
+    if (a->entry.p != b->entry.p) {
+        return a->entry.p < b->entry.p ? -1 : 1;
+    }
+    if (a->entry.q != b->entry.q) {
+        return a->entry.q < b->entry.q ? -1 : 1;
+    }
+    return a->index - b->index;
+}
+
+// orders buffered writes by chunk, then by table and position
+int _db_position_compare(const RingEntry *a, const RingEntry *b) {
+    if (a->p != b->p) {
+        return a->p < b->p ? -1 : 1;
+    }
+    if (a->q != b->q) {
+        return a->q < b->q ? -1 : 1;
+    }
+    if (a->type != b->type) {
+        return a->type < b->type ? -1 : 1;
+    }
+    if (a->x != b->x) {
+        return a->x < b->x ? -1 : 1;
+    }
+    if (a->y != b->y) {
+        return a->y < b->y ? -1 : 1;
+    }
+    if (a->z != b->z) {
+        return a->z < b->z ? -1 : 1;
+    }
+    return 0;
+}
+
+int _db_edit_compare(const void *arg1, const void *arg2) {
+    const DbWrite *a = (const DbWrite *)arg1;
+    const DbWrite *b = (const DbWrite *)arg2;
+    int result = _db_position_compare(&a->entry, &b->entry);
+    return result ? result : a->index - b->index;
+}
+
+// merges a batch of block and light writes into the pending buffer, only
+// the latest write to each position is kept, returns how many were dropped
+int _db_merge_edits(
+    DbWrite *edits, int count, DbWrite **scratch, int *scratch_capacity)
+{
+    qsort(edits, count, sizeof(DbWrite), _db_edit_compare);
+    int coalesced = 0;
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        if (i + 1 < count &&
+            !_db_position_compare(&edits[i].entry, &edits[i + 1].entry))
+        {
+            coalesced++;
+            continue;
+        }
+        edits[size++] = edits[i];
+    }
+    if (pending_count + size > *scratch_capacity) {
+        *scratch_capacity = (pending_count + size) * 2;
+        free(*scratch);
+        *scratch = malloc(sizeof(DbWrite) * (*scratch_capacity));
+    }
+    DbWrite *result = *scratch;
+    int n = 0;
+    int i = 0;
+    int j = 0;
+    while (i < pending_count || j < size) {
+        if (j == size) {
+            result[n++] = pending[i++];
+            continue;
+        }
+        if (i == pending_count) {
+            result[n++] = edits[j++];
+            continue;
+        }
+        int order = _db_position_compare(&pending[i].entry, &edits[j].entry);
+        if (order < 0) {
+            result[n++] = pending[i++];
+        }
+        else {
+            if (order == 0) {
+                coalesced++;
+                i++;
+            }
+            result[n++] = edits[j++];
+        }
+    }
+    // the old buffer becomes the scratch space of the next merge
+    DbWrite *previous = pending;
+    int previous_capacity = pending_capacity;
+    mtx_lock(&pending_mtx);
+    pending = result;
+    pending_capacity = *scratch_capacity;
+    pending_count = n;
+    mtx_unlock(&pending_mtx);
+    *scratch = previous;
+    *scratch_capacity = previous_capacity;
+    return coalesced;
+}
+
+// rewrites each chunk's block and light payloads in the region files
+void _db_flush_regions(Blob *blob) {
+    int i = 0;
+    while (i < pending_count) {
+        RingEntry *w = &pending[i].entry;
+        int kind = w->type == LIGHT ? REGION_LIGHTS : REGION_BLOCKS;
+        blob_clear(blob, w->p, w->q);
+        region_read(&regions, blob, kind);
+        for (; i < pending_count; i++) {
+            RingEntry *e = &pending[i].entry;
+            if (e->p != w->p || e->q != w->q || e->type != w->type) {
+                break;
+            }
+            blob_set(blob, e->x, e->y, e->z, e->w);
+        }
+        region_save(&regions, blob, kind);
+    }
+    region_sync(&regions);
+}
+
+// blobs are rewritten once per chunk since the buffer is sorted by chunk
+void _db_flush_rows(Blob *blob) {
+    int blob_open = 0;
+    for (int i = 0; i < pending_count; i++) {
+        RingEntry *w = &pending[i].entry;
+        if (w->type == LIGHT) {
+            _db_insert_light(w->p, w->q, w->x, w->y, w->z, w->w);
+        }
+        else if (!blob_storage) {
+            _db_insert_block(w->p, w->q, w->x, w->y, w->z, w->w);
+        }
+        else {
+            // edits to a chunk whose stored blob is corrupt are dropped
+            if (!blob_open || w->p != blob->p || w->q != blob->q) {
+                if (blob_open > 0) {
+                    _db_blob_end(blob);
+                }
+                blob_open = _db_blob_begin(blob, w->p, w->q) ? -1 : 1;
+            }
+            if (blob_open > 0) {
+                blob_set(blob, w->x, w->y, w->z, w->w);
+            }
+        }
+    }
+    if (blob_open > 0) {
+        _db_blob_end(blob);
+    }
+}
+
+// writes out and drops the pending buffer
+int _db_flush_edits(Blob *blob) {
+    if (region_storage) {
+        _db_flush_regions(blob);
+    }
+    else {
+        _db_flush_rows(blob);
+    }
+    int count = pending_count;
+    _db_commit();
+    // only dropped once committed so that loads never miss them
+    mtx_lock(&pending_mtx);
+    pending_count = 0;
+    pending_flushes++;
+    mtx_unlock(&pending_mtx);
+    return count;
+}
+
+void _db_append(DbWrite **array, int *count, int *capacity, DbWrite *write) {
+    if (*count == *capacity) {
+        *capacity *= 2;
+        *array = realloc(*array, sizeof(DbWrite) * (*capacity));
+    }
+    (*array)[*count] = *write;
+    (*array)[*count].index = *count;
+    (*count)++;
 }
 
 int db_worker_run(void *arg) {
     int running = 1;
+    int capacity = 1024;
+    DbWrite *writes = malloc(sizeof(DbWrite) * capacity);
+    int edit_capacity = 1024;
+    DbWrite *edits = malloc(sizeof(DbWrite) * edit_capacity);
+    int scratch_capacity = 0;
+    DbWrite *scratch = 0;
+    Blob blob;
+    blob_alloc(&blob, 0, 0);
     while (running) {
-        RingEntry e;
+        // sleep until something is queued, then drain everything
+        DbWrite write;
+        queue_wait(&queue, &write);
+        double start = 0;
+        int depth = 0;
+        int commit = 0;
+        int count = 0;
+        int edit_count = 0;
+        int phase = 0;
+        do {
+            depth++;
+            switch (write.entry.type) {
+                case COMMIT:
+                    commit = 1;
+                    break;
+                case EXIT:
+                    running = 0;
+                    commit = 1;
+                    break;
+                default:
+                    if (!(count + edit_count) || write.time < start) {
+                        start = write.time;
+                    }
+                    if (write.entry.type == BLOCK ||
+                        write.entry.type == LIGHT)
+                    {
+                        _db_append(&edits, &edit_count, &edit_capacity,
+                            &write);
+                        break;
+                    }
+                    // nothing is sorted across a delete of all signs
+                    if (write.entry.type == DELETE_ALL_SIGNS) {
+                        phase++;
+                    }
+                    write.phase = phase;
+                    _db_append(&writes, &count, &capacity, &write);
+                    break;
+            }
+        } while (queue_get(&queue, &write));
+        double now = _db_time();
+        int coalesced = 0;
+        if (edit_count) {
+            coalesced = _db_merge_edits(
+                edits, edit_count, &scratch, &scratch_capacity);
+        }
+        // sorted by chunk so each batch touches the indexes in order,
+        // ties keep queue order so the last write to a key wins
+        qsort(writes, count, sizeof(DbWrite), _db_write_compare);
+        for (int i = 0; i < count; i++) {
+            RingEntry *w = &writes[i].entry;
+            switch (w->type) {
+                case KEY:
+                    _db_set_key(w->p, w->q, w->key);
+                    break;
+                case SIGN:
+                    _db_insert_sign(w);
+                    free(w->text);
+                    break;
+                case DELETE_SIGN:
+                    _db_delete_sign(w->x, w->y, w->z, w->w);
+                    break;
+                case DELETE_SIGNS:
+                    _db_delete_signs(w->x, w->y, w->z);
+                    break;
+                case DELETE_ALL_SIGNS:
+                    sqlite3_exec(db, "delete from sign;", NULL, NULL, NULL);
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (commit || pending_count >= DB_WRITE_BUFFER_SIZE) {
+            _db_flush_edits(&blob);
+        }
+        // separate read connections only see committed writes
+        else if (readers_enabled && count) {
+            _db_commit();
+        }
+        double end = _db_time();
         mtx_lock(&mtx);
-        while (!ring_get(&ring, &e)) {
-            cnd_wait(&cnd, &mtx);
+        stats.batches++;
+        stats.writes += count + edit_count;
+        stats.coalesced += coalesced;
+        stats.pending = pending_count;
+        stats.queue_depth = depth;
+        if (depth > stats.max_queue_depth) {
+            stats.max_queue_depth = depth;
         }
-        mtx_unlock(&mtx);
-        switch (e.type) {
-            case BLOCK:
-                _db_insert_block(e.p, e.q, e.x, e.y, e.z, e.w);
-                break;
-            case LIGHT:
-                _db_insert_light(e.p, e.q, e.x, e.y, e.z, e.w);
-                break;
-            case KEY:
-                _db_set_key(e.p, e.q, e.key);
-                break;
-            case COMMIT:
-                _db_commit();
-                break;
-            case EXIT:
-                running = 0;
-                break;
+        stats.write_time = end - now;
+        if (end - now > stats.max_write_time) {
+            stats.max_write_time = end - now;
         }
+        if (count + edit_count) {
+            stats.latency = end - start;
+            if (end - start > stats.max_latency) {
+                stats.max_latency = end - start;
+            }
+        }
+        mtx_unlock(&mtx);
     }
+    free(writes);
+    free(edits);
+    free(scratch);
+    blob_free(&blob);
     return 0;
 }
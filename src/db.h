@@ -4,11 +4,32 @@
 #include "map.h"
 #include "sign.h"
 
+// storage formats, kept in the user_version of each world, a new world
+// starts in region storage when a directory named after it with a
+// .regions suffix exists and in the format set with db_set_format if not
+#define DB_FORMAT_ROWS 0
+#define DB_FORMAT_BLOBS 1
+#define DB_FORMAT_REGIONS 2
+
+typedef struct {
+    int batches;
+    int writes;
+    int coalesced;
+    int pending;
+    int queue_depth;
+    int max_queue_depth;
+    double write_time;
+    double max_write_time;
+    double latency;
+    double max_latency;
+} DbStats;
+
 void db_enable();
 void db_disable();
 int get_db_enabled();
 int db_init(char *path);
 void db_close();
+void db_set_format(int format);
 void db_commit();
 void db_auth_set(char *username, char *identity_token);
 int db_auth_select(char *username);
@@ -23,16 +44,24 @@ void db_save_state(float x, float y, float z, float rx, float ry);
 int db_load_state(float *x, float *y, float *z, float *rx, float *ry);
 void db_insert_block(int p, int q, int x, int y, int z, int w);
 void db_insert_light(int p, int q, int x, int y, int z, int w);
+void db_begin_batch();
+void db_end_batch();
 void db_insert_sign(
     int p, int q, int x, int y, int z, int face, const char *text);
-void db_delete_sign(int x, int y, int z, int face);
-void db_delete_signs(int x, int y, int z);
+void db_delete_sign(int p, int q, int x, int y, int z, int face);
+void db_delete_signs(int p, int q, int x, int y, int z);
 void db_delete_all_signs();
 void db_load_blocks(Map *map, int p, int q);
+int db_migrate_blobs();
 void db_load_lights(Map *map, int p, int q);
 void db_load_signs(SignList *list, int p, int q);
+void db_load_blocks_range(Map **maps, int p, int q, int width, int height);
+void db_load_lights_range(Map **maps, int p, int q, int width, int height);
+void db_load_signs_range(
+    SignList **lists, int p, int q, int width, int height);
 int db_get_key(int p, int q);
 void db_set_key(int p, int q, int key);
+void db_get_stats(DbStats *result);
 void db_worker_start();
 void db_worker_stop();
 int db_worker_run(void *arg);
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+
+int _event_message(char *line, Event *event) {
+    Message message;
+    if (message_parse(line, &message)) {
+        return -1;
+    }
+    event->type = message.type;
+    memcpy(event->fields, message.fields, sizeof(event->fields));
+    event->text = message.text;
+    event->data = 0;
+    return 0;
+}
+
+// Parses a version 1 line, text is copied out of it. The line that ends a
+// chunk response reads as an empty last record.
+int event_line(char *line, Event *event) {
+    if (_event_message(line, event)) {
+        return -1;
+    }
+    if (event->type == 'C') {
+        memset(&event->chunk, 0, sizeof(event->chunk));
+        event->chunk.p = event->fields[0].i;
+        event->chunk.q = event->fields[1].i;
+    }
+    if (event->text) {
+        int length = strlen(event->text);
+        event->data = malloc(length + 1);
+        memcpy(event->data, event->text, length + 1);
+        event->text = event->data;
+    }
+    return 0;
+}
+
+int _event_ints(const ProtoFrame *frame, Event *event, int count) {
+    int values[6];
+    if (proto_read_ints(frame, values, count)) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        event->fields[i].i = values[i];
+    }
+    return 0;
+}
+
+// Parses a version 2 frame, chunk entries and text frames are copied
+int event_frame(const ProtoFrame *frame, Event *event) {
+    int id;
+    float values[5];
+    event->type = frame->type;
+    event->text = 0;
+    event->data = 0;
+    switch (frame->type) {
+        case 'B':
+        case 'L':
+            return _event_ints(frame, event, 6);
+        case 'K':
+            return _event_ints(frame, event, 3);
+        case 'R':
+            return _event_ints(frame, event, 2);
+        case 'P':
+            if (proto_read_position(frame, &id, values)) {
+                return -1;
+            }
+            event->fields[0].i = id;
+            for (int i = 0; i < 5; i++) {
+                event->fields[i + 1].f = values[i];
+            }
+            return 0;
+        case 'M': {
+            int deltas[5];
+            if (proto_read_move(frame, &id, deltas)) {
+                return -1;
+            }
+            event->fields[0].i = id;
+            for (int i = 0; i < 5; i++) {
+                event->fields[i + 1].i = deltas[i];
+            }
+            return 0;
+        }
+        case 'C': {
+            ProtoFrame copy = *frame;
+            event->data = malloc(frame->size);
+            memcpy(event->data, frame->data, frame->size);
+            copy.data = (const unsigned char *)event->data;
+            if (proto_read_chunk(&copy, &event->chunk)) {
+                event_free(event);
+                return -1;
+            }
+            return 0;
+        }
+    }
+    char *line = malloc(frame->size + 1);
+    memcpy(line, frame->data, frame->size);
+    line[frame->size] = '\0';
+    if (_event_message(line, event)) {
+        free(line);
+        return -1;
+    }
+    event->data = line;
+    return 0;
+}
+
+void event_free(Event *event) {
+    free(event->data);
+    event->data = 0;
+    event->text = 0;
+}
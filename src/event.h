@@ -0,0 +1,25 @@
+#ifndef _event_h_
+#define _event_h_
+
+#include "message.h"
+#include "proto.h"
+
+// A server message parsed on the receive thread, typed by its protocol
+// tag. Fields are laid out as message_parse fills them in for both
+// protocol versions, moves carry the id and the five quantized deltas,
+// and text and chunk entries live in data, which the event owns until
+// event_free.
+
+typedef struct {
+    char type;
+    MessageField fields[MESSAGE_FIELDS];
+    char *text;
+    ProtoChunk chunk;
+    char *data;
+} Event;
+
+int event_line(char *line, Event *event);
+int event_frame(const ProtoFrame *frame, Event *event);
+void event_free(Event *event);
+
+#endif
@@ -1,3 +1,6 @@
+// clock_gettime for timed waits on the workers
+#define _POSIX_C_SOURCE 199309L
+
 #include "game.h"
 
 Model model;
@@ -551,7 +554,8 @@ int collide(int height, float *x, float *y, float *z) {
     if (!chunk) {
         return result;
     }
-    Map *map = &chunk->map;
+    // chunk maps hold no border, blocks across an edge come from the
+    // chunk that owns them
     int nx = roundf(*x);
     int ny = roundf(*y);
     int nz = roundf(*z);
@@ -560,24 +564,24 @@ int collide(int height, float *x, float *y, float *z) {
     float pz = *z - nz;
     float pad = 0.25;
     for (int dy = 0; dy < height; dy++) {
-        if (px < -pad && is_obstacle(map_get(map, nx - 1, ny - dy, nz))) {
+        if (px < -pad && is_obstacle(get_block(nx - 1, ny - dy, nz))) {
             *x = nx - pad;
         }
-        if (px > pad && is_obstacle(map_get(map, nx + 1, ny - dy, nz))) {
+        if (px > pad && is_obstacle(get_block(nx + 1, ny - dy, nz))) {
             *x = nx + pad;
         }
-        if (py < -pad && is_obstacle(map_get(map, nx, ny - dy - 1, nz))) {
+        if (py < -pad && is_obstacle(get_block(nx, ny - dy - 1, nz))) {
             *y = ny - pad;
             result = 1;
         }
-        if (py > pad && is_obstacle(map_get(map, nx, ny - dy + 1, nz))) {
+        if (py > pad && is_obstacle(get_block(nx, ny - dy + 1, nz))) {
             *y = ny + pad;
             result = 1;
         }
-        if (pz < -pad && is_obstacle(map_get(map, nx, ny - dy, nz - 1))) {
+        if (pz < -pad && is_obstacle(get_block(nx, ny - dy, nz - 1))) {
             *z = nz - pad;
         }
-        if (pz > pad && is_obstacle(map_get(map, nx, ny - dy, nz + 1))) {
+        if (pz > pad && is_obstacle(get_block(nx, ny - dy, nz + 1))) {
             *z = nz + pad;
         }
     }
@@ -682,8 +686,7 @@ void gen_sign_buffer(Chunk *chunk) {
             data + faces * 30, e->x, e->y, e->z, e->face, e->text);
     }
 
-    del_buffer(chunk->sign_buffer);
-    chunk->sign_buffer = gen_faces(5, faces, data);
+    chunk->sign_buffer = update_faces(chunk->sign_buffer, 5, faces, data);
     chunk->sign_faces = faces;
 }
 
@@ -711,6 +714,16 @@ int has_lights(Chunk *chunk) {
 
 void dirty_chunk(Chunk *chunk) {
     chunk->dirty = 1;
+    if (g->edit_depth) {
+        // neighbours and lights are handled once in end_edit
+        if (!chunk->edited) {
+            chunk->edited = 1;
+            g->edit_chunks[g->edit_count][0] = chunk->p;
+            g->edit_chunks[g->edit_count][1] = chunk->q;
+            g->edit_count++;
+        }
+        return;
+    }
     if (has_lights(chunk)) {
         for (int dp = -1; dp <= 1; dp++) {
             for (int dq = -1; dq <= 1; dq++) {
@@ -795,6 +808,21 @@ void light_fill(
     light_fill(opaque, light, x, y, z + 1, w, 0);
 }
 
+// the main thread cancels jobs that were superseded while they run
+static int _cancelled(WorkerItem *item) {
+    return __atomic_load_n(&item->cancel, __ATOMIC_ACQUIRE);
+}
+
+static void _cancel_chunk(
+    WorkerItem *item, char *opaque, char *light, char *highest)
+{
+    free(opaque);
+    free(light);
+    free(highest);
+    item->faces = 0;
+    item->data = 0;
+}
+
 void compute_chunk(WorkerItem *item) {
     char *opaque = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
     char *light = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
@@ -845,6 +873,11 @@ void compute_chunk(WorkerItem *item) {
         }
     }
 
+    if (_cancelled(item)) {
+        _cancel_chunk(item, opaque, light, highest);
+        return;
+    }
+
     // flood fill light intensities
     if (has_light) {
         for (int a = 0; a < 3; a++) {
@@ -863,6 +896,11 @@ void compute_chunk(WorkerItem *item) {
         }
     }
 
+    if (_cancelled(item)) {
+        _cancel_chunk(item, opaque, light, highest);
+        return;
+    }
+
     Map *map = item->block_maps[1][1];
 
     // count exposed faces
@@ -898,6 +936,9 @@ void compute_chunk(WorkerItem *item) {
     GLfloat *data = malloc_faces(10, faces);
     int offset = 0;
     MAP_FOR_EACH(map, ex, ey, ez, ew) {
+        if (_cancelled(item)) {
+            break;
+        }
         if (ew <= 0) {
             continue;
         }
@@ -963,6 +1004,12 @@ void compute_chunk(WorkerItem *item) {
         offset += total * 60;
     } END_MAP_FOR_EACH;
 
+    if (_cancelled(item)) {
+        free(data);
+        _cancel_chunk(item, opaque, light, highest);
+        return;
+    }
+
     free(opaque);
     free(light);
     free(highest);
@@ -977,50 +1024,48 @@ void generate_chunk(Chunk *chunk, WorkerItem *item) {
     chunk->miny = item->miny;
     chunk->maxy = item->maxy;
     chunk->faces = item->faces;
-    del_buffer(chunk->buffer);
-    chunk->buffer = gen_faces(10, item->faces, item->data);
+    chunk->buffer = update_faces(chunk->buffer, 10, item->faces, item->data);
+    item->data = 0;
     gen_sign_buffer(chunk);
 }
 
-void gen_chunk_buffer(Chunk *chunk) {
-    WorkerItem _item;
-    WorkerItem *item = &_item;
-    item->p = chunk->p;
-    item->q = chunk->q;
-    for (int dp = -1; dp <= 1; dp++) {
-        for (int dq = -1; dq <= 1; dq++) {
-            Chunk *other = chunk;
-            if (dp || dq) {
-                other = find_chunk(chunk->p + dp, chunk->q + dq);
-            }
-            if (other) {
-                item->block_maps[dp + 1][dq + 1] = &other->map;
-                item->light_maps[dp + 1][dq + 1] = &other->lights;
-            }
-            else {
-                item->block_maps[dp + 1][dq + 1] = 0;
-                item->light_maps[dp + 1][dq + 1] = 0;
-            }
-        }
-    }
-    compute_chunk(item);
-    generate_chunk(chunk, item);
-    chunk->dirty = 0;
-}
-
 void map_set_func(int x, int y, int z, int w, void *arg) {
     Map *map = (Map *)arg;
     map_set(map, x, y, z, w);
 }
 
+// Reads the chunk and every neighbour marked in item->loads, the
+// neighbourhood comes from one range query per table instead of one
+// query per chunk.
 void load_chunk(WorkerItem *item) {
-    int p = item->p;
-    int q = item->q;
-    Map *block_map = item->block_maps[1][1];
-    Map *light_map = item->light_maps[1][1];
-    create_world(p, q, map_set_func, block_map);
-    db_load_blocks(block_map, p, q);
-    db_load_lights(light_map, p, q);
+    Map *block_maps[9] = {0};
+    Map *light_maps[9] = {0};
+    SignList *signs[9] = {0};
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            if (!item->loads[a][b]) {
+                continue;
+            }
+            int p = item->p + a - 1;
+            int q = item->q + b - 1;
+            create_world(p, q, map_set_func, item->block_maps[a][b]);
+            if (_cancelled(item)) {
+                return;
+            }
+            block_maps[a * 3 + b] = item->block_maps[a][b];
+            light_maps[a * 3 + b] = item->light_maps[a][b];
+            signs[a * 3 + b] = &item->signs[a][b];
+        }
+    }
+    db_load_blocks_range(block_maps, item->p - 1, item->q - 1, 3, 3);
+    if (_cancelled(item)) {
+        return;
+    }
+    db_load_lights_range(light_maps, item->p - 1, item->q - 1, 3, 3);
+    if (_cancelled(item)) {
+        return;
+    }
+    db_load_signs_range(signs, item->p - 1, item->q - 1, 3, 3);
 }
 
 void request_chunk(int p, int q) {
@@ -1035,10 +1080,13 @@ void init_chunk(Chunk *chunk, int p, int q) {
     chunk->sign_faces = 0;
     chunk->buffer = 0;
     chunk->sign_buffer = 0;
+    chunk->generation = ++g->generation;
+    chunk->loaded = 0;
+    chunk->loading = 0;
+    chunk->requesting = 0;
+    chunk->edited = 0;
     dirty_chunk(chunk);
-    SignList *signs = &chunk->signs;
-    sign_list_alloc(signs, 16);
-    db_load_signs(signs, p, q);
+    sign_list_alloc(&chunk->signs, 16);
     Map *block_map = &chunk->map;
     Map *light_map = &chunk->lights;
     int dx = p * CHUNK_SIZE - 1;
@@ -1048,20 +1096,6 @@ void init_chunk(Chunk *chunk, int p, int q) {
     map_alloc(light_map, dx, dy, dz, 0xf);
 }
 
-void create_chunk(Chunk *chunk, int p, int q) {
-    init_chunk(chunk, p, q);
-
-    WorkerItem _item;
-    WorkerItem *item = &_item;
-    item->p = chunk->p;
-    item->q = chunk->q;
-    item->block_maps[1][1] = &chunk->map;
-    item->light_maps[1][1] = &chunk->lights;
-    load_chunk(item);
-
-    request_chunk(p, q);
-}
-
 void delete_chunks() {
     int count = g->chunk_count;
     State *s1 = &g->players->state;
@@ -1080,7 +1114,17 @@ void delete_chunks() {
                 break;
             }
         }
+        if (delete && prefetch_cached(chunk->p, chunk->q)) {
+            int p = chunked(s1->x);
+            int q = chunked(s1->z);
+            int r = g->delete_radius + g->prefetch_radius;
+            delete = chunk_distance(chunk, p, q) >= r;
+        }
         if (delete) {
+            if (chunk->loaded && !chunk->requesting) {
+                // the server sends changes to chunks it was asked for
+                client_unload(chunk->p, chunk->q);
+            }
             map_free(&chunk->map);
             map_free(&chunk->lights);
             sign_list_free(&chunk->signs);
@@ -1094,6 +1138,10 @@ void delete_chunks() {
 }
 
 void delete_all_chunks() {
+    for (int i = 0; i < g->upload_count; i++) {
+        free(g->uploads[i].data);
+    }
+    g->upload_count = 0;
     for (int i = 0; i < g->chunk_count; i++) {
         Chunk *chunk = g->chunks + i;
         map_free(&chunk->map);
@@ -1105,24 +1153,88 @@ void delete_all_chunks() {
     g->chunk_count = 0;
 }
 
+// A job is superseded once its chunk has been evicted (or evicted and
+// created again, which assigns a new generation), or, for mesh-only jobs,
+// once the chunk was dirtied again while it already has a mesh to show.
+// Loads are never superseded by dirtying because their maps are still needed.
+int job_superseded(WorkerItem *item, Chunk *chunk) {
+    if (!chunk || chunk->generation != item->generation) {
+        return 1;
+    }
+    return !item->load && chunk->dirty && chunk->buffer;
+}
+
+// Installs the data read by a load job into the chunk and the neighbours
+// it loaded, unless they were evicted or loaded some other way meanwhile.
+void install_chunks(WorkerItem *item) {
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            if (!item->loads[a][b]) {
+                continue;
+            }
+            Chunk *chunk = find_chunk(item->p + a - 1, item->q + b - 1);
+            if (!chunk || chunk->loaded ||
+                chunk->loading != item->generation)
+            {
+                continue;
+            }
+            map_free(&chunk->map);
+            map_free(&chunk->lights);
+            map_copy(&chunk->map, item->block_maps[a][b]);
+            map_copy(&chunk->lights, item->light_maps[a][b]);
+            SignList signs = chunk->signs;
+            chunk->signs = item->signs[a][b];
+            item->signs[a][b] = signs;
+            chunk->loaded = 1;
+            chunk->loading = 0;
+            chunk->requesting = g->mode == MODE_ONLINE;
+            // meshes built before this chunk arrived saw an empty border
+            for (int dp = -1; dp <= 1; dp++) {
+                for (int dq = -1; dq <= 1; dq++) {
+                    Chunk *other = find_chunk(chunk->p + dp, chunk->q + dq);
+                    if (other && other->buffer &&
+                        (other->p != item->p || other->q != item->q))
+                    {
+                        other->dirty = 1;
+                    }
+                }
+            }
+        }
+    }
+}
+
 void check_workers() {
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_DONE) {
+        if (worker->state == WORKER_BUSY) {
+            WorkerItem *item = &worker->item;
+            if (job_superseded(item, find_chunk(item->p, item->q))) {
+                __atomic_store_n(&item->cancel, 1, __ATOMIC_RELEASE);
+            }
+        }
+        if (worker->state == WORKER_DONE && g->upload_count < MAX_UPLOADS) {
             WorkerItem *item = &worker->item;
             Chunk *chunk = find_chunk(item->p, item->q);
+            if (_cancelled(item) || !chunk ||
+                chunk->generation != item->generation)
+            {
+                chunk = 0;
+            }
             if (chunk) {
                 if (item->load) {
-                    Map *block_map = item->block_maps[1][1];
-                    Map *light_map = item->light_maps[1][1];
-                    map_free(&chunk->map);
-                    map_free(&chunk->lights);
-                    map_copy(&chunk->map, block_map);
-                    map_copy(&chunk->lights, light_map);
-                    request_chunk(item->p, item->q);
+                    install_chunks(item);
+                }
+                if (item->prefetch || (chunk->dirty && chunk->buffer)) {
+                    // no mesh, or superseded by a newer job
+                    free(item->data);
+                }
+                else {
+                    queue_upload(item);
                 }
-                generate_chunk(chunk, item);
+            }
+            else {
+                free(item->data);
             }
             for (int a = 0; a < 3; a++) {
                 for (int b = 0; b < 3; b++) {
@@ -1136,6 +1248,14 @@ void check_workers() {
                         map_free(light_map);
                         free(light_map);
                     }
+                    if (item->loads[a][b]) {
+                        Chunk *other = find_chunk(
+                            item->p + a - 1, item->q + b - 1);
+                        if (other && other->loading == item->generation) {
+                            other->loading = 0;
+                        }
+                        sign_list_free(&item->signs[a][b]);
+                    }
                 }
             }
             worker->state = WORKER_IDLE;
@@ -1144,38 +1264,237 @@ void check_workers() {
     }
 }
 
-void force_chunks(Player *player) {
+// Hands a finished mesh to the upload queue. A mesh still waiting for the
+// same chunk is superseded by the newer one rather than uploaded twice.
+void queue_upload(WorkerItem *item) {
+    WorkerItem *upload = 0;
+    for (int i = 0; i < g->upload_count; i++) {
+        WorkerItem *other = g->uploads + i;
+        if (other->p == item->p && other->q == item->q) {
+            free(other->data);
+            upload = other;
+            break;
+        }
+    }
+    if (!upload) {
+        upload = g->uploads + g->upload_count++;
+    }
+    memcpy(upload, item, sizeof(WorkerItem));
+    memset(upload->block_maps, 0, sizeof(upload->block_maps));
+    memset(upload->light_maps, 0, sizeof(upload->light_maps));
+    memset(&upload->signs, 0, sizeof(upload->signs));
+    item->data = 0;
+}
+
+// Drains the upload queue in FIFO order until either the byte or the time
+// budget for this frame is spent. At least one mesh is uploaded per call so
+// that a single huge chunk cannot stall the queue forever.
+void upload_chunks() {
+    double start = glfwGetTime();
+    int bytes = 0;
+    int done = 0;
+    while (done < g->upload_count) {
+        if (done && (bytes >= g->upload_bytes ||
+            glfwGetTime() - start >= g->upload_time))
+        {
+            break;
+        }
+        WorkerItem *item = g->uploads + done++;
+        Chunk *chunk = find_chunk(item->p, item->q);
+        // the chunk may have been created again or handed to a newer job
+        if (chunk && chunk->generation == item->generation) {
+            bytes += sizeof(GLfloat) * 6 * 10 * item->faces;
+            generate_chunk(chunk, item);
+        }
+        else {
+            free(item->data);
+        }
+    }
+    g->upload_count -= done;
+    memmove(g->uploads, g->uploads + done, sizeof(WorkerItem) * g->upload_count);
+}
+
+int chunk_loaded(int p, int q) {
+    Chunk *chunk = find_chunk(p, q);
+    return chunk && chunk->loaded;
+}
+int prefetch_cached(int p, int q) {
+    Prefetch *prefetch = &g->prefetch;
+    for (int i = 0; i < prefetch->cache_count; i++) {
+        if (prefetch->cache[i][0] == p && prefetch->cache[i][1] == q) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void cache_prefetch(int p, int q) {
+    Prefetch *prefetch = &g->prefetch;
+    if (prefetch_cached(p, q)) {
+        return;
+    }
+    prefetch->cache[prefetch->cache_index][0] = p;
+    prefetch->cache[prefetch->cache_index][1] = q;
+    prefetch->cache_index = (prefetch->cache_index + 1) % MAX_PREFETCH;
+    prefetch->cache_count = MIN(prefetch->cache_count + 1, MAX_PREFETCH);
+}
+
+void add_prefetch_target(int p, int q) {
+    Prefetch *prefetch = &g->prefetch;
+    if (prefetch->count >= MAX_PREFETCH) {
+        return;
+    }
+    for (int i = 0; i < prefetch->count; i++) {
+        if (prefetch->targets[i][0] == p && prefetch->targets[i][1] == q) {
+            return;
+        }
+    }
+    prefetch->targets[prefetch->count][0] = p;
+    prefetch->targets[prefetch->count][1] = q;
+    prefetch->count++;
+}
+
+void update_prefetch(Player *player) {
+    Prefetch *prefetch = &g->prefetch;
     State *s = &player->state;
+    double now = glfwGetTime();
+    double dt = now - prefetch->t;
+    if (dt < 0.1) {
+        return;
+    }
+    float vx = (s->x - prefetch->x) / dt;
+    float vz = (s->z - prefetch->z) / dt;
+    if (dt > 1 || sqrtf(vx * vx + vz * vz) > 100) {
+        // paused or teleported, start over
+        vx = vz = 0;
+        prefetch->vx = prefetch->vz = 0;
+    }
+    prefetch->vx = (prefetch->vx + vx) / 2;
+    prefetch->vz = (prefetch->vz + vz) / 2;
+    prefetch->x = s->x;
+    prefetch->z = s->z;
+    prefetch->t = now;
+    prefetch->count = 0;
+    float speed = sqrtf(
+        prefetch->vx * prefetch->vx + prefetch->vz * prefetch->vz);
+    if (speed < 1) {
+        return;
+    }
+    float dx = prefetch->vx / speed;
+    float dz = prefetch->vz / speed;
+    float lx = cosf(s->rx - RADIANS(90));
+    float lz = sinf(s->rx - RADIANS(90));
+    int n = g->prefetch_radius;
+    if (dx * lx + dz * lz < 0) {
+        // moving away from where we look, less likely to keep going
+        n /= 2;
+    }
     int p = chunked(s->x);
     int q = chunked(s->z);
-    int r = 1;
-    for (int dp = -r; dp <= r; dp++) {
-        for (int dq = -r; dq <= r; dq++) {
-            int a = p + dp;
-            int b = q + dq;
-            Chunk *chunk = find_chunk(a, b);
-            if (chunk) {
-                if (chunk->dirty) {
-                    gen_chunk_buffer(chunk);
-                }
+    int r = g->create_radius;
+    for (int i = 1; i <= n; i++) {
+        int a = p + roundf(dx * (r + i));
+        int b = q + roundf(dz * (r + i));
+        for (int j = -1; j <= 1; j++) {
+            int c = a + roundf(-dz * j);
+            int d = b + roundf(dx * j);
+            if (MAX(ABS(c - p), ABS(d - q)) > r) {
+                add_prefetch_target(c, d);
             }
-            else if (g->chunk_count < MAX_CHUNKS) {
-                chunk = g->chunks + g->chunk_count++;
-                create_chunk(chunk, a, b);
-                gen_chunk_buffer(chunk);
+        }
+    }
+}
+
+// The 3x3 neighbourhood is meshed by the workers ahead of everything else
+// (see ensure_chunks_worker); block here, for at most timeout seconds, only
+// until the chunk the player is standing in has its block data.
+int force_chunks(Player *player, double timeout) {
+    double start = glfwGetTime();
+    State *s = &player->state;
+    int p = chunked(s->x);
+    int q = chunked(s->z);
+    int index = (ABS(p) ^ ABS(q)) % WORKERS;
+    int result = 0;
+    int waited = 0;
+    while (1) {
+        check_workers();
+        if (chunk_loaded(p, q)) {
+            result = 1;
+            break;
+        }
+        // the chunk may be loading as a neighbour in another worker's job
+        Worker *worker = g->workers + index;
+        Chunk *chunk = find_chunk(p, q);
+        for (int i = 0; chunk && chunk->loading && i < WORKERS; i++) {
+            Worker *other = g->workers + i;
+            mtx_lock(&other->mtx);
+            int generation = other->item.generation;
+            mtx_unlock(&other->mtx);
+            if (generation == chunk->loading) {
+                worker = other;
             }
         }
+        double remaining = timeout - (glfwGetTime() - start);
+        if (remaining <= 0) {
+            break;
+        }
+        waited = 1;
+        mtx_lock(&worker->mtx);
+        if (worker->state == WORKER_IDLE) {
+            ensure_chunks_worker(player, worker);
+        }
+        if (worker->state == WORKER_BUSY) {
+            struct timespec ts;
+            clock_gettime(TIME_UTC, &ts);
+            double deadline = ts.tv_sec + ts.tv_nsec / 1e9 + remaining;
+            ts.tv_sec = (time_t)deadline;
+            ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+            cnd_timedwait(&worker->cnd, &worker->mtx, &ts);
+            mtx_unlock(&worker->mtx);
+        }
+        else {
+            // done but not accepted (upload queue full) or nothing to do
+            mtx_unlock(&worker->mtx);
+            break;
+        }
+    }
+    double elapsed = glfwGetTime() - start;
+    g->force_time += elapsed;
+    g->force_worst = MAX(g->force_worst, elapsed);
+    if (waited) {
+        g->force_waits++;
+        if (!result) {
+            g->force_timeouts++;
+        }
     }
+    return result;
 }
 
-void ensure_chunks_worker(Player *player, Worker *worker) {
+static void _player_planes(Player *player, float planes[6][4]) {
     State *s = &player->state;
     float matrix[16];
     set_matrix_3d(
         matrix, g->width, g->height,
         s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
-    float planes[6][4];
     frustum_planes(planes, g->render_radius, matrix);
+}
+
+// Lower scores go first: the 3x3 neighbourhood, then visible chunks, then
+// chunks with priority set, nearest first within each.
+static int _chunk_score(
+    float planes[6][4], int p, int q, int a, int b, int priority)
+{
+    int distance = MAX(ABS(a - p), ABS(b - q));
+    int forced = distance <= 1;
+    int invisible = !forced && !chunk_visible(planes, a, b, 0, 256);
+    return
+        (!forced << 25) | (invisible << 24) | (priority << 16) | distance;
+}
+
+void ensure_chunks_worker(Player *player, Worker *worker) {
+    State *s = &player->state;
+    float planes[6][4];
+    _player_planes(player, planes);
     int p = chunked(s->x);
     int q = chunked(s->z);
     int r = g->create_radius;
@@ -1192,16 +1511,14 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
                 continue;
             }
             Chunk *chunk = find_chunk(a, b);
-            if (chunk && !chunk->dirty) {
+            if (chunk && (!chunk->dirty || chunk->loading)) {
                 continue;
             }
-            int distance = MAX(ABS(dp), ABS(dq));
-            int invisible = !chunk_visible(planes, a, b, 0, 256);
             int priority = 0;
             if (chunk) {
                 priority = chunk->buffer && chunk->dirty;
             }
-            int score = (invisible << 24) | (priority << 16) | distance;
+            int score = _chunk_score(planes, p, q, a, b, priority);
             if (score < best_score) {
                 best_score = score;
                 best_a = a;
@@ -1209,15 +1526,34 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
             }
         }
     }
+    int prefetch = 0;
+    for (int i = 0; i < g->prefetch.count; i++) {
+        int a = g->prefetch.targets[i][0];
+        int b = g->prefetch.targets[i][1];
+        int index = (ABS(a) ^ ABS(b)) % WORKERS;
+        if (index != worker->index) {
+            continue;
+        }
+        Chunk *chunk = find_chunk(a, b);
+        if (chunk && (chunk->loaded || chunk->loading)) {
+            continue;
+        }
+        int distance = MAX(ABS(a - p), ABS(b - q));
+        int score = (1 << 24) | distance;
+        if (score < best_score) {
+            best_score = score;
+            best_a = a;
+            best_b = b;
+            prefetch = 1;
+        }
+    }
     if (best_score == start) {
         return;
     }
     int a = best_a;
     int b = best_b;
-    int load = 0;
     Chunk *chunk = find_chunk(a, b);
     if (!chunk) {
-        load = 1;
         if (g->chunk_count < MAX_CHUNKS) {
             chunk = g->chunks + g->chunk_count++;
             init_chunk(chunk, a, b);
@@ -1229,12 +1565,32 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
     WorkerItem *item = &worker->item;
     item->p = chunk->p;
     item->q = chunk->q;
-    item->load = load;
+    item->load = 0;
+    item->prefetch = prefetch;
+    item->generation = chunk->generation = ++g->generation;
+    __atomic_store_n(&item->cancel, 0, __ATOMIC_RELEASE);
+    item->data = 0;
+    memset(item->loads, 0, sizeof(item->loads));
     for (int dp = -1; dp <= 1; dp++) {
         for (int dq = -1; dq <= 1; dq++) {
             Chunk *other = chunk;
             if (dp || dq) {
                 other = find_chunk(chunk->p + dp, chunk->q + dq);
+                // neighbours are read along with the chunk so that its
+                // mesh sees their edges and they need no load job of
+                // their own, this pulls in the ring beyond the frontier too
+                if (!other && !prefetch && g->chunk_count < MAX_CHUNKS) {
+                    other = g->chunks + g->chunk_count++;
+                    init_chunk(other, chunk->p + dp, chunk->q + dq);
+                }
+            }
+            if (other && !other->loaded && !other->loading &&
+                (other == chunk || !prefetch))
+            {
+                other->loading = item->generation;
+                item->load = 1;
+                item->loads[dp + 1][dq + 1] = 1;
+                sign_list_alloc(&item->signs[dp + 1][dq + 1], 16);
             }
             if (other) {
                 Map *block_map = malloc(sizeof(Map));
@@ -1250,14 +1606,23 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
             }
         }
     }
-    chunk->dirty = 0;
+    if (prefetch) {
+        // block data only, meshed once it comes within create_radius
+        cache_prefetch(a, b);
+    }
+    else {
+        chunk->dirty = 0;
+    }
     worker->state = WORKER_BUSY;
     cnd_signal(&worker->cnd);
 }
 
 void ensure_chunks(Player *player) {
     check_workers();
-    force_chunks(player);
+    update_prefetch(g->players);
+    if (player == g->players && !g->flying) {
+        force_chunks(player, FORCE_CHUNK_TIMEOUT);
+    }
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
@@ -1268,6 +1633,99 @@ void ensure_chunks(Player *player) {
     }
 }
 
+static double _request_clock() {
+    // glfwGetTime follows the time of day the server sets
+    struct timespec ts;
+    clock_gettime(TIME_UTC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _drop_request(int index) {
+    Requests *requests = &g->requests;
+    int last = --requests->count;
+    requests->chunks[index][0] = requests->chunks[last][0];
+    requests->chunks[index][1] = requests->chunks[last][1];
+    requests->times[index] = requests->times[last];
+    requests->sends[index] = requests->sends[last];
+}
+
+// Loaded chunks wait for a request until fewer than CHUNK_REQUEST_WINDOW
+// requests are unanswered, the best of them by the same score the workers
+// mesh by go out first. Requests that are not answered in time are sent
+// again and keep their slot until every response has ended, so that the
+// end of the first one does not free the slot of another request.
+void request_chunks(Player *player) {
+    Requests *requests = &g->requests;
+    double now = _request_clock();
+    for (int i = 0; i < requests->count; i++) {
+        if (now - requests->times[i] > CHUNK_REQUEST_TIMEOUT) {
+            int p = requests->chunks[i][0];
+            int q = requests->chunks[i][1];
+            if (!find_chunk(p, q)) {
+                // unloaded meanwhile, nothing waits for the response
+                _drop_request(i--);
+                continue;
+            }
+            request_chunk(p, q);
+            requests->times[i] = now;
+            requests->sends[i]++;
+        }
+    }
+    int slots = CHUNK_REQUEST_WINDOW - requests->count;
+    if (!slots) {
+        return;
+    }
+    State *s = &player->state;
+    float planes[6][4];
+    _player_planes(player, planes);
+    int p = chunked(s->x);
+    int q = chunked(s->z);
+    Chunk *best[CHUNK_REQUEST_WINDOW];
+    int scores[CHUNK_REQUEST_WINDOW];
+    int count = 0;
+    for (int i = 0; i < g->chunk_count; i++) {
+        Chunk *chunk = g->chunks + i;
+        if (!chunk->requesting) {
+            continue;
+        }
+        int score = _chunk_score(planes, p, q, chunk->p, chunk->q, 0);
+        if (count == slots && score >= scores[count - 1]) {
+            continue;
+        }
+        int j = count < slots ? count++ : count - 1;
+        for (; j > 0 && scores[j - 1] > score; j--) {
+            best[j] = best[j - 1];
+            scores[j] = scores[j - 1];
+        }
+        best[j] = chunk;
+        scores[j] = score;
+    }
+    for (int i = 0; i < count; i++) {
+        Chunk *chunk = best[i];
+        request_chunk(chunk->p, chunk->q);
+        chunk->requesting = 0;
+        requests->chunks[requests->count][0] = chunk->p;
+        requests->chunks[requests->count][1] = chunk->q;
+        requests->times[requests->count] = now;
+        requests->sends[requests->count] = 1;
+        requests->count++;
+    }
+}
+
+// Frees the window slot of a chunk request once its last response has
+// ended, responses nothing waits for anymore are ignored.
+void ack_chunk(int p, int q) {
+    Requests *requests = &g->requests;
+    for (int i = 0; i < requests->count; i++) {
+        if (requests->chunks[i][0] == p && requests->chunks[i][1] == q) {
+            if (!--requests->sends[i]) {
+                _drop_request(i);
+            }
+            return;
+        }
+    }
+}
+
 int worker_run(void *arg) {
     Worker *worker = (Worker *)arg;
     int running = 1;
@@ -1281,9 +1739,12 @@ int worker_run(void *arg) {
         if (item->load) {
             load_chunk(item);
         }
-        compute_chunk(item);
+        if (!_cancelled(item) && !item->prefetch) {
+            compute_chunk(item);
+        }
         mtx_lock(&worker->mtx);
         worker->state = WORKER_DONE;
+        cnd_broadcast(&worker->cnd);
         mtx_unlock(&worker->mtx);
     }
     return 0;
@@ -1297,11 +1758,11 @@ void unset_sign(int x, int y, int z) {
         SignList *signs = &chunk->signs;
         if (sign_list_remove_all(signs, x, y, z)) {
             chunk->dirty = 1;
-            db_delete_signs(x, y, z);
+            db_delete_signs(p, q, x, y, z);
         }
     }
     else {
-        db_delete_signs(x, y, z);
+        db_delete_signs(p, q, x, y, z);
     }
 }
 
@@ -1313,11 +1774,11 @@ void unset_sign_face(int x, int y, int z, int face) {
         SignList *signs = &chunk->signs;
         if (sign_list_remove(signs, x, y, z, face)) {
             chunk->dirty = 1;
-            db_delete_sign(x, y, z, face);
+            db_delete_sign(p, q, x, y, z, face);
         }
     }
     else {
-        db_delete_sign(x, y, z, face);
+        db_delete_sign(p, q, x, y, z, face);
     }
 }
 
@@ -1394,10 +1855,11 @@ void _set_block(int p, int q, int x, int y, int z, int w, int dirty) {
     }
 }
 
-void set_block(int x, int y, int z, int w) {
+// Blocks on a chunk edge show up in the meshes of the chunks next to it,
+// which read the block from the chunk that owns it.
+void dirty_neighbours(int x, int z) {
     int p = chunked(x);
     int q = chunked(z);
-    _set_block(p, q, x, y, z, w, 1);
     for (int dx = -1; dx <= 1; dx++) {
         for (int dz = -1; dz <= 1; dz++) {
             if (dx == 0 && dz == 0) {
@@ -1409,9 +1871,19 @@ void set_block(int x, int y, int z, int w) {
             if (dz && chunked(z + dz) == q) {
                 continue;
             }
-            _set_block(p + dx, q + dz, x, y, z, -w, 1);
+            Chunk *other = find_chunk(p + dx, q + dz);
+            if (other) {
+                dirty_chunk(other);
+            }
         }
     }
+}
+
+void set_block(int x, int y, int z, int w) {
+    int p = chunked(x);
+    int q = chunked(z);
+    _set_block(p, q, x, y, z, w, 1);
+    dirty_neighbours(x, z);
     client_block(x, y, z, w);
 }
 
@@ -1434,6 +1906,28 @@ int get_block(int x, int y, int z) {
     return 0;
 }
 
+void begin_edit() {
+    if (g->edit_depth++) {
+        return;
+    }
+    db_begin_batch();
+}
+
+void end_edit() {
+    if (--g->edit_depth) {
+        return;
+    }
+    for (int i = 0; i < g->edit_count; i++) {
+        Chunk *chunk = find_chunk(g->edit_chunks[i][0], g->edit_chunks[i][1]);
+        if (chunk) {
+            chunk->edited = 0;
+            dirty_chunk(chunk);
+        }
+    }
+    g->edit_count = 0;
+    db_end_batch();
+}
+
 void builder_block(int x, int y, int z, int w) {
     if (y <= 0 || y >= 256) {
         return;
@@ -1677,6 +2171,7 @@ void copy() {
 }
 
 void paste() {
+    begin_edit();
     Block *c1 = &g->copy1;
     Block *c2 = &g->copy0;
     Block *p1 = &g->block1;
@@ -1696,12 +2191,14 @@ void paste() {
             }
         }
     }
+    end_edit();
 }
 
 void array(Block *b1, Block *b2, int xc, int yc, int zc) {
     if (b1->w != b2->w) {
         return;
     }
+    begin_edit();
     int w = b1->w;
     int dx = b2->x - b1->x;
     int dy = b2->y - b1->y;
@@ -1719,12 +2216,14 @@ void array(Block *b1, Block *b2, int xc, int yc, int zc) {
             }
         }
     }
+    end_edit();
 }
 
 void cube(Block *b1, Block *b2, int fill) {
     if (b1->w != b2->w) {
         return;
     }
+    begin_edit();
     int w = b1->w;
     int x1 = MIN(b1->x, b2->x);
     int y1 = MIN(b1->y, b2->y);
@@ -1749,6 +2248,7 @@ void cube(Block *b1, Block *b2, int fill) {
             }
         }
     }
+    end_edit();
 }
 
 void sphere(Block *center, int radius, int fill, int fx, int fy, int fz) {
@@ -1762,6 +2262,7 @@ void sphere(Block *center, int radius, int fill, int fx, int fy, int fz) {
         {0.5, 0.5, -0.5},
         {0.5, 0.5, 0.5}
     };
+    begin_edit();
     int cx = center->x;
     int cy = center->y;
     int cz = center->z;
@@ -1798,6 +2299,7 @@ void sphere(Block *center, int radius, int fill, int fx, int fy, int fz) {
             }
         }
     }
+    end_edit();
 }
 
 void cylinder(Block *b1, Block *b2, int radius, int fill) {
@@ -1817,6 +2319,7 @@ void cylinder(Block *b1, Block *b2, int radius, int fill) {
     if (fx + fy + fz != 1) {
         return;
     }
+    begin_edit();
     Block block = {x1, y1, z1, w};
     if (fx) {
         for (int x = x1; x <= x2; x++) {
@@ -1836,9 +2339,11 @@ void cylinder(Block *b1, Block *b2, int radius, int fill) {
             sphere(&block, radius, fill, 0, 0, 1);
         }
     }
+    end_edit();
 }
 
 void tree(Block *block) {
+    begin_edit();
     int bx = block->x;
     int by = block->y;
     int bz = block->z;
@@ -1856,6 +2361,7 @@ void tree(Block *block) {
     for (int y = by; y < by + 7; y++) {
         builder_block(bx, y, bz, 5);
     }
+    end_edit();
 }
 
 void parse_command(const char *buffer, int forward) {
@@ -2288,8 +2794,9 @@ void handle_movement(double dt) {
     vx = vx * ut * speed;
     vy = vy * ut * speed;
     vz = vz * ut * speed;
+    int loaded = chunk_loaded(chunked(s->x), chunked(s->z));
     for (int i = 0; i < step; i++) {
-        if (g->flying) {
+        if (g->flying || !loaded) {
             dy = 0;
         }
         else {
@@ -2308,106 +2815,222 @@ void handle_movement(double dt) {
     }
 }
 
-void parse_buffer(char *buffer) {
+// Sends the position more often the faster it changes, once the player
+// moved POSITION_STEP blocks or turned POSITION_TURN radians since the last
+// one sent, and any smaller change after POSITION_MAX_INTERVAL.
+int send_position(Player *player, double elapsed) {
+    State *s = &player->state;
+    State *sent = &g->position_sent;
+    if (elapsed < POSITION_MIN_INTERVAL) {
+        return 0;
+    }
+    float dx = s->x - sent->x;
+    float dy = s->y - sent->y;
+    float dz = s->z - sent->z;
+    float moved = sqrtf(dx * dx + dy * dy + dz * dz);
+    float turned = MAX(ABS(s->rx - sent->rx), ABS(s->ry - sent->ry));
+    if (moved < POSITION_STEP && turned < POSITION_TURN &&
+        (elapsed < POSITION_MAX_INTERVAL || (!moved && !turned)))
+    {
+        return 0;
+    }
+    *sent = *s;
+    client_position(s->x, s->y, s->z, s->rx, s->ry);
+    return 1;
+}
+
+static void _server_block(int p, int q, int x, int y, int z, int w) {
+    State *s = &g->players->state;
+    // older servers also send border copies for the neighbours
+    if (chunked(x) == p && chunked(z) == q) {
+        _set_block(p, q, x, y, z, w, 0);
+        dirty_neighbours(x, z);
+    }
+    if (player_intersects_block(2, s->x, s->y, s->z, x, y, z)) {
+        s->y = highest_block(s->x, s->z) + 2;
+    }
+}
+
+static void _server_position(
+    int pid, float x, float y, float z, float rx, float ry)
+{
+    Player *player = find_player(pid);
+    if (!player && g->player_count < MAX_PLAYERS) {
+        player = g->players + g->player_count;
+        g->player_count++;
+        player->id = pid;
+        player->buffer = 0;
+        snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
+        update_player(player, x, y, z, rx, ry, 1); // twice
+    }
+    if (player) {
+        update_player(player, x, y, z, rx, ry, 1);
+    }
+}
+
+static void _server_redraw(int p, int q) {
+    Chunk *chunk = find_chunk(p, q);
+    if (chunk) {
+        dirty_chunk(chunk);
+    }
+}
+
+static void _server_chunk(const ProtoChunk *chunk) {
+    int x, y, z, w;
+    for (int i = 0; i < chunk->block_count; i++) {
+        proto_chunk_entry(chunk, chunk->blocks, i, &x, &y, &z, &w);
+        _server_block(chunk->p, chunk->q, x, y, z, w);
+    }
+    for (int i = 0; i < chunk->light_count; i++) {
+        proto_chunk_entry(chunk, chunk->lights, i, &x, &y, &z, &w);
+        set_light(chunk->p, chunk->q, x, y, z, w);
+    }
+    if (chunk->key) {
+        db_set_key(chunk->p, chunk->q, chunk->key);
+    }
+}
+
+static void _apply_you(Event *e) {
     Player *me = g->players;
     State *s = &g->players->state;
-    char *key;
-    char *line = tokenize(buffer, "\n", &key);
-    while (line) {
-        int pid;
-        float ux, uy, uz, urx, ury;
-        if (sscanf(line, "U,%d,%f,%f,%f,%f,%f",
-            &pid, &ux, &uy, &uz, &urx, &ury) == 6)
-        {
-            me->id = pid;
-            s->x = ux; s->y = uy; s->z = uz; s->rx = urx; s->ry = ury;
-            force_chunks(me);
-            if (uy == 0) {
-                s->y = highest_block(s->x, s->z) + 2;
-            }
-        }
-        int bp, bq, bx, by, bz, bw;
-        if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-        {
-            _set_block(bp, bq, bx, by, bz, bw, 0);
-            if (player_intersects_block(2, s->x, s->y, s->z, bx, by, bz)) {
-                s->y = highest_block(s->x, s->z) + 2;
-            }
-        }
-        if (sscanf(line, "L,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-        {
-            set_light(bp, bq, bx, by, bz, bw);
-        }
-        float px, py, pz, prx, pry;
-        if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
-            &pid, &px, &py, &pz, &prx, &pry) == 6)
-        {
-            Player *player = find_player(pid);
-            if (!player && g->player_count < MAX_PLAYERS) {
-                player = g->players + g->player_count;
-                g->player_count++;
-                player->id = pid;
-                player->buffer = 0;
-                snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
-                update_player(player, px, py, pz, prx, pry, 1); // twice
-            }
-            if (player) {
-                update_player(player, px, py, pz, prx, pry, 1);
-            }
-        }
-        if (sscanf(line, "D,%d", &pid) == 1) {
-            delete_player(pid);
-        }
-        int kp, kq, kk;
-        if (sscanf(line, "K,%d,%d,%d", &kp, &kq, &kk) == 3) {
-            db_set_key(kp, kq, kk);
-        }
-        if (sscanf(line, "R,%d,%d", &kp, &kq) == 2) {
-            Chunk *chunk = find_chunk(kp, kq);
-            if (chunk) {
-                dirty_chunk(chunk);
-            }
+    me->id = e->fields[0].i;
+    s->x = e->fields[1].f;
+    s->y = e->fields[2].f;
+    s->z = e->fields[3].f;
+    s->rx = e->fields[4].f;
+    s->ry = e->fields[5].f;
+    force_chunks(me, s->y == 0 ? SPAWN_CHUNK_TIMEOUT : 0);
+    if (s->y == 0) {
+        s->y = highest_block(s->x, s->z) + 2;
+    }
+}
+
+static void _apply_block(Event *e) {
+    MessageField *v = e->fields;
+    _server_block(v[0].i, v[1].i, v[2].i, v[3].i, v[4].i, v[5].i);
+}
+
+static void _apply_light(Event *e) {
+    MessageField *v = e->fields;
+    set_light(v[0].i, v[1].i, v[2].i, v[3].i, v[4].i, v[5].i);
+}
+
+static void _apply_position(Event *e) {
+    MessageField *v = e->fields;
+    _server_position(v[0].i, v[1].f, v[2].f, v[3].f, v[4].f, v[5].f);
+    Player *player = find_player(v[0].i);
+    if (player) {
+        float values[5] = {v[1].f, v[2].f, v[3].f, v[4].f, v[5].f};
+        proto_quantize(values, player->base);
+    }
+}
+
+static void _apply_move(Event *e) {
+    Player *player = find_player(e->fields[0].i);
+    if (!player) {
+        return;
+    }
+    float v[5];
+    for (int i = 0; i < 5; i++) {
+        player->base[i] += e->fields[i + 1].i;
+    }
+    proto_dequantize(player->base, v);
+    update_player(player, v[0], v[1], v[2], v[3], v[4], 1);
+}
+
+static void _apply_chunk(Event *e) {
+    _server_chunk(&e->chunk);
+    if (proto_chunk_last(&e->chunk)) {
+        ack_chunk(e->chunk.p, e->chunk.q);
+    }
+}
+
+static void _apply_delete(Event *e) {
+    delete_player(e->fields[0].i);
+}
+
+static void _apply_key(Event *e) {
+    db_set_key(e->fields[0].i, e->fields[1].i, e->fields[2].i);
+}
+
+static void _apply_redraw(Event *e) {
+    _server_redraw(e->fields[0].i, e->fields[1].i);
+}
+
+static void _apply_time(Event *e) {
+    double elapsed = e->fields[0].d;
+    int day_length = e->fields[1].i;
+    glfwSetTime(fmod(elapsed, day_length));
+    g->day_length = day_length;
+    g->time_changed = 1;
+}
+
+static void _apply_talk(Event *e) {
+    add_message(e->text);
+}
+
+static void _apply_nick(Event *e) {
+    Player *player = find_player(e->fields[0].i);
+    if (player) {
+        snprintf(player->name, MAX_NAME_LENGTH, "%s", e->text);
+    }
+}
+
+static void _apply_sign(Event *e) {
+    MessageField *v = e->fields;
+    char text[MAX_SIGN_LENGTH];
+    snprintf(text, MAX_SIGN_LENGTH, "%s", e->text);
+    _set_sign(v[0].i, v[1].i, v[2].i, v[3].i, v[4].i, v[5].i, text, 0);
+}
+
+typedef void (*event_func)(Event *);
+
+static const event_func appliers[128] = {
+    ['B'] = _apply_block,
+    ['C'] = _apply_chunk,
+    ['D'] = _apply_delete,
+    ['E'] = _apply_time,
+    ['K'] = _apply_key,
+    ['L'] = _apply_light,
+    ['M'] = _apply_move,
+    ['N'] = _apply_nick,
+    ['P'] = _apply_position,
+    ['R'] = _apply_redraw,
+    ['S'] = _apply_sign,
+    ['T'] = _apply_talk,
+    ['U'] = _apply_you,
+};
+
+// Applies the messages the receive thread parsed until the time budget for
+// this frame is spent, at least one per call. Chunks are redrawn once for
+// all of the blocks and lights set in them.
+void apply_events() {
+    double start = glfwGetTime();
+    int done = 0;
+    Event event;
+    begin_edit();
+    while ((!done || glfwGetTime() - start < g->event_time) &&
+        client_event(&event))
+    {
+        event_func func = appliers[(unsigned char)event.type];
+        if (func) {
+            func(&event);
         }
-        double elapsed;
-        int day_length;
-        if (sscanf(line, "E,%lf,%d", &elapsed, &day_length) == 2) {
-            glfwSetTime(fmod(elapsed, day_length));
-            g->day_length = day_length;
-            g->time_changed = 1;
-        }
-        if (line[0] == 'T' && line[1] == ',') {
-            char *text = line + 2;
-            add_message(text);
-        }
-        char format[64];
-        snprintf(
-            format, sizeof(format), "N,%%d,%%%ds", MAX_NAME_LENGTH - 1);
-        char name[MAX_NAME_LENGTH];
-        if (sscanf(line, format, &pid, name) == 2) {
-            Player *player = find_player(pid);
-            if (player) {
-                strncpy(player->name, name, MAX_NAME_LENGTH);
-            }
-        }
-        snprintf(
-            format, sizeof(format),
-            "S,%%d,%%d,%%d,%%d,%%d,%%d,%%%d[^\n]", MAX_SIGN_LENGTH - 1);
-        int face;
-        char text[MAX_SIGN_LENGTH] = {0};
-        if (sscanf(line, format,
-            &bp, &bq, &bx, &by, &bz, &face, text) >= 6)
-        {
-            _set_sign(bp, bq, bx, by, bz, face, text, 0);
+        if (event.type == 'E') {
+            // the clock was just set to the time of day
+            start = glfwGetTime();
         }
-        line = tokenize(NULL, "\n", &key);
+        event_free(&event);
+        done++;
     }
+    end_edit();
 }
 
 void reset_model() {
     memset(g->chunks, 0, sizeof(Chunk) * MAX_CHUNKS);
     g->chunk_count = 0;
+    memset(&g->requests, 0, sizeof(Requests));
+    memset(&g->position_sent, 0, sizeof(State));
     memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
     g->player_count = 0;
     g->observe1 = 0;
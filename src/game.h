@@ -17,7 +17,9 @@
 #include "item.h"
 #include "map.h"
 #include "matrix.h"
+#include "message.h"
 #include "noise.h"
+#include "proto.h"
 #include "sign.h"
 #include "tinycthread.h"
 #include "util.h"
@@ -27,6 +29,8 @@
 #define MAX_CHUNKS 8192
 #define MAX_PLAYERS 128
 #define WORKERS 4
+#define MAX_UPLOADS (WORKERS * 4)
+#define MAX_PREFETCH 64
 #define MAX_TEXT_LENGTH 256
 #define MAX_NAME_LENGTH 32
 #define MAX_PATH_LENGTH 256
@@ -52,6 +56,11 @@ typedef struct {
     int faces;
     int sign_faces;
     int dirty;
+    int edited;
+    int loaded;
+    int loading;
+    int requesting;
+    int generation;
     int miny;
     int maxy;
     GLuint buffer;
@@ -62,8 +71,13 @@ typedef struct {
     int p;
     int q;
     int load;
+    int prefetch;
+    int generation;
+    int cancel; // set by the main thread while a worker runs, atomic
     Map *block_maps[3][3];
     Map *light_maps[3][3];
+    int loads[3][3];
+    SignList signs[3][3];
     int miny;
     int maxy;
     int faces;
@@ -79,6 +93,26 @@ typedef struct {
     WorkerItem item;
 } Worker;
 
+typedef struct {
+    float x;
+    float z;
+    double t;
+    float vx;
+    float vz;
+    int count;
+    int targets[MAX_PREFETCH][2];
+    int cache[MAX_PREFETCH][2];
+    int cache_count;
+    int cache_index;
+} Prefetch;
+
+typedef struct {
+    int count;
+    int chunks[CHUNK_REQUEST_WINDOW][2];
+    double times[CHUNK_REQUEST_WINDOW];
+    int sends[CHUNK_REQUEST_WINDOW]; // responses still to come
+} Requests;
+
 typedef struct {
     int x;
     int y;
@@ -101,6 +135,7 @@ typedef struct {
     State state;
     State state1;
     State state2;
+    int base[5];
     GLuint buffer;
 } Player;
 
@@ -124,10 +159,27 @@ typedef struct {
     Worker workers[WORKERS];
     Chunk chunks[MAX_CHUNKS];
     int chunk_count;
+    int generation;
+    WorkerItem uploads[MAX_UPLOADS];
+    int upload_count;
+    int upload_bytes;
+    double upload_time;
+    double event_time;
+    double force_time;
+    double force_worst;
+    int force_waits;
+    int force_timeouts;
     int create_radius;
     int render_radius;
     int delete_radius;
     int sign_radius;
+    int prefetch_radius;
+    Prefetch prefetch;
+    Requests requests;
+    State position_sent;
+    int edit_depth;
+    int edit_count;
+    int edit_chunks[MAX_CHUNKS][2];
     Player players[MAX_PLAYERS];
     int player_count;
     int typing;
@@ -228,21 +280,30 @@ void occlusion(char neighbors[27], char lights[27], float shades[27], float ao[6
 void light_fill(char* opaque, char* light, int x, int y, int z, int w, int force);
 void compute_chunk(WorkerItem* item);
 void generate_chunk(Chunk* chunk, WorkerItem* item);
-void gen_chunk_buffer(Chunk* Chunk);
 
 void map_set_func(int x, int y, int z, int w, void* arg);
 
 void load_chunk(WorkerItem* item);
 void request_chunk(int p, int q);
 void init_chunk(Chunk* chunk, int p, int q);
-void create_chunk(Chunk* chunk, int p, int q);
 void delete_chunks();
 void delete_all_chunks();
 
+int job_superseded(WorkerItem* item, Chunk* chunk);
+void install_chunks(WorkerItem* item);
 void check_workers();
-void force_chunks(Player* player);
+void queue_upload(WorkerItem* item);
+void upload_chunks();
+int chunk_loaded(int p, int q);
+int prefetch_cached(int p, int q);
+void cache_prefetch(int p, int q);
+void add_prefetch_target(int p, int q);
+void update_prefetch(Player* player);
+int force_chunks(Player* player, double timeout);
 void ensure_chunks_worker(Player* player, Worker* worker);
 void ensure_chunks(Player* player);
+void request_chunks(Player* player);
+void ack_chunk(int p, int q);
 
 int worker_run(void* arg);
 void unset_sign(int x, int y, int z);
@@ -254,9 +315,12 @@ void toggle_light(int x, int y, int z);
 void set_light(int p, int q, int x, int y, int z, int w);
 
 // _set_block
+void dirty_neighbours(int x, int z);
 void set_block(int x, int y, int z, int w);
 void record_block(int x, int y, int z, int w);
 int get_block(int x, int y, int z);
+void begin_edit();
+void end_edit();
 void builder_block(int x, int y, int z, int w);
 
 int render_chunks(Attrib* attrib, Player* player);
@@ -293,7 +357,8 @@ void on_mouse_button(GLFWwindow* window, int button, int action, int mods);
 void create_window();
 void handle_mouse_input();
 void handle_movement(double dt);
-void parse_buffer(char* buffer);
+int send_position(Player* player, double elapsed);
+void apply_events();
 void reset_model();
 
 
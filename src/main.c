@@ -9,6 +9,7 @@
 #include <string.h>
 #include <time.h>
 #include "auth.h"
+#include "bench.h"
 #include "client.h"
 #include "config.h"
 #include "cube.h"
@@ -25,6 +26,32 @@
 extern Model* g;
 
 int main(int argc, char **argv) {
+    // MIGRATE A WORLD TO BLOB STORAGE //
+    if (argc == 3 && strcmp(argv[1], "--migrate-blobs") == 0) {
+        db_enable();
+        if (db_init(argv[2])) {
+            return -1;
+        }
+        int result = db_migrate_blobs();
+        db_close();
+        return result;
+    }
+
+    // COMPARE STORAGE FORMATS //
+    if (argc == 3 && strcmp(argv[1], "--bench-storage") == 0) {
+        return bench_storage(argv[2]);
+    }
+
+    // COMPARE PROTOCOL VERSIONS //
+    if (argc == 2 && strcmp(argv[1], "--bench-protocol") == 0) {
+        return bench_protocol();
+    }
+
+    // COMPARE SERVER MESSAGE PARSERS //
+    if (argc >= 2 && argc <= 3 && strcmp(argv[1], "--bench-parser") == 0) {
+        return bench_parser(argc == 3 ? argv[2] : 0);
+    }
+
     // INITIALIZATION //
     curl_global_init(CURL_GLOBAL_DEFAULT);
     srand(time(NULL));
@@ -155,7 +182,11 @@ int main(int argc, char **argv) {
     g->create_radius = CREATE_CHUNK_RADIUS;
     g->render_radius = RENDER_CHUNK_RADIUS;
     g->delete_radius = DELETE_CHUNK_RADIUS;
+    g->prefetch_radius = PREFETCH_CHUNK_RADIUS;
     g->sign_radius = RENDER_SIGN_RADIUS;
+    g->upload_bytes = UPLOAD_BUDGET_BYTES;
+    g->upload_time = UPLOAD_BUDGET_TIME;
+    g->event_time = EVENT_BUDGET_TIME;
 
     // INITIALIZE WORKER THREADS
     for (int i = 0; i < WORKERS; i++) {
@@ -187,7 +218,7 @@ int main(int argc, char **argv) {
             client_enable();
             client_connect(g->server_addr, g->server_port);
             client_start();
-            client_version(1);
+            client_version(PROTO_VERSION);
             login();
         }
 
@@ -207,7 +238,7 @@ int main(int argc, char **argv) {
 
         // LOAD STATE FROM DATABASE //
         int loaded = db_load_state(&s->x, &s->y, &s->z, &s->rx, &s->ry);
-        force_chunks(me);
+        force_chunks(me, loaded ? 0 : SPAWN_CHUNK_TIMEOUT);
         if (!loaded) {
             s->y = highest_block(s->x, s->z) + 2;
         }
@@ -228,6 +259,7 @@ int main(int argc, char **argv) {
                 memset(&fps, 0, sizeof(fps));
             }
             update_fps(&fps);
+            g->force_time = 0;
             double now = glfwGetTime();
             double dt = now - previous;
             dt = MIN(dt, 0.2);
@@ -241,11 +273,7 @@ int main(int argc, char **argv) {
             handle_movement(dt);
 
             // HANDLE DATA FROM SERVER //
-            char *buffer = client_recv();
-            if (buffer) {
-                parse_buffer(buffer);
-                free(buffer);
-            }
+            apply_events();
 
             // FLUSH DATABASE //
             if (now - last_commit > COMMIT_INTERVAL) {
@@ -254,15 +282,15 @@ int main(int argc, char **argv) {
             }
 
             // SEND POSITION TO SERVER //
-            if (now - last_update > 0.1) {
+            if (send_position(me, now - last_update)) {
                 last_update = now;
-                client_position(s->x, s->y, s->z, s->rx, s->ry);
             }
 
             // PREPARE TO RENDER //
             g->observe1 = g->observe1 % g->player_count;
             g->observe2 = g->observe2 % g->player_count;
             delete_chunks();
+            upload_chunks();
             del_buffer(me->buffer);
             me->buffer = gen_player_buffer(s->x, s->y, s->z, s->rx, s->ry);
             for (int i = 1; i < g->player_count; i++) {
@@ -311,6 +339,39 @@ int main(int argc, char **argv) {
                 render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
+            if (SHOW_STATS_TEXT) {
+                snprintf(
+                    text_buffer, 1024,
+                    "force %.2fms (worst %.2fms) %d waits %d timeouts",
+                    g->force_time * 1000, g->force_worst * 1000,
+                    g->force_waits, g->force_timeouts);
+                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                ty -= ts * 2;
+                DbStats db_stats;
+                db_get_stats(&db_stats);
+                snprintf(
+                    text_buffer, 1024,
+                    "db %d queued (max %d) %d pending %d coalesced "
+                    "%.2fms write (max %.2fms) %.2fms latency (max %.2fms)",
+                    db_stats.queue_depth, db_stats.max_queue_depth,
+                    db_stats.pending, db_stats.coalesced,
+                    db_stats.write_time * 1000, db_stats.max_write_time * 1000,
+                    db_stats.latency * 1000, db_stats.max_latency * 1000);
+                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                ty -= ts * 2;
+                ClientStats client_stats;
+                client_get_stats(&client_stats);
+                snprintf(
+                    text_buffer, 1024,
+                    "net %d messages %d calls (%d saved) %d flushes "
+                    "%dkb sent %dkb received",
+                    client_stats.messages, client_stats.syscalls,
+                    client_stats.saved, client_stats.flushes,
+                    client_stats.bytes_sent / 1024,
+                    client_stats.bytes_received / 1024);
+                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                ty -= ts * 2;
+            }
             if (SHOW_CHAT_TEXT) {
                 for (int i = 0; i < MAX_MESSAGES; i++) {
                     int index = (g->message_index + i) % MAX_MESSAGES;
@@ -374,6 +435,12 @@ int main(int argc, char **argv) {
                 }
             }
 
+            // REQUEST LOADED CHUNKS FROM SERVER //
+            request_chunks(me);
+
+            // SEND EVERYTHING QUEUED THIS FRAME //
+            client_flush();
+
             // SWAP AND POLL //
             glfwSwapBuffers(g->window);
             glfwPollEvents();
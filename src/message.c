@@ -0,0 +1,213 @@
+#include <limits.h>
+#include <math.h>
+#include "message.h"
+
+static const char *formats[128] = {
+    ['B'] = "iiiiii",
+    ['C'] = "ii",
+    ['D'] = "i",
+    ['E'] = "di",
+    ['K'] = "iii",
+    ['L'] = "iiiiii",
+    ['N'] = "iw",
+    ['P'] = "ifffff",
+    ['R'] = "ii",
+    ['S'] = "iiiiiis",
+    ['T'] = "s",
+    ['U'] = "ifffff",
+};
+
+// what clients send to the server
+static const char *requests[128] = {
+    ['A'] = "s",
+    ['B'] = "iiii",
+    ['C'] = "iii",
+    ['L'] = "iiii",
+    ['P'] = "fffff",
+    ['S'] = "iiiis",
+    ['T'] = "s",
+    ['V'] = "i",
+    ['X'] = "ii",
+};
+
+static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int _message_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+        c == '\v' || c == '\f';
+}
+
+int _message_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+char *_message_sign(char *data, int *negative) {
+    while (_message_space(*data)) {
+        data++;
+    }
+    *negative = *data == '-';
+    if (*data == '-' || *data == '+') {
+        data++;
+    }
+    return data;
+}
+
+char *_message_int(char *data, int *value) {
+    int negative;
+    data = _message_sign(data, &negative);
+    if (!_message_digit(*data)) {
+        return 0;
+    }
+    long long n = 0;
+    while (_message_digit(*data)) {
+        n = n * 10 + (*data++ - '0');
+        if (n > (long long)INT_MAX + 1) {
+            return 0;
+        }
+    }
+    if (negative) {
+        n = -n;
+    }
+    if (n > INT_MAX) {
+        return 0;
+    }
+    *value = (int)n;
+    return data;
+}
+
+// digits past the eighteenth only scale the value, servers send at most
+// a handful of decimals
+char *_message_double(char *data, double *value) {
+    int negative;
+    data = _message_sign(data, &negative);
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    while (_message_digit(*data)) {
+        if (mantissa < 100000000000000000ULL) {
+            mantissa = mantissa * 10 + (*data - '0');
+        }
+        else {
+            exponent++;
+        }
+        data++;
+        digits++;
+    }
+    if (*data == '.') {
+        data++;
+        while (_message_digit(*data)) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (*data - '0');
+                exponent--;
+            }
+            data++;
+            digits++;
+        }
+    }
+    if (!digits) {
+        return 0;
+    }
+    if (*data == 'e' || *data == 'E') {
+        int exponent_negative;
+        char *end = _message_sign(data + 1, &exponent_negative);
+        if (_message_digit(*end)) {
+            int n = 0;
+            while (_message_digit(*end)) {
+                if (n < 10000) {
+                    n = n * 10 + (*end - '0');
+                }
+                end++;
+            }
+            exponent += exponent_negative ? -n : n;
+            data = end;
+        }
+    }
+    double result = (double)mantissa;
+    if (exponent >= 0 && exponent <= 22) {
+        result *= powers[exponent];
+    }
+    else if (exponent < 0 && exponent >= -22) {
+        result /= powers[-exponent];
+    }
+    else if (mantissa) {
+        result *= pow(10, exponent);
+    }
+    *value = negative ? -result : result;
+    return data;
+}
+
+int _message_parse(char *line, const char **table, Message *message) {
+    unsigned char type = line[0];
+    if (type >= 128 || !table[type] || line[1] != ',') {
+        return -1;
+    }
+    message->type = type;
+    message->count = 0;
+    message->text = 0;
+    char *data = line + 2;
+    double d = 0;
+    for (const char *field = table[type]; *field; field++) {
+        if (field != table[type]) {
+            if (*field == 's' && *data == '\0') {
+                message->text = data;
+                message->count++;
+                break;
+            }
+            if (*data != ',') {
+                return -1;
+            }
+            data++;
+        }
+        MessageField *value = message->fields + message->count;
+        switch (*field) {
+            case 'i':
+                data = _message_int(data, &value->i);
+                break;
+            case 'f':
+                data = _message_double(data, &d);
+                value->f = (float)d;
+                break;
+            case 'd':
+                data = _message_double(data, &value->d);
+                break;
+            case 'w':
+                while (_message_space(*data)) {
+                    data++;
+                }
+                message->text = data;
+                while (*data && !_message_space(*data)) {
+                    data++;
+                }
+                if (data == message->text) {
+                    return -1;
+                }
+                *data = '\0';
+                break;
+            case 's':
+                message->text = data;
+                while (*data) {
+                    data++;
+                }
+                break;
+        }
+        if (!data) {
+            return -1;
+        }
+        message->count++;
+    }
+    return 0;
+}
+
+// fills in the fields of a line in place, words and text are terminated
+// inside the line itself
+int message_parse(char *line, Message *message) {
+    return _message_parse(line, formats, message);
+}
+
+// the same for a line sent by a client
+int message_parse_request(char *line, Message *message) {
+    return _message_parse(line, requests, message);
+}
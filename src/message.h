@@ -0,0 +1,27 @@
+#ifndef _message_h_
+#define _message_h_
+
+// Version 1 lines are a tag and its comma separated fields. The fields of
+// every tag are listed in a table for each direction, one character per
+// field: i for an int, f for a float, d for a double, w for a word ending
+// at whitespace and s for the rest of the line, which may be empty.
+
+#define MESSAGE_FIELDS 7
+
+typedef union {
+    int i;
+    float f;
+    double d;
+} MessageField;
+
+typedef struct {
+    char type;
+    int count;
+    MessageField fields[MESSAGE_FIELDS];
+    char *text;
+} Message;
+
+int message_parse(char *line, Message *message);
+int message_parse_request(char *line, Message *message);
+
+#endif
@@ -0,0 +1,261 @@
+#include <math.h>
+#include <string.h>
+#include "config.h"
+#include "proto.h"
+
+void _proto_put_int(char *data, int value) {
+    unsigned int u = (unsigned int)value;
+    data[0] = u & 0xff;
+    data[1] = (u >> 8) & 0xff;
+    data[2] = (u >> 16) & 0xff;
+    data[3] = (u >> 24) & 0xff;
+}
+
+int _proto_get_int(const unsigned char *data) {
+    return (int)(data[0] | (data[1] << 8) | (data[2] << 16) |
+        ((unsigned int)data[3] << 24));
+}
+
+void _proto_put_float(char *data, float value) {
+    int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    _proto_put_int(data, bits);
+}
+
+float _proto_get_float(const unsigned char *data) {
+    int bits = _proto_get_int(data);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void _proto_header(char *data, char type, int size) {
+    _proto_put_int(data, size);
+    data[4] = type;
+}
+
+int _proto_ints(char *data, char type, const int *values, int count) {
+    _proto_header(data, type, count * 4);
+    for (int i = 0; i < count; i++) {
+        _proto_put_int(data + PROTO_HEADER_SIZE + i * 4, values[i]);
+    }
+    return PROTO_HEADER_SIZE + count * 4;
+}
+
+int proto_block(
+    char *data, char type, int p, int q, int x, int y, int z, int w)
+{
+    int values[6] = {p, q, x, y, z, w};
+    return _proto_ints(data, type, values, 6);
+}
+
+int proto_position(
+    char *data, int id, float x, float y, float z, float rx, float ry)
+{
+    _proto_header(data, 'P', 24);
+    char *payload = data + PROTO_HEADER_SIZE;
+    _proto_put_int(payload, id);
+    _proto_put_float(payload + 4, x);
+    _proto_put_float(payload + 8, y);
+    _proto_put_float(payload + 12, z);
+    _proto_put_float(payload + 16, rx);
+    _proto_put_float(payload + 20, ry);
+    return PROTO_POSITION_SIZE;
+}
+
+// Encodes the change from base to fixed, both quantized positions, or
+// returns -1 if it does not fit and a full position must be sent instead
+int proto_move(char *data, int id, const int *base, const int *fixed) {
+    _proto_header(data, 'M', 14);
+    char *payload = data + PROTO_HEADER_SIZE;
+    _proto_put_int(payload, id);
+    for (int i = 0; i < 5; i++) {
+        int delta = fixed[i] - base[i];
+        if (delta < -32768 || delta > 32767) {
+            return -1;
+        }
+        payload[4 + i * 2] = delta & 0xff;
+        payload[5 + i * 2] = (delta >> 8) & 0xff;
+    }
+    return PROTO_MOVE_SIZE;
+}
+
+int proto_key(char *data, int p, int q, int key) {
+    int values[3] = {p, q, key};
+    return _proto_ints(data, 'K', values, 3);
+}
+
+int proto_redraw(char *data, int p, int q) {
+    int values[2] = {p, q};
+    return _proto_ints(data, 'R', values, 2);
+}
+
+int proto_request(char *data, int p, int q, int key) {
+    int values[3] = {p, q, key};
+    return _proto_ints(data, 'C', values, 3);
+}
+
+// wraps a version 1 line, returns -1 if it does not fit in size bytes
+int proto_text(char *data, int size, const char *line) {
+    int length = strlen(line);
+    if (length && line[length - 1] == '\n') {
+        length--;
+    }
+    if (!length || PROTO_HEADER_SIZE + length > size) {
+        return -1;
+    }
+    _proto_header(data, line[0], length);
+    memcpy(data + PROTO_HEADER_SIZE, line, length);
+    return PROTO_HEADER_SIZE + length;
+}
+
+// x, y and z in 1/PROTO_POSITION_SCALE blocks, rx and ry in
+// 1/PROTO_ANGLE_SCALE radians, both ends keep quantized positions so that
+// moves add up to the same values
+void proto_quantize(const float *values, int *fixed) {
+    for (int i = 0; i < 5; i++) {
+        int scale = i < 3 ? PROTO_POSITION_SCALE : PROTO_ANGLE_SCALE;
+        fixed[i] = (int)lroundf(values[i] * scale);
+    }
+}
+
+void proto_dequantize(const int *fixed, float *values) {
+    for (int i = 0; i < 5; i++) {
+        int scale = i < 3 ? PROTO_POSITION_SCALE : PROTO_ANGLE_SCALE;
+        values[i] = (float)fixed[i] / scale;
+    }
+}
+
+int proto_chunk_size(int block_count, int light_count) {
+    return PROTO_HEADER_SIZE + PROTO_CHUNK_HEADER_SIZE +
+        (block_count + light_count) * PROTO_CHUNK_ENTRY_SIZE;
+}
+
+void _proto_chunk_entries(
+    char *data, int p, int q, const int *entries, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const int *e = entries + i * 4;
+        data[0] = e[0] - p * CHUNK_SIZE;
+        data[1] = e[1];
+        data[2] = e[2] - q * CHUNK_SIZE;
+        data[3] = e[3];
+        data += PROTO_CHUNK_ENTRY_SIZE;
+    }
+}
+
+// Encodes a chunk response, blocks and lights are x, y, z, w quadruples
+// inside the chunk. The caller keeps the total within PROTO_CHUNK_ENTRIES
+// and sends larger responses as several records, see proto_chunk_last.
+int proto_chunk(
+    char *data, int p, int q, int key,
+    const int *blocks, int block_count, const int *lights, int light_count)
+{
+    int size = proto_chunk_size(block_count, light_count);
+    _proto_header(data, 'C', size - PROTO_HEADER_SIZE);
+    char *payload = data + PROTO_HEADER_SIZE;
+    _proto_put_int(payload, p);
+    _proto_put_int(payload + 4, q);
+    _proto_put_int(payload + 8, key);
+    _proto_put_int(payload + 12, block_count);
+    _proto_put_int(payload + 16, light_count);
+    payload += PROTO_CHUNK_HEADER_SIZE;
+    _proto_chunk_entries(payload, p, q, blocks, block_count);
+    payload += block_count * PROTO_CHUNK_ENTRY_SIZE;
+    _proto_chunk_entries(payload, p, q, lights, light_count);
+    return size;
+}
+
+// Finds the frame at the start of data. Returns its total size, 0 if it
+// has not been fully received yet or -1 if the stream is corrupt.
+int proto_frame(const char *data, int length, ProtoFrame *frame) {
+    if (length < PROTO_HEADER_SIZE) {
+        return 0;
+    }
+    const unsigned char *bytes = (const unsigned char *)data;
+    int size = _proto_get_int(bytes);
+    if (size < 0 || size > PROTO_MAX_FRAME) {
+        return -1;
+    }
+    if (length < PROTO_HEADER_SIZE + size) {
+        return 0;
+    }
+    frame->type = data[4];
+    frame->size = size;
+    frame->data = bytes + PROTO_HEADER_SIZE;
+    return PROTO_HEADER_SIZE + size;
+}
+
+int proto_read_ints(const ProtoFrame *frame, int *values, int count) {
+    if (frame->size != count * 4) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        values[i] = _proto_get_int(frame->data + i * 4);
+    }
+    return 0;
+}
+
+// values receives x, y, z, rx and ry
+int proto_read_position(const ProtoFrame *frame, int *id, float *values) {
+    if (frame->size != 24) {
+        return -1;
+    }
+    *id = _proto_get_int(frame->data);
+    for (int i = 0; i < 5; i++) {
+        values[i] = _proto_get_float(frame->data + 4 + i * 4);
+    }
+    return 0;
+}
+
+int proto_read_move(const ProtoFrame *frame, int *id, int *deltas) {
+    if (frame->size != 14) {
+        return -1;
+    }
+    *id = _proto_get_int(frame->data);
+    for (int i = 0; i < 5; i++) {
+        const unsigned char *data = frame->data + 4 + i * 2;
+        deltas[i] = (short)(data[0] | (data[1] << 8));
+    }
+    return 0;
+}
+
+int proto_read_chunk(const ProtoFrame *frame, ProtoChunk *chunk) {
+    if (frame->size < PROTO_CHUNK_HEADER_SIZE) {
+        return -1;
+    }
+    const unsigned char *data = frame->data;
+    chunk->p = _proto_get_int(data);
+    chunk->q = _proto_get_int(data + 4);
+    chunk->key = _proto_get_int(data + 8);
+    chunk->block_count = _proto_get_int(data + 12);
+    chunk->light_count = _proto_get_int(data + 16);
+    if (chunk->block_count < 0 || chunk->light_count < 0 ||
+        chunk->block_count + chunk->light_count > PROTO_CHUNK_ENTRIES ||
+        proto_chunk_size(chunk->block_count, chunk->light_count) !=
+        PROTO_HEADER_SIZE + frame->size)
+    {
+        return -1;
+    }
+    chunk->blocks = data + PROTO_CHUNK_HEADER_SIZE;
+    chunk->lights =
+        chunk->blocks + chunk->block_count * PROTO_CHUNK_ENTRY_SIZE;
+    return 0;
+}
+
+// A response ends with its first record that is not full, so one that
+// fills its last record exactly is followed by an empty record
+int proto_chunk_last(const ProtoChunk *chunk) {
+    return chunk->block_count + chunk->light_count < PROTO_CHUNK_ENTRIES;
+}
+
+void proto_chunk_entry(
+    const ProtoChunk *chunk, const unsigned char *entries, int index,
+    int *x, int *y, int *z, int *w)
+{
+    const unsigned char *e = entries + index * PROTO_CHUNK_ENTRY_SIZE;
+    *x = chunk->p * CHUNK_SIZE + e[0];
+    *y = e[1];
+    *z = chunk->q * CHUNK_SIZE + e[2];
+    *w = (signed char)e[3];
+}
@@ -0,0 +1,70 @@
+#ifndef _proto_h_
+#define _proto_h_
+
+// Protocol version 2 frames. Every frame is a little-endian 32-bit payload
+// size and a type byte, followed by the payload. Blocks, lights, positions,
+// keys, redraws and chunk requests have fixed binary payloads, a chunk
+// response is one bulk record, and every other message is sent as its
+// version 1 line without the trailing newline. A position may also be sent
+// as a move, the quantized change from the last position sent for that
+// player, after a full position record with quantized values.
+
+#define PROTO_VERSION 2
+#define PROTO_HEADER_SIZE 5
+#define PROTO_MAX_FRAME (512 * 1024)
+#define PROTO_CHUNK_HEADER_SIZE 20
+#define PROTO_CHUNK_ENTRY_SIZE 4
+#define PROTO_CHUNK_ENTRIES 65536
+#define PROTO_POSITION_SCALE 64
+#define PROTO_ANGLE_SCALE 1024
+
+#define PROTO_BLOCK_SIZE (PROTO_HEADER_SIZE + 24)
+#define PROTO_POSITION_SIZE (PROTO_HEADER_SIZE + 24)
+#define PROTO_MOVE_SIZE (PROTO_HEADER_SIZE + 14)
+#define PROTO_KEY_SIZE (PROTO_HEADER_SIZE + 12)
+#define PROTO_REDRAW_SIZE (PROTO_HEADER_SIZE + 8)
+
+typedef struct {
+    char type;
+    int size;
+    const unsigned char *data;
+} ProtoFrame;
+
+typedef struct {
+    int p;
+    int q;
+    int key;
+    int block_count;
+    int light_count;
+    const unsigned char *blocks;
+    const unsigned char *lights;
+} ProtoChunk;
+
+int proto_block(
+    char *data, char type, int p, int q, int x, int y, int z, int w);
+int proto_position(
+    char *data, int id, float x, float y, float z, float rx, float ry);
+int proto_move(char *data, int id, const int *base, const int *fixed);
+int proto_key(char *data, int p, int q, int key);
+int proto_redraw(char *data, int p, int q);
+int proto_request(char *data, int p, int q, int key);
+int proto_text(char *data, int size, const char *line);
+int proto_chunk_size(int block_count, int light_count);
+int proto_chunk(
+    char *data, int p, int q, int key,
+    const int *blocks, int block_count, const int *lights, int light_count);
+
+void proto_quantize(const float *values, int *fixed);
+void proto_dequantize(const int *fixed, float *values);
+
+int proto_frame(const char *data, int length, ProtoFrame *frame);
+int proto_read_ints(const ProtoFrame *frame, int *values, int count);
+int proto_read_position(const ProtoFrame *frame, int *id, float *values);
+int proto_read_move(const ProtoFrame *frame, int *id, int *deltas);
+int proto_read_chunk(const ProtoFrame *frame, ProtoChunk *chunk);
+int proto_chunk_last(const ProtoChunk *chunk);
+void proto_chunk_entry(
+    const ProtoChunk *chunk, const unsigned char *entries, int index,
+    int *x, int *y, int *z, int *w);
+
+#endif
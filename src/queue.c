@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include "queue.h"
+
+// The producer index counts slots of the current segment in its low part
+// and segments in its high part. Offset QUEUE_SEGMENT_SIZE means that the
+// producer which took the last slot is still installing the next segment.
+#define QUEUE_LAP (QUEUE_SEGMENT_SIZE + 1)
+
+QueueSegment *queue_segment_alloc(Queue *queue) {
+    return (QueueSegment *)calloc(1,
+        sizeof(QueueSegment) + (size_t)QUEUE_SEGMENT_SIZE * queue->item_size);
+}
+
+void queue_alloc(Queue *queue, int item_size) {
+    queue->item_size = item_size;
+    queue->tail = 0;
+    queue->tail_segment = queue_segment_alloc(queue);
+    queue->head = 0;
+    queue->head_segment = queue->tail_segment;
+    queue->sleeping = 0;
+    mtx_init(&queue->mtx, mtx_plain);
+    cnd_init(&queue->cnd);
+}
+
+void queue_free(Queue *queue) {
+    QueueSegment *segment = queue->head_segment;
+    while (segment) {
+        QueueSegment *next = segment->next;
+        free(segment);
+        segment = next;
+    }
+    queue->head_segment = queue->tail_segment = 0;
+    cnd_destroy(&queue->cnd);
+    mtx_destroy(&queue->mtx);
+}
+
+void queue_put(Queue *queue, const void *item) {
+    QueueSegment *next = 0;
+    while (1) {
+        size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        size_t offset = tail % QUEUE_LAP;
+        if (offset == QUEUE_SEGMENT_SIZE) {
+            thrd_yield();
+            continue;
+        }
+        QueueSegment *segment =
+            __atomic_load_n(&queue->tail_segment, __ATOMIC_ACQUIRE);
+        if (offset + 1 == QUEUE_SEGMENT_SIZE && !next) {
+            next = queue_segment_alloc(queue);
+        }
+        if (!__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+        // the slot is ours, the segment can't be released before it's read
+        if (offset + 1 == QUEUE_SEGMENT_SIZE) {
+            __atomic_store_n(&queue->tail_segment, next, __ATOMIC_RELEASE);
+            __atomic_store_n(&queue->tail, tail + 2, __ATOMIC_RELEASE);
+            __atomic_store_n(&segment->next, next, __ATOMIC_RELEASE);
+            next = 0;
+        }
+        memcpy(segment->data + offset * queue->item_size, item,
+            queue->item_size);
+        __atomic_store_n(&segment->ready[offset], 1, __ATOMIC_RELEASE);
+        break;
+    }
+    free(next);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED)) {
+        mtx_lock(&queue->mtx);
+        __atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+        cnd_signal(&queue->cnd);
+        mtx_unlock(&queue->mtx);
+    }
+}
+
+int queue_ready(Queue *queue) {
+    QueueSegment *segment = queue->head_segment;
+    return __atomic_load_n(&segment->ready[queue->head], __ATOMIC_ACQUIRE);
+}
+
+int queue_get(Queue *queue, void *item) {
+    if (!queue_ready(queue)) {
+        return 0;
+    }
+    QueueSegment *segment = queue->head_segment;
+    int offset = queue->head;
+    memcpy(item, segment->data + (size_t)offset * queue->item_size,
+        queue->item_size);
+    if (offset + 1 == QUEUE_SEGMENT_SIZE) {
+        // the producer of the last slot linked the next segment before
+        // marking the slot ready
+        queue->head_segment =
+            __atomic_load_n(&segment->next, __ATOMIC_ACQUIRE);
+        queue->head = 0;
+        free(segment);
+    }
+    else {
+        queue->head = offset + 1;
+    }
+    return 1;
+}
+
+void queue_wait(Queue *queue, void *item) {
+    while (!queue_get(queue, item)) {
+        mtx_lock(&queue->mtx);
+        __atomic_store_n(&queue->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!queue_ready(queue)) {
+            while (__atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED)) {
+                cnd_wait(&queue->cnd, &queue->mtx);
+            }
+        }
+        __atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+        mtx_unlock(&queue->mtx);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef _queue_h_
+#define _queue_h_
+
+#include <stddef.h>
+#include "tinycthread.h"
+
+// Unbounded multi-producer single-consumer queue. Items are copied into
+// fixed size segments that are chained as the queue grows, so puts never
+// copy existing items and never take a lock. The consumer only parks on
+// the condition variable when it finds the queue empty and producers only
+// touch the mutex when the consumer is parked.
+
+#define QUEUE_SEGMENT_SIZE 1024
+
+typedef struct QueueSegment {
+    struct QueueSegment *next;
+    int ready[QUEUE_SEGMENT_SIZE];
+    char data[];
+} QueueSegment;
+
+typedef struct {
+    int item_size;
+    size_t tail;
+    QueueSegment *tail_segment;
+    int head;
+    QueueSegment *head_segment;
+    int sleeping;
+    mtx_t mtx;
+    cnd_t cnd;
+} Queue;
+
+QueueSegment *queue_segment_alloc(Queue *queue);
+void queue_alloc(Queue *queue, int item_size);
+void queue_free(Queue *queue);
+void queue_put(Queue *queue, const void *item);
+int queue_ready(Queue *queue);
+int queue_get(Queue *queue, void *item);
+void queue_wait(Queue *queue, void *item);
+
+#endif
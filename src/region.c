@@ -0,0 +1,517 @@
+// pread, pwrite, fsync and mmap
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "region.h"
+
+#ifndef _WIN32
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int _region_floor(int p) {
+    return p >= 0 ? p / REGION_SIZE : (p + 1) / REGION_SIZE - 1;
+}
+
+int _region_slot(RegionFile *file, int p, int q, int kind) {
+    int a = p - file->rp * REGION_SIZE;
+    int b = q - file->rq * REGION_SIZE;
+    return (a * REGION_SIZE + b) * REGION_KINDS + kind;
+}
+
+void _region_path(RegionStore *store, int rp, int rq, char *path, int size) {
+    snprintf(path, size, "%s/r.%d.%d.dat", store->path, rp, rq);
+}
+
+void _region_put_int(unsigned char *data, unsigned int value) {
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+    data[2] = (value >> 16) & 0xff;
+    data[3] = (value >> 24) & 0xff;
+}
+
+unsigned int _region_get_int(const unsigned char *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+        ((unsigned int)data[3] << 24);
+}
+
+int _region_write(int fd, const void *data, size_t size, size_t offset) {
+    const char *bytes = (const char *)data;
+    while (size) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        if (n <= 0) {
+            return -1;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+void _region_unmap(RegionFile *file) {
+    RegionMapping *mapping = file->retired;
+    while (mapping) {
+        RegionMapping *next = mapping->next;
+        munmap(mapping->data, mapping->size);
+        free(mapping);
+        mapping = next;
+    }
+    file->retired = 0;
+}
+
+// Maps at least size bytes, with room to grow so that appends rarely need
+// a new mapping. An old mapping stays valid until the readers still
+// decoding out of it are done, the caller holds the lock.
+int _region_map(RegionFile *file, size_t size, int force) {
+    if (!force && size <= file->mapped) {
+        return 0;
+    }
+    size_t mapped = size * 2;
+    if (mapped < REGION_COMPACT_SIZE) {
+        mapped = REGION_COMPACT_SIZE;
+    }
+    void *data = mmap(NULL, mapped, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    if (file->data && !file->readers) {
+        munmap(file->data, file->mapped);
+    }
+    else if (file->data) {
+        RegionMapping *mapping = malloc(sizeof(RegionMapping));
+        mapping->data = file->data;
+        mapping->size = file->mapped;
+        mapping->readers = file->readers;
+        mapping->next = file->retired;
+        file->retired = mapping;
+    }
+    file->data = (unsigned char *)data;
+    file->mapped = mapped;
+    file->readers = 0;
+    return 0;
+}
+
+int _region_attach(RegionStore *store, RegionFile *file, int create) {
+    char path[512];
+    _region_path(store, file->rp, file->rq, path, sizeof(path));
+    int fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    unsigned char *header = calloc(1, REGION_HEADER_SIZE);
+    size_t size = st.st_size;
+    if (size == 0) {
+        memcpy(header, "CRGN", 4);
+        _region_put_int(header + 4, REGION_VERSION);
+        if (_region_write(fd, header, REGION_HEADER_SIZE, 0)) {
+            free(header);
+            close(fd);
+            return -1;
+        }
+        size = REGION_HEADER_SIZE;
+    }
+    else if (size < REGION_HEADER_SIZE ||
+        pread(fd, header, REGION_HEADER_SIZE, 0) != REGION_HEADER_SIZE ||
+        memcmp(header, "CRGN", 4) ||
+        _region_get_int(header + 4) != REGION_VERSION)
+    {
+        fprintf(stderr, "invalid region file %s\n", path);
+        free(header);
+        close(fd);
+        return -1;
+    }
+    size_t live = REGION_HEADER_SIZE;
+    for (int i = 0; i < REGION_SLOTS; i++) {
+        RegionSlot *slot = file->slots + i;
+        slot->offset = _region_get_int(header + 8 + i * 8);
+        slot->size = _region_get_int(header + 12 + i * 8);
+        if (slot->offset + (size_t)slot->size > size) {
+            slot->offset = slot->size = 0;
+        }
+        live += slot->size;
+    }
+    free(header);
+    file->fd = fd;
+    file->size = size;
+    file->dead = size - live;
+    if (_region_map(file, size, 0)) {
+        close(fd);
+        file->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// looks up the file holding a chunk, regions without a file on disk are
+// remembered as empty until create is set, the caller holds the lock
+RegionFile *_region_file(RegionStore *store, int p, int q, int create) {
+    int rp = _region_floor(p);
+    int rq = _region_floor(q);
+    RegionFile *file = 0;
+    for (int i = 0; i < store->count; i++) {
+        RegionFile *other = store->files[i];
+        if (other->rp == rp && other->rq == rq) {
+            file = other;
+            break;
+        }
+    }
+    if (!file) {
+        if (store->count == store->capacity) {
+            store->capacity *= 2;
+            store->files = realloc(
+                store->files, sizeof(RegionFile *) * store->capacity);
+        }
+        file = calloc(1, sizeof(RegionFile));
+        file->rp = rp;
+        file->rq = rq;
+        file->fd = -1;
+        store->files[store->count++] = file;
+        _region_attach(store, file, 0);
+    }
+    if (file->fd < 0 && create) {
+        _region_attach(store, file, 1);
+    }
+    return file->fd < 0 ? 0 : file;
+}
+
+int region_store_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int region_store_open(RegionStore *store, const char *path) {
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        return -1;
+    }
+    strncpy(store->path, path, sizeof(store->path) - 1);
+    store->path[sizeof(store->path) - 1] = '\0';
+    store->count = 0;
+    store->capacity = 16;
+    store->files = malloc(sizeof(RegionFile *) * store->capacity);
+    mtx_init(&store->mtx, mtx_plain);
+    return 0;
+}
+
+void region_store_close(RegionStore *store) {
+    region_sync(store);
+    for (int i = 0; i < store->count; i++) {
+        RegionFile *file = store->files[i];
+        _region_unmap(file);
+        if (file->data) {
+            munmap(file->data, file->mapped);
+        }
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        free(file);
+    }
+    free(store->files);
+    store->files = 0;
+    store->count = 0;
+    mtx_destroy(&store->mtx);
+}
+
+// finds a chunk's payload, the pointer stays valid until it is released
+const unsigned char *_region_payload(
+    RegionStore *store, int p, int q, int kind, unsigned int *size)
+{
+    const unsigned char *data = 0;
+    *size = 0;
+    mtx_lock(&store->mtx);
+    RegionFile *file = _region_file(store, p, q, 0);
+    if (file) {
+        RegionSlot *slot = file->slots + _region_slot(file, p, q, kind);
+        if (slot->size) {
+            data = file->data + slot->offset;
+            *size = slot->size;
+            file->readers++;
+        }
+    }
+    mtx_unlock(&store->mtx);
+    return data;
+}
+
+// unmaps the retired mappings once the last reader of each is done
+void _region_release(
+    RegionStore *store, int p, int q, const unsigned char *data)
+{
+    mtx_lock(&store->mtx);
+    RegionFile *file = _region_file(store, p, q, 0);
+    if (data >= file->data && data < file->data + file->mapped) {
+        file->readers--;
+    }
+    else {
+        RegionMapping **link = &file->retired;
+        while (data < (*link)->data || data >= (*link)->data + (*link)->size) {
+            link = &(*link)->next;
+        }
+        RegionMapping *mapping = *link;
+        if (!--mapping->readers) {
+            *link = mapping->next;
+            munmap(mapping->data, mapping->size);
+            free(mapping);
+        }
+    }
+    mtx_unlock(&store->mtx);
+}
+
+int region_load(RegionStore *store, Map *map, int p, int q, int kind) {
+    unsigned int size;
+    const unsigned char *data = _region_payload(store, p, q, kind, &size);
+    if (!data) {
+        return 0;
+    }
+    int result = blob_load(map, p, q, data, size);
+    _region_release(store, p, q, data);
+    return result;
+}
+
+int region_read(RegionStore *store, Blob *blob, int kind) {
+    unsigned int size;
+    const unsigned char *data =
+        _region_payload(store, blob->p, blob->q, kind, &size);
+    if (!data) {
+        return 0;
+    }
+    int result = blob_decode(blob, data, size);
+    _region_release(store, blob->p, blob->q, data);
+    return result;
+}
+
+// Appends a chunk's payload and points its slot at it. Only the DB writer
+// calls this, readers see the new slot once the mapping covers it while
+// the file's table is only rewritten by region_sync.
+int region_save(RegionStore *store, Blob *blob, int kind) {
+    unsigned char *data;
+    int size;
+    if (blob_encode(blob, &data, &size)) {
+        return -1;
+    }
+    mtx_lock(&store->mtx);
+    RegionFile *file = _region_file(store, blob->p, blob->q, 1);
+    mtx_unlock(&store->mtx);
+    if (!file) {
+        free(data);
+        return -1;
+    }
+    int index = _region_slot(file, blob->p, blob->q, kind);
+    size_t offset = file->size;
+    if (_region_write(file->fd, data, size, offset)) {
+        free(data);
+        return -1;
+    }
+    free(data);
+    mtx_lock(&store->mtx);
+    int result = _region_map(file, offset + size, 0);
+    if (!result) {
+        RegionSlot *slot = file->slots + index;
+        file->dead += slot->size;
+        slot->offset = offset;
+        slot->size = size;
+        file->size = offset + size;
+        file->dirty = 1;
+    }
+    mtx_unlock(&store->mtx);
+    return result;
+}
+
+// rewrites a file with only the payloads its slots point at
+void _region_compact(RegionStore *store, RegionFile *file) {
+    char path[512];
+    char temp[520];
+    _region_path(store, file->rp, file->rq, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    int fd = open(temp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    unsigned char *header = calloc(1, REGION_HEADER_SIZE);
+    memcpy(header, "CRGN", 4);
+    _region_put_int(header + 4, REGION_VERSION);
+    RegionSlot *slots = malloc(sizeof(file->slots));
+    size_t size = REGION_HEADER_SIZE;
+    int error = 0;
+    for (int i = 0; i < REGION_SLOTS && !error; i++) {
+        RegionSlot *slot = file->slots + i;
+        slots[i].offset = slot->size ? size : 0;
+        slots[i].size = slot->size;
+        _region_put_int(header + 8 + i * 8, slots[i].offset);
+        _region_put_int(header + 12 + i * 8, slots[i].size);
+        if (slot->size) {
+            error = _region_write(
+                fd, file->data + slot->offset, slot->size, size);
+            size += slot->size;
+        }
+    }
+    if (!error) {
+        error = _region_write(fd, header, REGION_HEADER_SIZE, 0) ||
+            fsync(fd) || rename(temp, path);
+    }
+    free(header);
+    if (error) {
+        close(fd);
+        remove(temp);
+        free(slots);
+        return;
+    }
+    mtx_lock(&store->mtx);
+    int old = file->fd;
+    file->fd = fd;
+    if (_region_map(file, size, 1)) {
+        // keep reading the old, still complete, file contents
+        file->fd = old;
+        close(fd);
+    }
+    else {
+        close(old);
+        memcpy(file->slots, slots, sizeof(file->slots));
+        file->size = size;
+        file->dead = 0;
+    }
+    mtx_unlock(&store->mtx);
+    free(slots);
+}
+
+// Flushes the payloads appended since the last sync before pointing the
+// table on disk at them, so that a crash never leaves it pointing at
+// payloads that were not written out. Only the DB writer changes the
+// slots, so they are read here without the lock.
+int _region_flush(RegionFile *file) {
+    unsigned char *table = malloc(REGION_SLOTS * 8);
+    for (int i = 0; i < REGION_SLOTS; i++) {
+        _region_put_int(table + i * 8, file->slots[i].offset);
+        _region_put_int(table + i * 8 + 4, file->slots[i].size);
+    }
+    int error = fsync(file->fd) ||
+        _region_write(file->fd, table, REGION_SLOTS * 8, 8) ||
+        fsync(file->fd);
+    free(table);
+    return error;
+}
+
+// flushes the files written since the last sync, compacting the ones
+// that are mostly superseded payloads
+void region_sync(RegionStore *store) {
+    for (int i = 0; ; i++) {
+        // loads may add files and grow the list meanwhile
+        mtx_lock(&store->mtx);
+        RegionFile *file = i < store->count ? store->files[i] : 0;
+        mtx_unlock(&store->mtx);
+        if (!file) {
+            break;
+        }
+        if (!file->dirty) {
+            continue;
+        }
+        if (_region_flush(file)) {
+            continue;
+        }
+        file->dirty = 0;
+        if (file->size > REGION_COMPACT_SIZE && file->dead > file->size / 2) {
+            _region_compact(store, file);
+        }
+    }
+}
+
+// lists every chunk with a payload of the given kind, the caller frees
+// the returned pairs of p and q
+int region_chunks(RegionStore *store, int kind, int **chunks) {
+    int count = 0;
+    int capacity = 64;
+    int *result = malloc(sizeof(int) * 2 * capacity);
+    DIR *dir = opendir(store->path);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        int rp, rq, n = 0;
+        if (sscanf(entry->d_name, "r.%d.%d.dat%n", &rp, &rq, &n) != 2 ||
+            entry->d_name[n] != '\0')
+        {
+            continue;
+        }
+        mtx_lock(&store->mtx);
+        RegionFile *file = _region_file(
+            store, rp * REGION_SIZE, rq * REGION_SIZE, 0);
+        for (int a = 0; file && a < REGION_SIZE; a++) {
+            for (int b = 0; b < REGION_SIZE; b++) {
+                int p = rp * REGION_SIZE + a;
+                int q = rq * REGION_SIZE + b;
+                if (!file->slots[_region_slot(file, p, q, kind)].size) {
+                    continue;
+                }
+                if (count == capacity) {
+                    capacity *= 2;
+                    result = realloc(result, sizeof(int) * 2 * capacity);
+                }
+                result[count * 2] = p;
+                result[count * 2 + 1] = q;
+                count++;
+            }
+        }
+        mtx_unlock(&store->mtx);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    *chunks = result;
+    return count;
+}
+
+size_t region_file_size(RegionStore *store, int p, int q) {
+    mtx_lock(&store->mtx);
+    RegionFile *file = _region_file(store, p, q, 0);
+    size_t result = file ? file->size : 0;
+    mtx_unlock(&store->mtx);
+    return result;
+}
+
+#else
+
+int region_store_exists(const char *path) {
+    return 0;
+}
+
+int region_store_open(RegionStore *store, const char *path) {
+    fprintf(stderr, "region files are not supported on this platform\n");
+    return -1;
+}
+
+void region_store_close(RegionStore *store) {
+}
+
+int region_load(RegionStore *store, Map *map, int p, int q, int kind) {
+    return -1;
+}
+
+int region_read(RegionStore *store, Blob *blob, int kind) {
+    return -1;
+}
+
+int region_save(RegionStore *store, Blob *blob, int kind) {
+    return -1;
+}
+
+void region_sync(RegionStore *store) {
+}
+
+int region_chunks(RegionStore *store, int kind, int **chunks) {
+    *chunks = 0;
+    return 0;
+}
+
+size_t region_file_size(RegionStore *store, int p, int q) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _region_h_
+#define _region_h_
+
+#include <stddef.h>
+#include "blob.h"
+#include "map.h"
+#include "tinycthread.h"
+
+// World storage in region files of REGION_SIZE by REGION_SIZE chunks. Each
+// file starts with a table holding the offset and size of every chunk's
+// compressed block and light payloads. Payloads are only ever appended,
+// and the table on disk only points at them once region_sync has flushed
+// them. Readers decode them straight out of a shared mapping of the file,
+// and the file is rewritten without superseded payloads once they make up
+// most of it.
+
+#define REGION_SIZE 32
+#define REGION_VERSION 1
+#define REGION_BLOCKS 0
+#define REGION_LIGHTS 1
+#define REGION_KINDS 2
+#define REGION_SLOTS (REGION_SIZE * REGION_SIZE * REGION_KINDS)
+#define REGION_HEADER_SIZE (8 + REGION_SLOTS * 8)
+#define REGION_COMPACT_SIZE (1024 * 1024)
+
+typedef struct {
+    unsigned int offset;
+    unsigned int size;
+} RegionSlot;
+
+typedef struct RegionMapping {
+    struct RegionMapping *next;
+    unsigned char *data;
+    size_t size;
+    int readers;
+} RegionMapping;
+
+typedef struct {
+    int rp;
+    int rq;
+    int fd;
+    unsigned char *data;
+    size_t mapped;
+    int readers;
+    size_t size;
+    size_t dead;
+    int dirty;
+    RegionMapping *retired;
+    RegionSlot slots[REGION_SLOTS];
+} RegionFile;
+
+typedef struct {
+    char path[256];
+    RegionFile **files;
+    int count;
+    int capacity;
+    mtx_t mtx;
+} RegionStore;
+
+int region_store_exists(const char *path);
+int region_store_open(RegionStore *store, const char *path);
+void region_store_close(RegionStore *store);
+int region_load(RegionStore *store, Map *map, int p, int q, int kind);
+int region_read(RegionStore *store, Blob *blob, int kind);
+int region_save(RegionStore *store, Blob *blob, int kind);
+void region_sync(RegionStore *store);
+int region_chunks(RegionStore *store, int kind, int **chunks);
+size_t region_file_size(RegionStore *store, int p, int q);
+
+#endif
@@ -5,6 +5,10 @@ typedef enum {
     BLOCK,
     LIGHT,
     KEY,
+    SIGN,
+    DELETE_SIGN,
+    DELETE_SIGNS,
+    DELETE_ALL_SIGNS,
     COMMIT,
     EXIT
 } RingEntryType;
@@ -18,6 +22,7 @@ typedef struct {
     int z;
     int w;
     int key;
+    char *text;
 } RingEntry;
 
 typedef struct {
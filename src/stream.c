@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include "proto.h"
+#include "stream.h"
+
+void stream_alloc(Stream *stream, int capacity) {
+    stream->data = (char *)malloc(capacity);
+    stream->capacity = capacity;
+    stream->start = 0;
+    stream->size = 0;
+    stream->spill = 0;
+    stream->spill_capacity = 0;
+}
+
+void stream_free(Stream *stream) {
+    free(stream->data);
+    free(stream->spill);
+    stream->data = 0;
+    stream->spill = 0;
+}
+
+// the contiguous free space after the stored bytes, it stays free until
+// it is committed however the reader consumes in the meantime
+int stream_space(Stream *stream, char **data) {
+    int end = stream->start + stream->size;
+    if (end < stream->capacity) {
+        *data = stream->data + end;
+        return stream->capacity - end;
+    }
+    end -= stream->capacity;
+    *data = stream->data + end;
+    return stream->start - end;
+}
+
+void stream_commit(Stream *stream, int length) {
+    stream->size += length;
+}
+
+void stream_consume(Stream *stream, int length) {
+    stream->start = (stream->start + length) % stream->capacity;
+    stream->size -= length;
+}
+
+// unwraps the stored bytes into a larger ring, only while nothing is
+// borrowed and no space is being written
+void stream_grow(Stream *stream, int capacity) {
+    char *data = (char *)malloc(capacity);
+    int first = stream->capacity - stream->start;
+    if (first > stream->size) {
+        first = stream->size;
+    }
+    memcpy(data, stream->data + stream->start, first);
+    memcpy(data + first, stream->data, stream->size - first);
+    free(stream->data);
+    stream->data = data;
+    stream->capacity = capacity;
+    stream->start = 0;
+}
+
+// copies the first length bytes, which wrap around the end, to the spill
+char *_stream_gather(Stream *stream, int length) {
+    if (length > stream->spill_capacity) {
+        stream->spill_capacity = length * 2;
+        stream->spill = (char *)realloc(stream->spill, stream->spill_capacity);
+    }
+    int first = stream->capacity - stream->start;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(stream->spill, stream->data + stream->start, first);
+    memcpy(stream->spill + first, stream->data, length - first);
+    return stream->spill;
+}
+
+int _stream_contiguous(Stream *stream) {
+    int contiguous = stream->capacity - stream->start;
+    return contiguous < stream->size ? contiguous : stream->size;
+}
+
+// Returns the complete lines at the front and their length, or 0 if there
+// is no complete line yet
+char *stream_lines(Stream *stream, int *length) {
+    int contiguous = _stream_contiguous(stream);
+    char *data = stream->data + stream->start;
+    *length = contiguous;
+    while (*length > 0 && data[*length - 1] != '\n') {
+        (*length)--;
+    }
+    if (*length) {
+        return data;
+    }
+    if (contiguous == stream->size) {
+        return 0;
+    }
+    // the first line wraps around the end
+    char *end = memchr(stream->data, '\n', stream->size - contiguous);
+    if (!end) {
+        return 0;
+    }
+    *length = contiguous + (end - stream->data) + 1;
+    return _stream_gather(stream, *length);
+}
+
+// Returns the complete frames at the front and their length, or 0 if there
+// is no complete frame yet, *length is -1 if the next frame is corrupt
+char *stream_frames(Stream *stream, int *length) {
+    int contiguous = _stream_contiguous(stream);
+    char *data = stream->data + stream->start;
+    ProtoFrame frame;
+    int size = 0;
+    int n;
+    while ((n = proto_frame(data + size, contiguous - size, &frame)) > 0) {
+        size += n;
+    }
+    *length = size;
+    if (size) {
+        return data;
+    }
+    if (n < 0) {
+        *length = -1;
+        return 0;
+    }
+    if (contiguous == stream->size || stream->size < PROTO_HEADER_SIZE) {
+        return 0;
+    }
+    // the first frame wraps around the end, its header may too
+    n = proto_frame(
+        _stream_gather(stream, PROTO_HEADER_SIZE), stream->size, &frame);
+    if (n <= 0) {
+        *length = n;
+        return 0;
+    }
+    *length = n;
+    return _stream_gather(stream, n);
+}
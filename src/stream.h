@@ -0,0 +1,28 @@
+#ifndef _stream_h_
+#define _stream_h_
+
+// A growable ring of received bytes. The receiving thread reads straight
+// into the free space after the stored bytes, and the reader borrows the
+// complete lines or frames at the front in place. Only a message that
+// wraps around the end of the ring is copied, into a spill buffer, so the
+// reader always gets one contiguous span. The caller does the locking.
+
+typedef struct {
+    char *data;
+    int capacity;
+    int start;
+    int size;
+    char *spill;
+    int spill_capacity;
+} Stream;
+
+void stream_alloc(Stream *stream, int capacity);
+void stream_free(Stream *stream);
+int stream_space(Stream *stream, char **data);
+void stream_commit(Stream *stream, int length);
+void stream_consume(Stream *stream, int length);
+void stream_grow(Stream *stream, int capacity);
+char *stream_lines(Stream *stream, int *length);
+char *stream_frames(Stream *stream, int *length);
+
+#endif
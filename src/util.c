@@ -66,6 +66,27 @@ GLuint gen_faces(int components, int faces, GLfloat *data) {
     return buffer;
 }
 
+// Re-specifies the storage of an existing buffer instead of allocating a
+// new buffer object. The NULL upload orphans the old storage so the driver
+// does not stall on draws that still reference it.
+GLuint update_buffer(GLuint buffer, GLsizei size, GLfloat *data) {
+    if (!buffer) {
+        return gen_buffer(size, data);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
+
+GLuint update_faces(GLuint buffer, int components, int faces, GLfloat *data) {
+    buffer = update_buffer(
+        buffer, sizeof(GLfloat) * 6 * components * faces, data);
+    free(data);
+    return buffer;
+}
+
 GLuint make_shader(GLenum type, const char *source) {
     GLuint shader = glCreateShader(type);
     glShaderSource(shader, 1, &source, NULL);
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../src/blob.h"
+#include "../src/config.h"
+
+#include <CUnit/CUnit.h>
+#include "blob_test.h"
+
+static void set_rejects_positions_outside_chunk() {
+    Blob blob;
+    blob_alloc(&blob, 1, 2);
+
+    CU_ASSERT(blob_set(&blob, CHUNK_SIZE - 1, 10, CHUNK_SIZE * 2 - 1, 1));
+    CU_ASSERT(blob_set(&blob, CHUNK_SIZE * 2, 10, CHUNK_SIZE * 3, 1));
+    CU_ASSERT_FALSE(blob_set(&blob, CHUNK_SIZE - 2, 10, CHUNK_SIZE * 2, 1));
+    CU_ASSERT_FALSE(blob_set(&blob, CHUNK_SIZE, 256, CHUNK_SIZE * 2, 1));
+    CU_ASSERT_FALSE(blob_set(&blob, CHUNK_SIZE, -1, CHUNK_SIZE * 2, 1));
+    CU_ASSERT(blob.size == 2);
+
+    blob_free(&blob);
+}
+
+static void compact_keeps_last_write() {
+    Blob blob;
+    blob_alloc(&blob, 0, 0);
+
+    blob_set(&blob, 5, 20, 5, 1);
+    blob_set(&blob, 3, 20, 5, 2);
+    blob_set(&blob, 5, 20, 5, 3);
+    blob_set(&blob, 5, 20, 5, 0);
+    blob_compact(&blob);
+
+    CU_ASSERT(blob.size == 2);
+    CU_ASSERT(blob.data[0].w == 2);
+    CU_ASSERT(blob.data[1].w == 0);
+
+    blob_set(&blob, 3, 20, 5, 7);
+    blob_compact(&blob);
+    CU_ASSERT(blob.size == 2);
+    CU_ASSERT(blob.data[0].w == 7);
+
+    blob_free(&blob);
+}
+
+static void encode_decode_round_trip() {
+    Blob blob;
+    blob_alloc(&blob, -3, 4);
+    int ox = -3 * CHUNK_SIZE;
+    int oz = 4 * CHUNK_SIZE;
+    for (int y = 0; y < 256; y += 3) {
+        for (int x = -1; x <= CHUNK_SIZE; x++) {
+            blob_set(&blob, ox + x, y, oz + (x * 7 + y) % CHUNK_SIZE,
+                (x + y) % 3 - 1);
+        }
+    }
+    blob_compact(&blob);
+    int expected = blob.size;
+
+    unsigned char *data;
+    int size;
+    CU_ASSERT(blob_encode(&blob, &data, &size) == 0);
+
+    Blob other;
+    blob_alloc(&other, -3, 4);
+    CU_ASSERT(blob_decode(&other, data, size) == 0);
+    CU_ASSERT(other.size == expected);
+    int same = other.size == blob.size;
+    for (unsigned int i = 0; same && i < other.size; i++) {
+        same = other.data[i].key == blob.data[i].key &&
+            other.data[i].w == blob.data[i].w;
+    }
+    CU_ASSERT(same);
+
+    free(data);
+    blob_free(&other);
+    blob_free(&blob);
+}
+
+static void load_writes_into_map() {
+    Blob blob;
+    blob_alloc(&blob, 1, 1);
+    blob_set(&blob, CHUNK_SIZE + 1, 12, CHUNK_SIZE + 2, 5);
+    blob_set(&blob, CHUNK_SIZE + 3, 12, CHUNK_SIZE + 2, -5);
+    blob_set(&blob, CHUNK_SIZE + 4, 12, CHUNK_SIZE + 2, 0);
+
+    unsigned char *data;
+    int size;
+    blob_encode(&blob, &data, &size);
+
+    Map map;
+    map_alloc(&map, CHUNK_SIZE - 1, 0, CHUNK_SIZE - 1, 0x7fff);
+    map_set(&map, CHUNK_SIZE + 4, 12, CHUNK_SIZE + 2, 9);
+    CU_ASSERT(blob_load(&map, 1, 1, data, size) == 0);
+    CU_ASSERT(map_get(&map, CHUNK_SIZE + 1, 12, CHUNK_SIZE + 2) == 5);
+    CU_ASSERT(map_get(&map, CHUNK_SIZE + 3, 12, CHUNK_SIZE + 2) == -5);
+    CU_ASSERT(map_get(&map, CHUNK_SIZE + 4, 12, CHUNK_SIZE + 2) == 0);
+
+    free(data);
+    map_free(&map);
+    blob_free(&blob);
+}
+
+static void decode_rejects_bad_data() {
+    Blob blob;
+    blob_alloc(&blob, 0, 0);
+    blob_set(&blob, 1, 1, 1, 1);
+
+    unsigned char *data;
+    int size;
+    blob_encode(&blob, &data, &size);
+
+    Blob other;
+    blob_alloc(&other, 0, 0);
+    data[2] = BLOB_VERSION + 1;
+    CU_ASSERT(blob_decode(&other, data, size) != 0);
+    data[2] = BLOB_VERSION;
+    CU_ASSERT(blob_decode(&other, data, size - 4) != 0);
+    CU_ASSERT(blob_decode(&other, data, 4) != 0);
+    CU_ASSERT(blob_decode(&other, data, size) == 0);
+    CU_ASSERT(other.size == 1);
+
+    free(data);
+    blob_free(&other);
+    blob_free(&blob);
+}
+
+static void trim_drops_border_entries() {
+    Blob blob;
+    blob_alloc(&blob, 1, -1);
+    int ox = CHUNK_SIZE;
+    int oz = -CHUNK_SIZE;
+    blob_set(&blob, ox - 1, 10, oz + 3, -4);
+    blob_set(&blob, ox + 3, 10, oz + CHUNK_SIZE, -4);
+    blob_set(&blob, ox, 10, oz, 4);
+    blob_set(&blob, ox + CHUNK_SIZE - 1, 11, oz + CHUNK_SIZE - 1, 5);
+    blob_compact(&blob);
+
+    CU_ASSERT(blob_trim(&blob) == 2);
+    CU_ASSERT(blob.size == 2);
+    CU_ASSERT(blob.data[0].w == 4);
+    CU_ASSERT(blob.data[1].w == 5);
+    CU_ASSERT(blob_trim(&blob) == 0);
+
+    blob_free(&blob);
+}
+
+static CU_TestInfo blob_tests[] = {
+    {"positions outside the chunk are rejected", set_rejects_positions_outside_chunk},
+    {"compacting keeps the last write", compact_keeps_last_write},
+    {"encoded blobs decode to the same entries", encode_decode_round_trip},
+    {"loading writes straight into a map", load_writes_into_map},
+    {"bad versions and truncated data are rejected", decode_rejects_bad_data},
+    {"trimming drops the border around the chunk", trim_drops_border_entries},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"blob suite", NULL, NULL, NULL, NULL, blob_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void BlobTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
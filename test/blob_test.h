@@ -0,0 +1,7 @@
+#ifndef __BLOB_TEST_H__
+#define __BLOB_TEST_H__
+
+void BlobTest_AddTests();
+
+
+#endif /* __BLOB_TEST_H__ */
@@ -15,6 +15,17 @@
 #include "item_test_mutant.h"
 #include "ring_test.h"
 #include "sign_test.h"
+#include "queue_test.h"
+#include "blob_test.h"
+#include "region_test.h"
+#include "db_test.h"
+#include "proto_test.h"
+#include "message_test.h"
+#include "stream_test.h"
+#include "event_test.h"
+#ifdef __linux__
+#include "server_test.h"
+#endif
 
 
 
@@ -34,6 +45,17 @@ void AddAllTests() {
 	SignTest_AddTests();
 	ItemTestMutant_AddTests();
 	MapTest_AddTests();
+	QueueTest_AddTests();
+	BlobTest_AddTests();
+	RegionTest_AddTests();
+	DbTest_AddTests();
+	ProtoTest_AddTests();
+	MessageTest_AddTests();
+	StreamTest_AddTests();
+	EventTest_AddTests();
+#ifdef __linux__
+	ServerTest_AddTests();
+#endif
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "../src/db.h"
+#include "../src/config.h"
+#include "../deps/sqlite/sqlite3.h"
+
+#include <CUnit/CUnit.h>
+#include "db_test.h"
+
+#define TEST_PATH "db_test.tmp.db"
+
+static int configured_format() {
+    return DB_REGION_STORAGE ? DB_FORMAT_REGIONS :
+        DB_BLOB_STORAGE ? DB_FORMAT_BLOBS : DB_FORMAT_ROWS;
+}
+
+static int stored_format() {
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    int result = -1;
+    if (sqlite3_open(TEST_PATH, &db) == 0 &&
+        sqlite3_prepare_v2(db, "pragma user_version;", -1, &stmt, NULL) == 0)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            result = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return result;
+}
+
+static void remove_world() {
+    remove(TEST_PATH);
+    remove(TEST_PATH "-wal");
+    remove(TEST_PATH "-shm");
+    remove(TEST_PATH ".regions/r.0.0.dat");
+    remove(TEST_PATH ".regions");
+}
+
+// writes a block, then reads it back after opening the world again
+static int block_survives_reopening() {
+    Map map;
+    db_enable();
+    if (db_init(TEST_PATH)) {
+        return 0;
+    }
+    db_insert_block(0, 0, 1, 10, 1, 5);
+    db_commit();
+    db_close();
+    if (db_init(TEST_PATH)) {
+        return 0;
+    }
+    map_alloc(&map, -1, 0, -1, 0x7fff);
+    db_load_blocks(&map, 0, 0);
+    int result = map_get(&map, 1, 10, 1) == 5;
+    map_free(&map);
+    db_close();
+    db_disable();
+    return result;
+}
+
+static void region_directory_selects_region_storage() {
+#ifndef _WIN32
+    remove_world();
+    CU_ASSERT_FATAL(mkdir(TEST_PATH ".regions", 0755) == 0);
+    CU_ASSERT(block_survives_reopening());
+    CU_ASSERT(stored_format() == DB_FORMAT_REGIONS);
+    struct stat st;
+    CU_ASSERT(stat(TEST_PATH ".regions/r.0.0.dat", &st) == 0);
+    remove_world();
+#endif
+}
+
+static void other_worlds_get_the_configured_format() {
+    remove_world();
+    CU_ASSERT(block_survives_reopening());
+    CU_ASSERT(stored_format() == configured_format());
+    remove_world();
+}
+
+static CU_TestInfo db_tests[] = {
+    {"region directory selects region storage",
+        region_directory_selects_region_storage},
+    {"other worlds get the configured format",
+        other_worlds_get_the_configured_format},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"db suite", NULL, NULL, NULL, NULL, db_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void DbTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef __DB_TEST_H__
+#define __DB_TEST_H__
+
+void DbTest_AddTests();
+
+
+#endif /* __DB_TEST_H__ */
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/event.h"
+
+#include <CUnit/CUnit.h>
+#include "event_test.h"
+
+static void lines_own_their_text() {
+    char line[] = "S,0,0,3,40,5,1,hello, world";
+    Event event;
+    CU_ASSERT(event_line(line, &event) == 0);
+    CU_ASSERT(event.type == 'S');
+    CU_ASSERT(event.fields[2].i == 3 && event.fields[5].i == 1);
+    memset(line, 0, sizeof(line));
+    CU_ASSERT(strcmp(event.text, "hello, world") == 0);
+    event_free(&event);
+
+    char block[] = "B,1,2,33,40,50,7";
+    CU_ASSERT(event_line(block, &event) == 0);
+    CU_ASSERT(event.text == 0 && event.data == 0);
+    CU_ASSERT(event.fields[4].i == 50);
+    event_free(&event);
+
+    char end[] = "C,-4,9";
+    CU_ASSERT(event_line(end, &event) == 0);
+    CU_ASSERT(event.chunk.p == -4 && event.chunk.q == 9);
+    CU_ASSERT(event.chunk.block_count == 0 && event.chunk.key == 0);
+    CU_ASSERT(proto_chunk_last(&event.chunk));
+    event_free(&event);
+
+    char bad[] = "B,1,2";
+    CU_ASSERT(event_line(bad, &event) == -1);
+}
+
+static void frames_fill_the_same_fields() {
+    char data[64];
+    ProtoFrame frame;
+    Event event;
+
+    proto_position(data, 9, 1.5f, 2.5f, 3.5f, 0.25f, -0.5f);
+    CU_ASSERT(proto_frame(data, sizeof(data), &frame) > 0);
+    CU_ASSERT(event_frame(&frame, &event) == 0);
+    CU_ASSERT(event.type == 'P' && event.fields[0].i == 9);
+    CU_ASSERT(event.fields[1].f == 1.5f && event.fields[5].f == -0.5f);
+    event_free(&event);
+
+    proto_redraw(data, -3, 4);
+    CU_ASSERT(proto_frame(data, sizeof(data), &frame) > 0);
+    CU_ASSERT(event_frame(&frame, &event) == 0);
+    CU_ASSERT(event.type == 'R');
+    CU_ASSERT(event.fields[0].i == -3 && event.fields[1].i == 4);
+
+    int length = proto_text(data, sizeof(data), "N,4,guest4\n");
+    CU_ASSERT(proto_frame(data, length, &frame) == length);
+    CU_ASSERT(event_frame(&frame, &event) == 0);
+    memset(data, 0, sizeof(data));
+    CU_ASSERT(event.type == 'N' && event.fields[0].i == 4);
+    CU_ASSERT(strcmp(event.text, "guest4") == 0);
+    event_free(&event);
+}
+
+static void chunks_are_copied() {
+    int blocks[] = {-31, 10, 33, 5, -1, 255, 63, -7};
+    int lights[] = {-20, 12, 40, 15};
+    char *data = malloc(proto_chunk_size(2, 1));
+    int length = proto_chunk(data, -1, 1, 42, blocks, 2, lights, 1);
+    ProtoFrame frame;
+    Event event;
+    CU_ASSERT(proto_frame(data, length, &frame) == length);
+    CU_ASSERT(event_frame(&frame, &event) == 0);
+    free(data);
+    CU_ASSERT(event.type == 'C');
+    CU_ASSERT(event.chunk.p == -1 && event.chunk.q == 1);
+    CU_ASSERT(event.chunk.key == 42);
+    CU_ASSERT(event.chunk.block_count == 2 && event.chunk.light_count == 1);
+    int x, y, z, w;
+    proto_chunk_entry(&event.chunk, event.chunk.blocks, 1, &x, &y, &z, &w);
+    CU_ASSERT(x == -1 && y == 255 && z == 63 && w == -7);
+    proto_chunk_entry(&event.chunk, event.chunk.lights, 0, &x, &y, &z, &w);
+    CU_ASSERT(x == -20 && y == 12 && z == 40 && w == 15);
+    event_free(&event);
+}
+
+static CU_TestInfo event_tests[] = {
+    {"lines keep a copy of their text", lines_own_their_text},
+    {"frames fill the same fields as lines", frames_fill_the_same_fields},
+    {"chunk entries outlive the frame", chunks_are_copied},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"event suite", NULL, NULL, NULL, NULL, event_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void EventTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef __EVENT_TEST_H__
+#define __EVENT_TEST_H__
+
+void EventTest_AddTests();
+
+
+#endif /* __EVENT_TEST_H__ */
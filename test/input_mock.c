@@ -145,7 +145,10 @@ static int Setup() {
     g->create_radius = CREATE_CHUNK_RADIUS;
     g->render_radius = RENDER_CHUNK_RADIUS;
     g->delete_radius = DELETE_CHUNK_RADIUS;
+    g->prefetch_radius = PREFETCH_CHUNK_RADIUS;
     g->sign_radius = RENDER_SIGN_RADIUS;
+    g->upload_bytes = UPLOAD_BUDGET_BYTES;
+    g->upload_time = UPLOAD_BUDGET_TIME;
 
     // INITIALIZE WORKER THREADS
     for (int i = 0; i < WORKERS; i++) {
@@ -195,7 +198,7 @@ static int Setup() {
 
     // LOAD STATE FROM DATABASE //
     int loaded = db_load_state(&s->x, &s->y, &s->z, &s->rx, &s->ry);
-    force_chunks(me);
+    force_chunks(me, loaded ? 0 : SPAWN_CHUNK_TIMEOUT);
     if (!loaded) {
         s->y = highest_block(s->x, s->z) + 2;
     }
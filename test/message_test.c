@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/message.h"
+
+#include <CUnit/CUnit.h>
+#include "message_test.h"
+
+static int parse(const char *text, Message *message) {
+    static char line[256];
+    snprintf(line, sizeof(line), "%s", text);
+    return message_parse(line, message);
+}
+
+static void fields_are_typed_by_tag() {
+    Message m;
+    CU_ASSERT(parse("B,-2,3,-40,200,100,15", &m) == 0);
+    CU_ASSERT(m.type == 'B' && m.count == 6);
+    CU_ASSERT(m.fields[0].i == -2 && m.fields[1].i == 3);
+    CU_ASSERT(m.fields[2].i == -40 && m.fields[5].i == 15);
+
+    CU_ASSERT(parse("P,7,1.50,-2.25,1e2,0.5,-0.125", &m) == 0);
+    CU_ASSERT(m.type == 'P' && m.count == 6 && m.fields[0].i == 7);
+    CU_ASSERT(m.fields[1].f == 1.5f && m.fields[2].f == -2.25f);
+    CU_ASSERT(m.fields[3].f == 100.0f && m.fields[5].f == -0.125f);
+
+    CU_ASSERT(parse("E,1792427507.99,600", &m) == 0);
+    CU_ASSERT(m.fields[0].d == 1792427507.99 && m.fields[1].i == 600);
+
+    CU_ASSERT(parse("K,-2147483648,2147483647,0", &m) == 0);
+    CU_ASSERT(m.fields[0].i == -2147483647 - 1);
+    CU_ASSERT(m.fields[1].i == 2147483647);
+}
+
+static void text_fields_end_the_line() {
+    Message m;
+    CU_ASSERT(parse("T,hello, world", &m) == 0);
+    CU_ASSERT(strcmp(m.text, "hello, world") == 0);
+    CU_ASSERT(parse("T,", &m) == 0);
+    CU_ASSERT(strcmp(m.text, "") == 0);
+
+    CU_ASSERT(parse("S,0,0,1,20,1,2,a sign", &m) == 0);
+    CU_ASSERT(m.count == 7 && m.fields[5].i == 2);
+    CU_ASSERT(strcmp(m.text, "a sign") == 0);
+    CU_ASSERT(parse("S,0,0,1,20,1,2", &m) == 0);
+    CU_ASSERT(strcmp(m.text, "") == 0);
+
+    CU_ASSERT(parse("N,3,guest3 trailing", &m) == 0);
+    CU_ASSERT(m.fields[0].i == 3);
+    CU_ASSERT(strcmp(m.text, "guest3") == 0);
+}
+
+static void matches_scanf() {
+    const char *lines[] = {
+        "U,1,0,0,0,0,0",
+        "U,12,-3.5,70.25,1e-05,6.28,-1.57",
+        "P,4, 1.25,+2,3.,.5,-0",
+        "P,4,123456.789,0.000001,99999999999999999999,1E3,2.5e+2",
+    };
+    for (int i = 0; i < 4; i++) {
+        Message m;
+        int id;
+        float v[5];
+        CU_ASSERT(sscanf(lines[i] + 1, ",%d,%f,%f,%f,%f,%f",
+            &id, v, v + 1, v + 2, v + 3, v + 4) == 6);
+        CU_ASSERT(parse(lines[i], &m) == 0);
+        CU_ASSERT(m.fields[0].i == id);
+        for (int j = 0; j < 5; j++) {
+            CU_ASSERT(m.fields[j + 1].f == v[j]);
+        }
+    }
+}
+
+static void malformed_lines_fail() {
+    const char *lines[] = {
+        "", "B", "B,", "B,1,2,3", "B,1,2,x,4,5,6", "B1,2,3,4,5,6,7",
+        "Q,1,2", "D,", "D,-", "K,2147483648,0,0", "K,1,,2", "P,1,.,0,0,0,0",
+        "P,1,e5,0,0,0,0", "N,1,", "N,1", "T", "S,1,2,3,4,5",
+        "S,1,2,3,4,5,6x", "E,abc,600", "\x80,1",
+    };
+    int count = sizeof(lines) / sizeof(lines[0]);
+    for (int i = 0; i < count; i++) {
+        Message m;
+        CU_ASSERT(parse(lines[i], &m) == -1);
+    }
+}
+
+// random edits of valid lines, the parser must stay inside each line
+static void mutated_lines_stay_in_bounds() {
+    const char *seeds[] = {
+        "B,-2,3,-40,200,100,15", "P,7,1.50,-2.25,1e2,0.5,-0.125",
+        "E,1792427507.99,600", "S,0,0,1,20,1,2,a sign", "N,3,guest3",
+        "T,hello", "K,1,2,3", "R,-1,1", "D,5",
+    };
+    const char alphabet[] = "0123456789,.-+eE BLPSNTKRDUx \t";
+    srand(42);
+    for (int i = 0; i < 20000; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "%s", seeds[i % 9]);
+        int length = strlen(line);
+        for (int edits = 1 + rand() % 4; edits; edits--) {
+            int at = rand() % (length + 1);
+            switch (rand() % 3) {
+                case 0:
+                    if (length < 60) {
+                        memmove(line + at + 1, line + at, length - at + 1);
+                        line[at] = alphabet[rand() % (sizeof(alphabet) - 1)];
+                        length++;
+                    }
+                    break;
+                case 1:
+                    if (at < length) {
+                        memmove(line + at, line + at + 1, length - at);
+                        length--;
+                    }
+                    break;
+                case 2:
+                    if (at < length) {
+                        line[at] = rand() % 255 + 1;
+                    }
+                    break;
+            }
+        }
+        Message m;
+        int result = message_parse(line, &m);
+        CU_ASSERT(result == 0 || result == -1);
+        if (result == 0) {
+            CU_ASSERT(m.count > 0 && m.count <= MESSAGE_FIELDS);
+            if (m.text) {
+                CU_ASSERT(m.text >= line && m.text <= line + length);
+            }
+        }
+    }
+}
+
+static void requests_have_their_own_fields() {
+    char block[] = "B,-40,200,100,15";
+    char position[] = "P,1.5,20,-3.25,0.5,0";
+    char login[] = "A,someone,token";
+    char reply[] = "B,-2,3,-40,200,100,15";
+    Message m;
+    CU_ASSERT(message_parse_request(block, &m) == 0);
+    CU_ASSERT(m.type == 'B' && m.count == 4 && m.fields[3].i == 15);
+    CU_ASSERT(message_parse_request(position, &m) == 0);
+    CU_ASSERT(m.count == 5 && m.fields[2].f == -3.25f);
+    CU_ASSERT(message_parse_request(login, &m) == 0);
+    CU_ASSERT(strcmp(m.text, "someone,token") == 0);
+    CU_ASSERT(message_parse(reply, &m) == 0 && m.count == 6);
+    char unload[] = "X,3,-4";
+    CU_ASSERT(message_parse_request(unload, &m) == 0);
+    CU_ASSERT(m.count == 2 && m.fields[1].i == -4);
+    char unknown[] = "U,1,0,0,0,0,0";
+    CU_ASSERT(message_parse_request(unknown, &m) == -1);
+}
+
+static CU_TestInfo message_tests[] = {
+    {"fields are typed by the tag's format", fields_are_typed_by_tag},
+    {"words and text end the line", text_fields_end_the_line},
+    {"numbers read the same as with sscanf", matches_scanf},
+    {"malformed lines are rejected", malformed_lines_fail},
+    {"mutated lines stay in bounds", mutated_lines_stay_in_bounds},
+    {"client lines use their own fields", requests_have_their_own_fields},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"message suite", NULL, NULL, NULL, NULL, message_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void MessageTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
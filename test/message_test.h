@@ -0,0 +1,7 @@
+#ifndef __MESSAGE_TEST_H__
+#define __MESSAGE_TEST_H__
+
+void MessageTest_AddTests();
+
+
+#endif /* __MESSAGE_TEST_H__ */
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/proto.h"
+#include "../src/config.h"
+
+#include <CUnit/CUnit.h>
+#include "proto_test.h"
+
+static void fixed_records_round_trip() {
+    char data[64];
+    ProtoFrame frame;
+    int v[6];
+
+    int size = proto_block(data, 'L', -2, 3, -40, 200, 100, 15);
+    CU_ASSERT(size == PROTO_BLOCK_SIZE);
+    CU_ASSERT(proto_frame(data, size, &frame) == size);
+    CU_ASSERT(frame.type == 'L');
+    CU_ASSERT(proto_read_ints(&frame, v, 6) == 0);
+    CU_ASSERT(v[0] == -2 && v[1] == 3 && v[2] == -40);
+    CU_ASSERT(v[3] == 200 && v[4] == 100 && v[5] == 15);
+
+    size = proto_key(data, 7, -8, 123456789);
+    CU_ASSERT(proto_frame(data, size, &frame) == PROTO_KEY_SIZE);
+    CU_ASSERT(frame.type == 'K');
+    CU_ASSERT(proto_read_ints(&frame, v, 3) == 0);
+    CU_ASSERT(v[0] == 7 && v[1] == -8 && v[2] == 123456789);
+    CU_ASSERT(proto_read_ints(&frame, v, 2) != 0);
+
+    size = proto_redraw(data, -1, -1);
+    CU_ASSERT(proto_frame(data, size, &frame) == PROTO_REDRAW_SIZE);
+    CU_ASSERT(proto_read_ints(&frame, v, 2) == 0);
+    CU_ASSERT(v[0] == -1 && v[1] == -1);
+}
+
+static void position_round_trip() {
+    char data[64];
+    ProtoFrame frame;
+    int id;
+    float values[5];
+    int size = proto_position(data, 42, 1.5f, -64.25f, 1e6f, 3.14159f, -0.5f);
+    CU_ASSERT(size == PROTO_POSITION_SIZE);
+    CU_ASSERT(proto_frame(data, size, &frame) == size);
+    CU_ASSERT(frame.type == 'P');
+    CU_ASSERT(proto_read_position(&frame, &id, values) == 0);
+    CU_ASSERT(id == 42);
+    CU_ASSERT(values[0] == 1.5f && values[1] == -64.25f);
+    CU_ASSERT(values[2] == 1e6f && values[3] == 3.14159f);
+    CU_ASSERT(values[4] == -0.5f);
+}
+
+static void moves_add_up_to_positions() {
+    char data[64];
+    ProtoFrame frame;
+    int id;
+    float start[5] = {1000.3f, 40.0f, -2000.7f, 6.1f, -1.2f};
+    float end[5] = {1003.9f, 38.5f, -2001.0f, 0.2f, -1.25f};
+    int base[5];
+    int fixed[5];
+    int deltas[5];
+    proto_quantize(start, base);
+    proto_quantize(end, fixed);
+    int size = proto_move(data, 7, base, fixed);
+    CU_ASSERT(size == PROTO_MOVE_SIZE);
+    CU_ASSERT(proto_frame(data, size, &frame) == size);
+    CU_ASSERT(frame.type == 'M');
+    CU_ASSERT(proto_read_move(&frame, &id, deltas) == 0);
+    CU_ASSERT(id == 7);
+    float values[5];
+    for (int i = 0; i < 5; i++) {
+        base[i] += deltas[i];
+    }
+    CU_ASSERT(memcmp(base, fixed, sizeof(base)) == 0);
+    proto_dequantize(base, values);
+    CU_ASSERT(fabsf(values[0] - end[0]) <= 0.5f / PROTO_POSITION_SCALE);
+    CU_ASSERT(fabsf(values[3] - end[3]) <= 0.5f / PROTO_ANGLE_SCALE);
+
+    // teleports do not fit and are sent as positions
+    end[2] = 0;
+    proto_quantize(end, fixed);
+    CU_ASSERT(proto_move(data, 7, base, fixed) == -1);
+}
+
+static void text_frames_carry_lines() {
+    char data[64];
+    ProtoFrame frame;
+    int size = proto_text(data, sizeof(data), "T,hello, world\n");
+    CU_ASSERT(size == PROTO_HEADER_SIZE + 14);
+    CU_ASSERT(proto_frame(data, size, &frame) == size);
+    CU_ASSERT(frame.type == 'T');
+    CU_ASSERT(frame.size == 14);
+    CU_ASSERT(memcmp(frame.data, "T,hello, world", 14) == 0);
+    CU_ASSERT(proto_text(data, 8, "T,hello, world") == -1);
+    CU_ASSERT(proto_text(data, sizeof(data), "") == -1);
+}
+
+static void chunk_round_trip() {
+    int p = -3;
+    int q = 5;
+    int blocks[4 * 3] = {
+        p * CHUNK_SIZE, 0, q * CHUNK_SIZE, 1,
+        p * CHUNK_SIZE + CHUNK_SIZE - 1, 255, q * CHUNK_SIZE + 7, 63,
+        p * CHUNK_SIZE + 4, 12, q * CHUNK_SIZE + CHUNK_SIZE - 1, 0,
+    };
+    int lights[4] = {p * CHUNK_SIZE + 9, 30, q * CHUNK_SIZE + 2, 15};
+    int size = proto_chunk_size(3, 1);
+    char *data = malloc(size);
+    CU_ASSERT(proto_chunk(data, p, q, 99, blocks, 3, lights, 1) == size);
+
+    ProtoFrame frame;
+    ProtoChunk chunk;
+    CU_ASSERT(proto_frame(data, size, &frame) == size);
+    CU_ASSERT(frame.type == 'C');
+    CU_ASSERT(proto_read_chunk(&frame, &chunk) == 0);
+    CU_ASSERT(chunk.p == p && chunk.q == q && chunk.key == 99);
+    CU_ASSERT(chunk.block_count == 3 && chunk.light_count == 1);
+    int same = 1;
+    int x, y, z, w;
+    for (int i = 0; i < 3; i++) {
+        proto_chunk_entry(&chunk, chunk.blocks, i, &x, &y, &z, &w);
+        same = same && x == blocks[i * 4] && y == blocks[i * 4 + 1] &&
+            z == blocks[i * 4 + 2] && w == blocks[i * 4 + 3];
+    }
+    CU_ASSERT(same);
+    proto_chunk_entry(&chunk, chunk.lights, 0, &x, &y, &z, &w);
+    CU_ASSERT(x == lights[0] && y == 30 && z == lights[2] && w == 15);
+    CU_ASSERT(proto_chunk_last(&chunk));
+    chunk.light_count = PROTO_CHUNK_ENTRIES - chunk.block_count;
+    CU_ASSERT(!proto_chunk_last(&chunk));
+
+    // counts that disagree with the frame size are rejected
+    frame.size -= PROTO_CHUNK_ENTRY_SIZE;
+    CU_ASSERT(proto_read_chunk(&frame, &chunk) != 0);
+    free(data);
+}
+
+static void partial_and_corrupt_frames() {
+    char data[128];
+    int first = proto_redraw(data, 1, 2);
+    int second = proto_block(data + first, 'B', 0, 0, 1, 2, 3, 4);
+    ProtoFrame frame;
+    CU_ASSERT(proto_frame(data, 0, &frame) == 0);
+    CU_ASSERT(proto_frame(data, PROTO_HEADER_SIZE - 1, &frame) == 0);
+    CU_ASSERT(proto_frame(data, first - 1, &frame) == 0);
+    CU_ASSERT(proto_frame(data, first + 3, &frame) == first);
+    CU_ASSERT(proto_frame(data + first, second - 1, &frame) == 0);
+    CU_ASSERT(proto_frame(data + first, second, &frame) == second);
+
+    data[3] = 0x7f;
+    CU_ASSERT(proto_frame(data, sizeof(data), &frame) == -1);
+}
+
+static CU_TestInfo proto_tests[] = {
+    {"fixed records decode to the same values", fixed_records_round_trip},
+    {"positions keep full float precision", position_round_trip},
+    {"moves add up to the quantized positions", moves_add_up_to_positions},
+    {"other messages are sent as text frames", text_frames_carry_lines},
+    {"chunk records decode to the same entries", chunk_round_trip},
+    {"partial frames wait and oversized ones fail", partial_and_corrupt_frames},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"proto suite", NULL, NULL, NULL, NULL, proto_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void ProtoTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
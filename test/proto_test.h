@@ -0,0 +1,7 @@
+#ifndef __PROTO_TEST_H__
+#define __PROTO_TEST_H__
+
+void ProtoTest_AddTests();
+
+
+#endif /* __PROTO_TEST_H__ */
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../src/queue.h"
+
+#include <CUnit/CUnit.h>
+#include "queue_test.h"
+
+#define PRODUCERS 4
+#define PRODUCER_ITEMS 100000
+
+typedef struct {
+    int producer;
+    int sequence;
+} QueueItem;
+
+typedef struct {
+    Queue *queue;
+    int producer;
+} Producer;
+
+static int produce(void *arg) {
+    Producer *producer = (Producer *)arg;
+    for (int i = 0; i < PRODUCER_ITEMS; i++) {
+        QueueItem item = {producer->producer, i};
+        queue_put(producer->queue, &item);
+    }
+    return 0;
+}
+
+static int consume_one(void *arg) {
+    Queue *queue = (Queue *)arg;
+    QueueItem item;
+    queue_wait(queue, &item);
+    return item.sequence;
+}
+
+static void get_on_empty_queue_fails() {
+    Queue queue;
+    queue_alloc(&queue, sizeof(QueueItem));
+
+    QueueItem item;
+    CU_ASSERT_FALSE(queue_get(&queue, &item));
+
+    queue_free(&queue);
+}
+
+static void keeps_order_across_segments() {
+    Queue queue;
+    queue_alloc(&queue, sizeof(QueueItem));
+
+    int count = QUEUE_SEGMENT_SIZE * 3 + 5;
+    for (int i = 0; i < count; i++) {
+        QueueItem item = {0, i};
+        queue_put(&queue, &item);
+    }
+    int ordered = 1;
+    QueueItem item;
+    for (int i = 0; i < count; i++) {
+        if (!queue_get(&queue, &item) || item.sequence != i) {
+            ordered = 0;
+        }
+    }
+    CU_ASSERT(ordered);
+    CU_ASSERT_FALSE(queue_get(&queue, &item));
+
+    queue_free(&queue);
+}
+
+static void interleaved_put_and_get() {
+    Queue queue;
+    queue_alloc(&queue, sizeof(QueueItem));
+
+    int next = 0;
+    int ordered = 1;
+    QueueItem item;
+    for (int i = 0; i < QUEUE_SEGMENT_SIZE * 4; i++) {
+        QueueItem a = {0, i * 2};
+        QueueItem b = {0, i * 2 + 1};
+        queue_put(&queue, &a);
+        queue_put(&queue, &b);
+        if (!queue_get(&queue, &item) || item.sequence != next++) {
+            ordered = 0;
+        }
+    }
+    while (queue_get(&queue, &item)) {
+        if (item.sequence != next++) {
+            ordered = 0;
+        }
+    }
+    CU_ASSERT(ordered);
+    CU_ASSERT(next == QUEUE_SEGMENT_SIZE * 8);
+
+    queue_free(&queue);
+}
+
+static void wait_wakes_on_put() {
+    Queue queue;
+    queue_alloc(&queue, sizeof(QueueItem));
+
+    thrd_t thrd;
+    thrd_create(&thrd, consume_one, &queue);
+    struct timespec ts = {0, 10000000};
+    thrd_sleep(&ts, NULL);
+    QueueItem item = {0, 42};
+    queue_put(&queue, &item);
+    int result = 0;
+    thrd_join(thrd, &result);
+    CU_ASSERT(result == 42);
+
+    queue_free(&queue);
+}
+
+static void stress_multiple_producers() {
+    Queue queue;
+    queue_alloc(&queue, sizeof(QueueItem));
+
+    thrd_t threads[PRODUCERS];
+    Producer producers[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i].queue = &queue;
+        producers[i].producer = i;
+        thrd_create(threads + i, produce, producers + i);
+    }
+    int next[PRODUCERS] = {0};
+    int ordered = 1;
+    for (int i = 0; i < PRODUCERS * PRODUCER_ITEMS; i++) {
+        QueueItem item;
+        queue_wait(&queue, &item);
+        if (item.producer < 0 || item.producer >= PRODUCERS ||
+            item.sequence != next[item.producer]++)
+        {
+            ordered = 0;
+        }
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        thrd_join(threads[i], NULL);
+        CU_ASSERT(next[i] == PRODUCER_ITEMS);
+    }
+    CU_ASSERT(ordered);
+    QueueItem item;
+    CU_ASSERT_FALSE(queue_get(&queue, &item));
+
+    queue_free(&queue);
+}
+
+static CU_TestInfo queue_tests[] = {
+    {"get on an empty queue fails", get_on_empty_queue_fails},
+    {"items keep their order across segments", keeps_order_across_segments},
+    {"interleaved puts and gets keep order", interleaved_put_and_get},
+    {"a waiting consumer wakes on put", wait_wakes_on_put},
+    {"stress test with multiple producers", stress_multiple_producers},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"queue suite", NULL, NULL, NULL, NULL, queue_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void QueueTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
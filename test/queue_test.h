@@ -0,0 +1,7 @@
+#ifndef __QUEUE_TEST_H__
+#define __QUEUE_TEST_H__
+
+void QueueTest_AddTests();
+
+
+#endif /* __QUEUE_TEST_H__ */
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../src/region.h"
+#include "../src/config.h"
+
+#include <CUnit/CUnit.h>
+#include "region_test.h"
+
+#define TEST_PATH "region_test.tmp"
+
+static void remove_store(int rp, int rq) {
+    char path[64];
+    snprintf(path, sizeof(path), TEST_PATH "/r.%d.%d.dat", rp, rq);
+    remove(path);
+    remove(TEST_PATH);
+}
+
+static void fill_blob(Blob *blob, int p, int q, int count, int seed) {
+    srand(seed);
+    blob_clear(blob, p, q);
+    for (int i = 0; i < count; i++) {
+        int x = p * CHUNK_SIZE + rand() % CHUNK_SIZE;
+        int z = q * CHUNK_SIZE + rand() % CHUNK_SIZE;
+        blob_set(blob, x, rand() % 256, z, 1 + rand() % 60);
+    }
+    blob_compact(blob);
+}
+
+static int same_entries(Blob *a, Blob *b) {
+    blob_compact(b);
+    if (a->size != b->size) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < a->size; i++) {
+        if (a->data[i].key != b->data[i].key || a->data[i].w != b->data[i].w) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void save_read_round_trip() {
+    RegionStore store;
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    Blob blob, other;
+    blob_alloc(&blob, -2, 3);
+    blob_alloc(&other, -2, 3);
+    fill_blob(&blob, -2, 3, 500, 1);
+
+    CU_ASSERT(region_save(&store, &blob, REGION_BLOCKS) == 0);
+    CU_ASSERT(region_read(&store, &other, REGION_BLOCKS) == 0);
+    CU_ASSERT(same_entries(&blob, &other));
+
+    blob_clear(&other, -2, 3);
+    region_read(&store, &other, REGION_LIGHTS);
+    CU_ASSERT(other.size == 0);
+    blob_clear(&other, -1, 3);
+    region_read(&store, &other, REGION_BLOCKS);
+    CU_ASSERT(other.size == 0);
+
+    blob_free(&other);
+    blob_free(&blob);
+    region_store_close(&store);
+    remove_store(-1, 0);
+}
+
+static void missing_region_loads_nothing() {
+    RegionStore store;
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    Map map;
+    map_alloc(&map, -1, 0, -1, 0x7fff);
+    CU_ASSERT(region_load(&store, &map, 0, 0, REGION_BLOCKS) == 0);
+    CU_ASSERT(map.size == 0);
+    CU_ASSERT(region_file_size(&store, 0, 0) == 0);
+
+    map_free(&map);
+    region_store_close(&store);
+    remove_store(0, 0);
+}
+
+static void reopened_store_keeps_payloads() {
+    RegionStore store;
+    Blob blob, other;
+    blob_alloc(&blob, 5, 7);
+    blob_alloc(&other, 5, 7);
+    fill_blob(&blob, 5, 7, 300, 2);
+
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    region_save(&store, &blob, REGION_LIGHTS);
+    region_sync(&store);
+    region_store_close(&store);
+
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    CU_ASSERT(region_read(&store, &other, REGION_LIGHTS) == 0);
+    CU_ASSERT(same_entries(&blob, &other));
+
+    Map map;
+    map_alloc(&map, 5 * CHUNK_SIZE - 1, 0, 7 * CHUNK_SIZE - 1, 0xf);
+    CU_ASSERT(region_load(&store, &map, 5, 7, REGION_LIGHTS) == 0);
+    CU_ASSERT(map.size == blob.size);
+
+    map_free(&map);
+    blob_free(&other);
+    blob_free(&blob);
+    region_store_close(&store);
+    remove_store(0, 0);
+}
+
+static void sync_compacts_superseded_payloads() {
+    RegionStore store;
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    Blob blob, other;
+    blob_alloc(&blob, 1, 1);
+    blob_alloc(&other, 1, 1);
+    int seed = 0;
+    while (region_file_size(&store, 1, 1) <= REGION_COMPACT_SIZE * 2) {
+        fill_blob(&blob, 1, 1, 2000, ++seed);
+        CU_ASSERT_FATAL(region_save(&store, &blob, REGION_BLOCKS) == 0);
+    }
+    size_t size = region_file_size(&store, 1, 1);
+    region_sync(&store);
+    CU_ASSERT(region_file_size(&store, 1, 1) < size / 4);
+    CU_ASSERT(region_read(&store, &other, REGION_BLOCKS) == 0);
+    CU_ASSERT(same_entries(&blob, &other));
+    region_store_close(&store);
+
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    blob_clear(&other, 1, 1);
+    CU_ASSERT(region_read(&store, &other, REGION_BLOCKS) == 0);
+    CU_ASSERT(same_entries(&blob, &other));
+
+    blob_free(&other);
+    blob_free(&blob);
+    region_store_close(&store);
+    remove_store(0, 0);
+}
+
+// reads a slot's offset from the table on disk of the region at 0, 0
+static unsigned int table_offset(int p, int q, int kind) {
+    unsigned char entry[4] = {0};
+    FILE *file = fopen(TEST_PATH "/r.0.0.dat", "rb");
+    if (file) {
+        fseek(file, 8 + ((p * REGION_SIZE + q) * REGION_KINDS + kind) * 8,
+            SEEK_SET);
+        if (fread(entry, 1, 4, file) != 4) {
+            entry[0] = 0;
+        }
+        fclose(file);
+    }
+    return entry[0] | (entry[1] << 8) | (entry[2] << 16) |
+        ((unsigned int)entry[3] << 24);
+}
+
+static void table_points_at_synced_payloads() {
+    RegionStore store;
+    CU_ASSERT(region_store_open(&store, TEST_PATH) == 0);
+    Blob blob;
+    blob_alloc(&blob, 2, 3);
+    fill_blob(&blob, 2, 3, 100, 3);
+
+    CU_ASSERT(region_save(&store, &blob, REGION_BLOCKS) == 0);
+    CU_ASSERT(table_offset(2, 3, REGION_BLOCKS) == 0);
+    region_sync(&store);
+    CU_ASSERT(table_offset(2, 3, REGION_BLOCKS) == REGION_HEADER_SIZE);
+
+    blob_free(&blob);
+    region_store_close(&store);
+    remove_store(0, 0);
+}
+
+static CU_TestInfo region_tests[] = {
+    {"saved payloads read back", save_read_round_trip},
+    {"missing regions load nothing", missing_region_loads_nothing},
+    {"payloads survive reopening the store", reopened_store_keeps_payloads},
+    {"sync compacts superseded payloads", sync_compacts_superseded_payloads},
+    {"table points at synced payloads", table_points_at_synced_payloads},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"region suite", NULL, NULL, NULL, NULL, region_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void RegionTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
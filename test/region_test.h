@@ -0,0 +1,7 @@
+#ifndef __REGION_TEST_H__
+#define __REGION_TEST_H__
+
+void RegionTest_AddTests();
+
+
+#endif /* __REGION_TEST_H__ */
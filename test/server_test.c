@@ -0,0 +1,508 @@
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../server/server.h"
+#include "../server/shard.h"
+#include "../src/config.h"
+#include "../src/proto.h"
+#include "../src/stream.h"
+#include "../deps/sqlite/sqlite3.h"
+
+#include <CUnit/CUnit.h>
+#include "server_test.h"
+
+static int port;
+static char db_path[64];
+
+typedef struct {
+    int fd;
+    Stream stream;
+} TestClient;
+
+static int init_server() {
+    if (server_open(":memory:", NULL)) {
+        return -1;
+    }
+    server_set_auth(0);
+    port = server_listen("127.0.0.1", 0);
+    if (port <= 0) {
+        return -1;
+    }
+    server_start();
+    return 0;
+}
+
+static int clean_server() {
+    server_stop();
+    return 0;
+}
+
+// a database as server.py leaves it, with a block in chunk 3, 3 under
+// rowid 7, for the shards to split
+static int init_import() {
+    static const char *query =
+        "create table block (p int, q int, x int, y int, z int, w int);"
+        "create table light (p int, q int, x int, y int, z int, w int);"
+        "create table sign ("
+        "    p int, q int, x int, y int, z int, face int, text text);"
+        "create table block_history ("
+        "    timestamp real, user_id int, x int, y int, z int, w int);"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (7, 3, 3, 100, 200, 100, 4);"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (8, -3, 5, -90, 200, 170, 4);"
+        "create table migration (name text);"
+        "insert into migration values ('borders');";
+    sqlite3 *db;
+    snprintf(db_path, sizeof(db_path), "/tmp/craft-server-%d.db", getpid());
+    unlink(db_path);
+    if (sqlite3_open(db_path, &db)) {
+        return -1;
+    }
+    int rc = sqlite3_exec(db, query, NULL, NULL, NULL);
+    sqlite3_close(db);
+    if (rc || server_open(db_path, NULL)) {
+        return -1;
+    }
+    server_set_auth(0);
+    port = server_listen("127.0.0.1", 0);
+    server_start();
+    return port > 0 ? 0 : -1;
+}
+
+static int clean_import() {
+    char path[80];
+    server_stop();
+    unlink(db_path);
+    for (int i = 0; i < SERVER_SHARDS; i++) {
+        snprintf(path, sizeof(path), "%s.%d", db_path, i);
+        unlink(path);
+    }
+    return 0;
+}
+
+static int test_connect(TestClient *client) {
+    struct sockaddr_in address = {0};
+    struct timeval timeout = {2, 0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client->fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    stream_alloc(&client->stream, 1024);
+    return connect(client->fd, (struct sockaddr *)&address, sizeof(address));
+}
+
+static void test_close(TestClient *client) {
+    close(client->fd);
+    stream_free(&client->stream);
+}
+
+static void test_send(TestClient *client, const char *data, int length) {
+    CU_ASSERT(send(client->fd, data, length, 0) == length);
+}
+
+static int test_receive(TestClient *client) {
+    char *space;
+    int size = stream_space(&client->stream, &space);
+    if (!size) {
+        stream_grow(&client->stream, client->stream.capacity * 2);
+        size = stream_space(&client->stream, &space);
+    }
+    int n = recv(client->fd, space, size, 0);
+    if (n <= 0) {
+        return 0;
+    }
+    stream_commit(&client->stream, n);
+    return 1;
+}
+
+// skips lines until one starts with prefix, the rest stays in the stream
+static int expect_line(TestClient *client, const char *prefix, char *line) {
+    int length;
+    char *data;
+    do {
+        while ((data = stream_lines(&client->stream, &length))) {
+            int used = 0;
+            while (used < length) {
+                char *end = memchr(data + used, '\n', length - used);
+                int n = end - (data + used);
+                int found = !strncmp(data + used, prefix, strlen(prefix));
+                if (found && line) {
+                    memcpy(line, data + used, n);
+                    line[n] = '\0';
+                }
+                used += n + 1;
+                if (found) {
+                    stream_consume(&client->stream, used);
+                    return 1;
+                }
+            }
+            stream_consume(&client->stream, length);
+        }
+    } while (test_receive(client));
+    return 0;
+}
+
+static int expect_frame(TestClient *client, char type, char *payload) {
+    int length;
+    char *data;
+    do {
+        while ((data = stream_frames(&client->stream, &length))) {
+            ProtoFrame frame;
+            int used = 0;
+            while (used < length) {
+                used += proto_frame(data + used, length - used, &frame);
+                if (frame.type == type) {
+                    memcpy(payload, frame.data, frame.size);
+                    stream_consume(&client->stream, used);
+                    return frame.size;
+                }
+            }
+            stream_consume(&client->stream, length);
+        }
+    } while (test_receive(client));
+    return -1;
+}
+
+static void join(TestClient *client, int version) {
+    CU_ASSERT(test_connect(client) == 0);
+    test_send(client, "V,1\n", 4);
+    CU_ASSERT(expect_line(client, "T,Welcome to Craft!", NULL));
+    if (version == PROTO_VERSION) {
+        test_send(client, "V,2\n", 4);
+        CU_ASSERT(expect_line(client, "V,2", NULL));
+        test_send(client, "V,2\n", 4);
+    }
+}
+
+static void blocks_are_relayed_and_served() {
+    TestClient a, b;
+    join(&a, 1);
+    join(&b, 1);
+    char line[256];
+    test_send(&b, "C,1,1,0\n", 8);
+    CU_ASSERT(expect_line(&b, "C,1,1", NULL));
+    test_send(&a, "B,40,200,40,5\n", 14);
+    CU_ASSERT(expect_line(&b, "B,1,1,40,200,40,5", NULL));
+    CU_ASSERT(expect_line(&b, "R,1,1", NULL));
+    test_send(&b, "C,1,1,0\n", 8);
+    CU_ASSERT(expect_line(&b, "B,1,1,40,200,40,5", NULL));
+    CU_ASSERT(expect_line(&b, "K,1,1,", line));
+    CU_ASSERT(atoi(line + 6) > 0);
+    CU_ASSERT(expect_line(&b, "R,1,1", NULL));
+    CU_ASSERT(expect_line(&b, "C,1,1", NULL));
+    test_send(&a, "B,40,200,40,0\n", 14);
+    CU_ASSERT(expect_line(&b, "B,1,1,40,200,40,0", NULL));
+    test_close(&a);
+    test_close(&b);
+}
+
+static void version_2_clients_get_frames() {
+    TestClient a, b;
+    join(&a, 1);
+    join(&b, PROTO_VERSION);
+    char data[PROTO_BLOCK_SIZE];
+    char payload[1024];
+    test_send(&a, "C,2,2,0\n", 8);
+    CU_ASSERT(expect_line(&a, "C,2,2", NULL));
+    test_send(&b, data, proto_block(data, 'B', 2, 2, 70, 200, 70, 7));
+    CU_ASSERT(expect_line(&a, "B,2,2,70,200,70,7", NULL));
+    test_send(&b, data, proto_request(data, 2, 2, 0));
+    int size = expect_frame(&b, 'C', payload);
+    CU_ASSERT(size == PROTO_CHUNK_HEADER_SIZE + PROTO_CHUNK_ENTRY_SIZE);
+    ProtoFrame frame = {'C', size, (unsigned char *)payload};
+    ProtoChunk chunk;
+    CU_ASSERT(proto_read_chunk(&frame, &chunk) == 0);
+    CU_ASSERT(chunk.p == 2 && chunk.q == 2 && chunk.key > 0);
+    CU_ASSERT(chunk.block_count == 1 && proto_chunk_last(&chunk));
+    CU_ASSERT(expect_frame(&b, 'R', payload) == 8);
+    test_close(&a);
+    test_close(&b);
+}
+
+static void positions_are_relayed_as_moves() {
+    TestClient a, b;
+    join(&a, PROTO_VERSION);
+    join(&b, PROTO_VERSION);
+    char data[PROTO_POSITION_SIZE];
+    char payload[1024];
+    float position[5] = {10, 20, 30, 0, 0};
+    int base[5];
+    int fixed[5];
+    int id;
+    int deltas[5];
+    ProtoFrame frame = {'M', PROTO_MOVE_SIZE - PROTO_HEADER_SIZE,
+        (unsigned char *)payload};
+    // b joined in version 1, the first position it gets in frames is full
+    proto_quantize(position, base);
+    test_send(&a, data, proto_position(data, 0, 10, 20, 30, 0, 0));
+    CU_ASSERT(expect_frame(&b, 'P', payload) == 24);
+    position[0] = 10.5f;
+    proto_quantize(position, fixed);
+    test_send(&a, data, proto_move(data, 0, base, fixed));
+    CU_ASSERT(expect_frame(&b, 'M', payload) == frame.size);
+    CU_ASSERT(proto_read_move(&frame, &id, deltas) == 0);
+    CU_ASSERT(deltas[0] == PROTO_POSITION_SCALE / 2);
+    CU_ASSERT(deltas[1] == 0 && deltas[2] == 0);
+    test_close(&a);
+    test_close(&b);
+}
+
+static void shards_apply_edits_in_their_regions() {
+    TestClient a, b;
+    join(&a, 1);
+    join(&b, 1);
+    int p = 1;
+    while (shard_index(p, 1) == shard_index(1, 1)) {
+        p += SERVER_REGION_SIZE;
+    }
+    // the shards answer in any order
+    char line[256];
+    char first[256];
+    char second[256];
+    char other[256];
+    snprintf(line, sizeof(line), "C,%d,1,0\nC,1,1,0\n", p);
+    test_send(&b, line, strlen(line));
+    CU_ASSERT(expect_line(&b, "C,", first));
+    CU_ASSERT(expect_line(&b, "C,", second));
+    snprintf(line, sizeof(line), "B,%d,200,40,3\nB,40,200,41,3\n",
+        p * CHUNK_SIZE + 8);
+    test_send(&a, line, strlen(line));
+    snprintf(other, sizeof(other), "B,%d,1,%d,200,40,3", p, p * CHUNK_SIZE + 8);
+    CU_ASSERT(expect_line(&b, "B,", first));
+    CU_ASSERT(expect_line(&b, "B,", second));
+    CU_ASSERT(!strcmp(first, other) || !strcmp(second, other));
+    CU_ASSERT(!strcmp(first, "B,1,1,40,200,41,3") ||
+        !strcmp(second, "B,1,1,40,200,41,3"));
+    snprintf(line, sizeof(line), "C,%d,1,0\nC,1,1,0\n", p);
+    test_send(&b, line, strlen(line));
+    snprintf(other, sizeof(other), "C,%d,1", p);
+    CU_ASSERT(expect_line(&b, "C,", first));
+    CU_ASSERT(expect_line(&b, "C,", second));
+    CU_ASSERT(!strcmp(first, other) || !strcmp(second, other));
+    CU_ASSERT(!strcmp(first, "C,1,1") || !strcmp(second, "C,1,1"));
+    test_close(&a);
+    test_close(&b);
+}
+
+static void changes_go_to_subscribed_clients() {
+    TestClient a, b, c;
+    join(&a, 1);
+    join(&b, 1);
+    join(&c, 1);
+    char line[256];
+    int relayed = 0;
+    test_send(&b, "C,3,1,0\n", 8);
+    CU_ASSERT(expect_line(&b, "C,3,1", NULL));
+    test_send(&c, "C,3,1,0\nX,3,1\n", 14);
+    CU_ASSERT(expect_line(&c, "C,3,1", NULL));
+    test_send(&a, "B,100,200,40,5\n", 15);
+    CU_ASSERT(expect_line(&b, "B,3,1,100,200,40,5", NULL));
+    // c was sent the change before anything that comes after it
+    test_send(&a, "T,done\n", 7);
+    while (expect_line(&c, "", line) && !strstr(line, "> done")) {
+        relayed |= line[0] == 'B' || line[0] == 'R';
+    }
+    CU_ASSERT(!relayed && strstr(line, "> done"));
+    test_close(&a);
+    test_close(&b);
+    test_close(&c);
+}
+
+static void shards_take_their_part_of_a_database() {
+    TestClient a;
+    char line[256];
+    CU_ASSERT(shard_index(3, 3) != shard_index(-3, 5));
+    join(&a, 1);
+    test_send(&a, "C,3,3,0\n", 8);
+    CU_ASSERT(expect_line(&a, "B,3,3,100,200,100,4", NULL));
+    CU_ASSERT(expect_line(&a, "K,3,3,", line));
+    CU_ASSERT(strcmp(line, "K,3,3,7") == 0);
+    test_send(&a, "C,-3,5,7\n", 9);
+    CU_ASSERT(expect_line(&a, "K,-3,5,", line));
+    CU_ASSERT(strcmp(line, "K,-3,5,8") == 0);
+    CU_ASSERT(expect_line(&a, "C,-3,5", NULL));
+    test_send(&a, "C,-3,5,8\n", 9);
+    CU_ASSERT(expect_line(&a, "", line));
+    CU_ASSERT(strcmp(line, "C,-3,5") == 0);
+    test_close(&a);
+}
+
+// the first shard file says it was split into one more shard
+static void shards_refuse_another_layout() {
+    char path[80];
+    char query[256];
+    sqlite3 *db;
+    snprintf(db_path, sizeof(db_path), "/tmp/craft-layout-%d.db", getpid());
+    snprintf(path, sizeof(path), SERVER_SHARDS == 1 ? "%s" : "%s.0", db_path);
+    unlink(path);
+    snprintf(query, sizeof(query),
+        "create table layout (shards int not null, region_size int not null);"
+        "insert into layout values (%d, %d);"
+        "create table migration (name text);"
+        "insert into migration values ('borders');",
+        SERVER_SHARDS + 1, SERVER_REGION_SIZE);
+    CU_ASSERT(sqlite3_open(path, &db) == 0);
+    CU_ASSERT(sqlite3_exec(db, query, NULL, NULL, NULL) == 0);
+    sqlite3_close(db);
+    CU_ASSERT(server_open(db_path, NULL) != 0);
+    unlink(path);
+}
+
+static int count_rows(const char *path, const char *sql) {
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    int result = -1;
+    if (sqlite3_open(path, &db) == 0 &&
+        sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == 0)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            result = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return result;
+}
+
+static int run_server() {
+    if (server_open(db_path, NULL) || server_listen("127.0.0.1", 0) <= 0) {
+        return -1;
+    }
+    server_start();
+    server_stop();
+    return 0;
+}
+
+// the shard holding chunk 3, 3 has its block but no marker, as an older
+// first run could leave it, and imports again; once done it never does
+static void interrupted_imports_start_over() {
+    char path[80];
+    sqlite3 *db;
+    if (SERVER_SHARDS == 1) {
+        return;
+    }
+    snprintf(db_path, sizeof(db_path), "/tmp/craft-reimport-%d.db", getpid());
+    snprintf(path, sizeof(path), "%s.%d", db_path, shard_index(3, 3));
+    for (int i = 0; i < SERVER_SHARDS; i++) {
+        char other[80];
+        snprintf(other, sizeof(other), "%s.%d", db_path, i);
+        unlink(other);
+    }
+    unlink(db_path);
+    CU_ASSERT(sqlite3_open(db_path, &db) == 0);
+    CU_ASSERT(sqlite3_exec(db,
+        "create table block (p int, q int, x int, y int, z int, w int);"
+        "create table light (p int, q int, x int, y int, z int, w int);"
+        "create table sign ("
+        "    p int, q int, x int, y int, z int, face int, text text);"
+        "create table block_history ("
+        "    timestamp real, user_id int, x int, y int, z int, w int);"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (7, 3, 3, 100, 200, 100, 4);"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (9, 3, 3, 95, 200, 100, 4);",
+        NULL, NULL, NULL) == 0);
+    sqlite3_close(db);
+    CU_ASSERT(sqlite3_open(path, &db) == 0);
+    CU_ASSERT(sqlite3_exec(db,
+        "create table block (p int, q int, x int, y int, z int, w int);"
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (7, 3, 3, 100, 200, 100, 4);",
+        NULL, NULL, NULL) == 0);
+    sqlite3_close(db);
+
+    CU_ASSERT_FATAL(run_server() == 0);
+    CU_ASSERT(count_rows(path, "select count(*) from block;") == 1);
+    CU_ASSERT(count_rows(path, "select count(*) from migration;") == 1);
+
+    CU_ASSERT(sqlite3_open(db_path, &db) == 0);
+    CU_ASSERT(sqlite3_exec(db,
+        "insert into block (rowid, p, q, x, y, z, w) "
+        "    values (10, 3, 3, 101, 200, 100, 4);",
+        NULL, NULL, NULL) == 0);
+    sqlite3_close(db);
+    CU_ASSERT_FATAL(run_server() == 0);
+    CU_ASSERT(count_rows(path, "select count(*) from block;") == 1);
+
+    unlink(db_path);
+    for (int i = 0; i < SERVER_SHARDS; i++) {
+        snprintf(path, sizeof(path), "%s.%d", db_path, i);
+        unlink(path);
+    }
+}
+
+// a client world whose blocks are stored as blobs is not split
+static void shards_refuse_to_import_blobs() {
+    sqlite3 *db;
+    if (SERVER_SHARDS == 1) {
+        return;
+    }
+    snprintf(db_path, sizeof(db_path), "/tmp/craft-blobs-%d.db", getpid());
+    unlink(db_path);
+    CU_ASSERT(sqlite3_open(db_path, &db) == 0);
+    CU_ASSERT(sqlite3_exec(db,
+        "create table block (p int, q int, x int, y int, z int, w int);"
+        "pragma user_version = 1;", NULL, NULL, NULL) == 0);
+    sqlite3_close(db);
+    CU_ASSERT(server_open(db_path, NULL) != 0);
+    unlink(db_path);
+    for (int i = 0; i < SERVER_SHARDS; i++) {
+        char path[80];
+        snprintf(path, sizeof(path), "%s.%d", db_path, i);
+        unlink(path);
+    }
+}
+
+static CU_TestInfo layout_tests[] = {
+    {"shards refuse another layout", shards_refuse_another_layout},
+    {"interrupted imports start over", interrupted_imports_start_over},
+    {"shards refuse to import blobs", shards_refuse_to_import_blobs},
+    CU_TEST_INFO_NULL
+};
+
+static CU_TestInfo import_tests[] = {
+    {"shards take their part of a database",
+        shards_take_their_part_of_a_database},
+    CU_TEST_INFO_NULL
+};
+
+static CU_TestInfo server_tests[] = {
+    {"blocks are relayed and served", blocks_are_relayed_and_served},
+    {"version 2 clients get frames", version_2_clients_get_frames},
+    {"positions are relayed as moves", positions_are_relayed_as_moves},
+    {"changes go to subscribed clients", changes_go_to_subscribed_clients},
+    {"shards apply edits in their regions",
+        shards_apply_edits_in_their_regions},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"server suite", init_server, clean_server, NULL, NULL, server_tests},
+    {"server layout suite", NULL, NULL, NULL, NULL, layout_tests},
+    {"server import suite", init_import, clean_import, NULL, NULL,
+        import_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void ServerTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif
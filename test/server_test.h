@@ -0,0 +1,7 @@
+#ifndef __SERVER_TEST_H__
+#define __SERVER_TEST_H__
+
+void ServerTest_AddTests();
+
+
+#endif /* __SERVER_TEST_H__ */
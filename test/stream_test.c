@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/stream.h"
+#include "../src/proto.h"
+
+#include <CUnit/CUnit.h>
+#include "stream_test.h"
+
+static void put(Stream *stream, const char *data, int length) {
+    while (length) {
+        char *space;
+        int n = stream_space(stream, &space);
+        assert(n > 0);
+        n = n < length ? n : length;
+        memcpy(space, data, n);
+        stream_commit(stream, n);
+        data += n;
+        length -= n;
+    }
+}
+
+static void lines_are_borrowed_in_place() {
+    Stream stream;
+    int length;
+    stream_alloc(&stream, 32);
+    put(&stream, "B,1\nK,2\nR,", 10);
+    char *lines = stream_lines(&stream, &length);
+    CU_ASSERT(lines == stream.data);
+    CU_ASSERT(length == 8);
+    CU_ASSERT(memcmp(lines, "B,1\nK,2\n", 8) == 0);
+    stream_consume(&stream, length);
+    CU_ASSERT(stream_lines(&stream, &length) == 0);
+    put(&stream, "3\n", 2);
+    lines = stream_lines(&stream, &length);
+    CU_ASSERT(lines == stream.data + 8);
+    CU_ASSERT(length == 4 && memcmp(lines, "R,3\n", 4) == 0);
+    stream_free(&stream);
+}
+
+static void wrapped_lines_are_spilled() {
+    Stream stream;
+    int length;
+    char *space;
+    stream_alloc(&stream, 16);
+    put(&stream, "T,0123456789\n", 13);
+    stream_consume(&stream, 13);
+    CU_ASSERT(stream_space(&stream, &space) == 3);
+    put(&stream, "T,abcdef\nD", 10);
+    char *lines = stream_lines(&stream, &length);
+    CU_ASSERT(lines == stream.spill);
+    CU_ASSERT(length == 9 && memcmp(lines, "T,abcdef\n", 9) == 0);
+    stream_consume(&stream, length);
+    CU_ASSERT(stream.start == 6 && stream.size == 1);
+    put(&stream, ",1\n", 3);
+    lines = stream_lines(&stream, &length);
+    CU_ASSERT(lines == stream.data + 6);
+    CU_ASSERT(length == 4 && memcmp(lines, "D,1\n", 4) == 0);
+    stream_free(&stream);
+}
+
+static void full_streams_have_no_space() {
+    Stream stream;
+    int length;
+    char *space;
+    stream_alloc(&stream, 8);
+    put(&stream, "T,abcdef", 8);
+    CU_ASSERT(stream_space(&stream, &space) == 0);
+    CU_ASSERT(stream_lines(&stream, &length) == 0);
+    stream_consume(&stream, 2);
+    CU_ASSERT(stream_space(&stream, &space) == 2);
+    CU_ASSERT(space == stream.data);
+    put(&stream, "gh", 2);
+    stream_grow(&stream, 16);
+    CU_ASSERT(stream.start == 0 && stream.size == 8);
+    CU_ASSERT(memcmp(stream.data, "abcdefgh", 8) == 0);
+    CU_ASSERT(stream_space(&stream, &space) == 8);
+    stream_free(&stream);
+}
+
+static void wrapped_frames_are_spilled() {
+    Stream stream;
+    int length;
+    char data[64];
+    stream_alloc(&stream, 40);
+    int size = proto_block(data, 'B', 1, 2, 3, 4, 5, 6);
+    put(&stream, data, size);
+    CU_ASSERT(stream_frames(&stream, &length) == stream.data);
+    CU_ASSERT(length == size);
+    stream_consume(&stream, length);
+
+    // the next header straddles the end of the ring
+    size = proto_key(data, 7, 8, 9);
+    put(&stream, data, size);
+    char *frames = stream_frames(&stream, &length);
+    CU_ASSERT(frames == stream.spill);
+    CU_ASSERT(length == size && memcmp(frames, data, size) == 0);
+    stream_consume(&stream, length);
+    CU_ASSERT(stream.size == 0);
+
+    memset(data, 0x7f, 8);
+    put(&stream, data, 8);
+    CU_ASSERT(stream_frames(&stream, &length) == 0);
+    CU_ASSERT(length == -1);
+    stream_free(&stream);
+}
+
+static CU_TestInfo stream_tests[] = {
+    {"complete lines are borrowed in place", lines_are_borrowed_in_place},
+    {"lines that wrap are copied to the spill", wrapped_lines_are_spilled},
+    {"full streams have no space until consumed", full_streams_have_no_space},
+    {"frames that wrap are copied to the spill", wrapped_frames_are_spilled},
+    CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo suites[] = {
+    {"stream suite", NULL, NULL, NULL, NULL, stream_tests},
+    CU_SUITE_INFO_NULL
+};
+
+void StreamTest_AddTests() {
+    assert(NULL != CU_get_registry());
+    assert(!CU_is_test_running());
+
+    if(CU_register_suites(suites) != CUE_SUCCESS) {
+        fprintf(stderr, "suite registration failed - %s\n", CU_get_error_msg());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef __STREAM_TEST_H__
+#define __STREAM_TEST_H__
+
+void StreamTest_AddTests();
+
+
+#endif /* __STREAM_TEST_H__ */